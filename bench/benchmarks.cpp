@@ -0,0 +1,381 @@
+// micro-benchmarks for the cpu side of a frame: `make bench` (linux, google benchmark),
+// then run ./hello_triangle_bench from the repo root so images/ and shaders/ resolve.
+// No GL context is made. Every GL entry point is stubbed to do nothing, so the numbers
+// are only the cpu work around the calls: the baseline cpu changes get measured against.
+
+// the functions under test live in main.cpp next to main() itself, so the whole file is
+// compiled in here with its main() renamed out of the way
+#define main helloTriangleMain
+#include "../src/main.cpp"
+#undef main
+
+#include <benchmark/benchmark.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// GL stubs. glad loads every entry point through stubProcAddress. Anything without its own
+// stub gets stubCall, which takes no arguments and returns 0. Calling it through another
+// function's pointer type is fine on every ABI this builds for, because the caller cleans up.
+static const GLubyte *APIENTRY stubGetString(GLenum name)
+{
+  return (const GLubyte *)"4.1 stub";
+}
+
+static const GLubyte *APIENTRY stubGetStringi(GLenum name, GLuint index)
+{
+  return (const GLubyte *)"";
+}
+
+// glGen*: hands out made-up names, so nothing ends up as 0 ("none")
+static void APIENTRY stubGen(GLsizei n, GLuint *names)
+{
+  static GLuint next = 1;
+
+  for (GLsizei i = 0; i < n; i++) {
+    names[i] = next++;
+  }
+}
+
+// glad gives up on a context without extensions, so it gets one (named ""); every other
+// query is left alone, since the callers all fill in a default first
+static void APIENTRY stubGetIntegerv(GLenum name, GLint *data)
+{
+  if (name == GL_NUM_EXTENSIONS) {
+    *data = 1;
+  }
+}
+
+// compile and link status: everything succeeds
+static void APIENTRY stubGetObjectiv(GLuint object, GLenum name, GLint *params)
+{
+  *params = GL_TRUE;
+}
+
+static long stubCall()
+{
+  return 0;
+}
+
+static void *stubProcAddress(const char *name)
+{
+  if (strcmp(name, "glGetString") == 0) {
+    return (void *)stubGetString;
+  } else if (strcmp(name, "glGetStringi") == 0) {
+    return (void *)stubGetStringi;
+  } else if (strcmp(name, "glGetIntegerv") == 0) {
+    return (void *)stubGetIntegerv;
+  } else if (strcmp(name, "glGetShaderiv") == 0 || strcmp(name, "glGetProgramiv") == 0) {
+    return (void *)stubGetObjectiv;
+  } else if (strncmp(name, "glGen", 5) == 0 && strncmp(name, "glGenerate", 10) != 0) {
+    return (void *)stubGen;
+  }
+
+  return (void *)stubCall;
+}
+
+// a unit cube with the same layout as main()'s: position, normal, uv; two triangles a face
+static void makeCube(float *out)
+{
+  static const float corners[6][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 1, 1 }, { 0, 1 }, { 0, 0 } };
+
+  for (int face = 0; face < 6; face++) {
+    int axis = face / 2;
+    glm::vec3 normal(0.0f);
+    glm::vec3 u(0.0f);
+    glm::vec3 v(0.0f);
+    normal[axis] = face % 2 ? 1.0f : -1.0f;
+    u[(axis + 1) % 3] = 1.0f;
+    v[(axis + 2) % 3] = 1.0f;
+
+    for (int k = 0; k < 6; k++) {
+      glm::vec3 pos = normal * 0.5f + u * (corners[k][0] - 0.5f) + v * (corners[k][1] - 0.5f);
+      float vertex[8] = { pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, corners[k][0], corners[k][1] };
+      memcpy(out, vertex, sizeof(vertex));
+      out += 8;
+    }
+  }
+}
+
+// what main() sets up for the frame loop, minus everything that needs a real gpu: the
+// lights and their cubes, some spinning cubes with children, and a couple of materials
+typedef struct {
+  Scene scene;
+  PointLights lights;
+  Camera cam;
+  UniformBuffer *materialBuffer;
+  Mesh *cubeMesh;
+  unsigned int cubeMeshId;
+  unsigned int materialIds[2];
+  FramePacket packet;
+} BenchScene;
+
+static float cubeVertices[36 * 8];
+
+static BenchScene *createBenchScene(unsigned int numCubes)
+{
+  BenchScene *bench = new BenchScene;
+  Scene *scene = &bench->scene;
+  setupCam(&bench->cam);
+  scene->instances = NULL;
+  scene->voxels = NULL;
+  scene->voxelMaterialId = 0;
+  scene->cullEntities = true;
+
+  makeCube(cubeVertices);
+  bench->cubeMesh = createMesh(cubeVertices, 36, sizeof(cubeVertices), WITH_ATTRIBUTES);
+  bench->cubeMeshId = addMesh(scene, bench->cubeMesh);
+  bench->materialBuffer = new UniformBuffer(sizeof(MaterialConstants), 4);
+
+  for (int i = 0; i < 2; i++) {
+    Material *mat = createMaterial(NULL, 1, 16.0f, 2 + i, glm::vec3(0.2f), 1, 1);
+    attachMaterialBuffer(mat, bench->materialBuffer);
+    bench->materialIds[i] = addMaterial(scene, mat);
+  }
+
+  for (int i = 0; i < MAX_NUM_OF_LIGHTS; i++) {
+    glm::vec3 pos((i % 11) * 0.3f, (i % 13) * 0.3f, (i % 17) * 0.6f);
+    addPointLight(&bench->lights, &scene->entities, bench->cubeMeshId, bench->materialIds[0], pos);
+  }
+
+  // every other cube spins and carries the next one around, like main()'s cluster
+  EntityHandle spinner = { INVALID_ENTITY_INDEX, 0 };
+
+  for (unsigned int i = 0; i < numCubes; i++) {
+    glm::vec3 pos((float)(i % 32) - 16.0f, (float)(i / 1024), (float)((i / 32) % 32) - 16.0f);
+    unsigned int material = bench->materialIds[(i / 64) % 2];
+    EntityHandle cube = scene->entities.create(bench->cubeMeshId, material, pos, ALL_PASSES);
+    unsigned int index = scene->entities.indexOf(cube);
+    scene->entities.rotationAxes[index] = glm::vec3(1.0f, 0.3f, 0.5f);
+
+    if (i % 2 == 0) {
+      scene->entities.spinRates[index] = glm::radians(20.0f + i % 7);
+      spinner = cube;
+    } else {
+      scene->entities.positions[index] = glm::vec3(1.5f, 0.0f, 0.0f);
+      scene->entities.scales[index] = glm::vec3(0.4f);
+      scene->entities.setParent(cube, spinner);
+    }
+  }
+
+  scene->entities.updateTransforms();
+  initFramePacket(&bench->packet);
+  return bench;
+}
+
+static void destroyBenchScene(BenchScene *bench)
+{
+  for (unsigned int i = 0; i < bench->scene.materials.size(); i++) {
+    if (bench->scene.materials[i]) {
+      destroyMaterial(bench->scene.materials[i]);
+    }
+  }
+
+  destroyMesh(bench->cubeMesh);
+  destroyFramePacket(&bench->packet);
+  delete bench->materialBuffer;
+  delete bench;
+}
+
+static void BM_processCamera(benchmark::State &state)
+{
+  Camera cam;
+  setupCam(&cam);
+  float time = 0.0f;
+
+  for (auto _ : state) {
+    cam.forwardPressed = true;
+    cam.leftPressed = true;
+    cam.shouldJump = cam.canJump;
+    time += 1.0f / 60.0f;
+    processCamera(&cam, 1.0f / 60.0f, time);
+    benchmark::DoNotOptimize(cam.front);
+  }
+}
+BENCHMARK(BM_processCamera);
+
+// range(0) lights moving, with their cubes
+static void BM_updatePointLights(benchmark::State &state)
+{
+  BenchScene *bench = createBenchScene(0);
+  float time = 0.0f;
+
+  for (auto _ : state) {
+    time += 1.0f / 60.0f;
+    updatePointLights(&bench->lights, &bench->scene.entities, state.range(0), time);
+    benchmark::DoNotOptimize(bench->lights.positions.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  destroyBenchScene(bench);
+}
+BENCHMARK(BM_updatePointLights)->Arg(10)->Arg(MAX_NUM_OF_LIGHTS);
+
+// just the animation kernel, on far more lights than the scene can hold
+static void BM_animateLights(benchmark::State &state)
+{
+  unsigned int count = state.range(0);
+  std::vector<float> radii(count), heights(count), orbitRates(count), bobRates(count);
+  std::vector<glm::vec3> colorRates(count), positions(count), ambient(count), diffuse(count), specular(count);
+
+  for (unsigned int i = 0; i < count; i++) {
+    radii[i] = (i % 17) * 0.6f;
+    heights[i] = (i % 13) * 0.3f;
+    orbitRates[i] = (i % 11 + 1) / (2.0f + (i % 3) * 1.5f);
+    bobRates[i] = (i % 11 + 1) / 5.0f;
+    colorRates[i] = glm::vec3((i % 7 + 1) * 0.15f, (i % 11 + 1) * 0.17f, (i % 9 + 1) * 0.13f);
+  }
+
+  LightMotion motion = { radii.data(), heights.data(), orbitRates.data(), bobRates.data(), colorRates.data() };
+  float time = 0.0f;
+
+  for (auto _ : state) {
+    time += 1.0f / 60.0f;
+    animateLights(&motion, time, positions.data(), ambient.data(), diffuse.data(), specular.data(), count);
+    benchmark::DoNotOptimize(positions.data());
+    benchmark::DoNotOptimize(specular.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_animateLights)->Arg(MAX_NUM_OF_LIGHTS)->Arg(1024)->Arg(16384);
+
+// the per-light uniform names for range(0) shaded lights: seven snprintf's a light
+static void BM_sendPointLightUniforms(benchmark::State &state)
+{
+  BenchScene *bench = createBenchScene(0);
+  Shader shader("shaders/light_cube_shader.vs", "shaders/light_cube_shader.fs");
+  updatePointLights(&bench->lights, &bench->scene.entities, MAX_NUM_OF_LIGHTS, 1.0f);
+  buildFramePacket(&bench->packet, &bench->scene, &bench->lights, MAX_NUM_OF_LIGHTS, state.range(0), &bench->cam, 1.0f, 1280, 720);
+
+  for (auto _ : state) {
+    sendPointLightColors(&shader, &bench->packet);
+    sendPointLightPositions(&shader, &bench->packet);
+    sendPointLightAttenuations(&shader, &bench->lights, &bench->packet);
+  }
+
+  state.SetItemsProcessed(state.iterations() * bench->packet.numShaded);
+  destroyBenchScene(bench);
+}
+BENCHMARK(BM_sendPointLightUniforms)->Arg(16)->Arg(MAX_NUM_OF_LIGHTS);
+
+// model + normal matrices for range(0) cubes, half of them children of the other half;
+// what renderGameObject used to do one draw at a time
+static void BM_entityTransforms(benchmark::State &state)
+{
+  BenchScene *bench = createBenchScene(state.range(0));
+  float time = 0.0f;
+
+  for (auto _ : state) {
+    time += 1.0f / 60.0f;
+    bench->scene.entities.animate(time);
+    bench->scene.entities.updateTransforms();
+    benchmark::DoNotOptimize(bench->scene.entities.transforms.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  destroyBenchScene(bench);
+}
+BENCHMARK(BM_entityTransforms)->Arg(16)->Arg(1024)->Arg(16384);
+
+// the castle walls: renderWalls walked them every frame, now they're baked once at load
+static void BM_createWalls(benchmark::State &state)
+{
+  BenchScene *bench = createBenchScene(0);
+
+  for (auto _ : state) {
+    StaticBatchBuilder builder(STATIC_CHUNK_SIZE);
+    createWalls(&builder, bench->cubeMesh, bench->materialIds[0]);
+    benchmark::DoNotOptimize(&builder);
+  }
+
+  destroyBenchScene(bench);
+}
+BENCHMARK(BM_createWalls)->Unit(benchmark::kMillisecond);
+
+// everything the main thread hands the render thread, for range(0) moving cubes
+static void BM_buildFramePacket(benchmark::State &state)
+{
+  BenchScene *bench = createBenchScene(state.range(0));
+  float time = 0.0f;
+
+  for (auto _ : state) {
+    time += 1.0f / 60.0f;
+    updatePointLights(&bench->lights, &bench->scene.entities, MAX_NUM_OF_LIGHTS, time);
+    bench->scene.entities.animate(time);
+    bench->scene.entities.updateTransforms();
+    buildFramePacket(&bench->packet, &bench->scene, &bench->lights, MAX_NUM_OF_LIGHTS, 16, &bench->cam, time, 1280, 720);
+    benchmark::DoNotOptimize(bench->packet.runs[FOR_REAL]);
+  }
+
+  destroyBenchScene(bench);
+}
+BENCHMARK(BM_buildFramePacket)->Arg(16)->Arg(1024);
+
+static void BM_stbiLoad(benchmark::State &state, std::string path)
+{
+  for (auto _ : state) {
+    int width, height, channels;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, 0);
+
+    if (!data) {
+      state.SkipWithError("stbi_load failed");
+      break;
+    }
+
+    stbi_image_free(data);
+  }
+}
+
+static void findImages(const std::string &dir, std::vector<std::string> *paths)
+{
+  DIR *d = opendir(dir.c_str());
+
+  if (!d) {
+    return;
+  }
+
+  while (struct dirent *entry = readdir(d)) {
+    std::string name = entry->d_name;
+    std::string path = dir + "/" + name;
+
+    if (name[0] == '.') {
+      continue;
+    } else if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".png") == 0 || name.compare(name.size() - 4, 4, ".jpg") == 0)) {
+      paths->push_back(path);
+    } else {
+      findImages(path, paths); // not a directory just fails to open
+    }
+  }
+
+  closedir(d);
+}
+
+int main(int argc, char **argv)
+{
+  if (!gladLoadGLLoader((GLADloadproc)stubProcAddress)) {
+    printf("couldn't stub out GL\n");
+    return 1;
+  }
+
+  // one stbi_load benchmark per asset, loaded the way loadTexture does it
+  std::vector<std::string> images;
+  findImages("images", &images);
+  std::sort(images.begin(), images.end());
+  stbi_set_flip_vertically_on_load(true);
+
+  if (images.empty()) {
+    printf("no images found; run from the repo root for the stbi_load benchmarks\n");
+  }
+
+  for (unsigned int i = 0; i < images.size(); i++) {
+    benchmark::RegisterBenchmark(("BM_stbiLoad/" + images[i]).c_str(), BM_stbiLoad, images[i])->Unit(benchmark::kMillisecond);
+  }
+
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
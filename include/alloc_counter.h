@@ -0,0 +1,63 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+
+// counts every trip through the global operator new, so the frame loop can check that
+// it stays off the heap once it's warmed up. Define ALLOC_COUNTER_IMPLEMENTATION in
+// exactly one file before including this to install the counting operator new/delete.
+inline std::atomic<unsigned long long> &allocationCounter()
+{
+  static std::atomic<unsigned long long> count(0);
+  return count;
+}
+
+inline unsigned long long allocationCount()
+{
+  return allocationCounter().load(std::memory_order_relaxed);
+}
+
+#ifdef ALLOC_COUNTER_IMPLEMENTATION
+// every form is replaced explicitly rather than left to the library's forwarding, and
+// kept out of line so the optimizer never sees new's malloc paired with a delete's free
+__attribute__((noinline)) void *operator new(size_t size)
+{
+  allocationCounter().fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+__attribute__((noinline)) void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+#endif
+#endif
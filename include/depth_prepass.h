@@ -0,0 +1,112 @@
+#ifndef DEPTH_PREPASS_H
+#define DEPTH_PREPASS_H
+
+#include <glad/glad.h>
+#include <query_ring.h>
+
+#include <math.h>
+#include <stdio.h>
+
+#define DEPTH_PREPASS_OFF 0
+#define DEPTH_PREPASS_ON 1
+#define DEPTH_PREPASS_AUTO 2
+
+// what a lit fragment costs, in depth-only fragments: the material's textures and the
+// directional shadow's filter, then one more for every point light shaded
+#define DEPTH_PREPASS_BASE_COST 6.0f
+#define DEPTH_PREPASS_LIGHT_COST 1.0f
+// the opaque geometry going through the vertex stage a second time, per pixel
+#define DEPTH_PREPASS_GEOMETRY_COST 0.25f
+#define DEPTH_PREPASS_HYSTERESIS 0.2f
+
+// decides whether the main pass draws its opaque geometry depth-only first, so the lit
+// pass after it (GL_EQUAL, no depth writes) shades each pixel once instead of once per
+// surface that happened to be drawn over it.
+//
+// The evidence is a GL_SAMPLES_PASSED query around whichever opaque pass tests with
+// GL_LESS -- the pre-pass when it's on, the lit pass when it's off -- which counts the
+// same fragments either way: every one that was nearest at the time it was drawn. Over
+// the pixels drawn that's the overdraw, and with the light count it says whether the
+// shading saved pays for drawing the geometry twice. Sky counts as a pixel with nothing
+// in it, so a frame that's half sky reads low; that errs towards leaving it off.
+class DepthPrepass
+{
+public:
+  int mode; // DEPTH_PREPASS_*
+  bool enabled; // this frame's choice
+  float overdraw; // latest measurement: opaque fragments that passed the depth test, per pixel
+
+  DepthPrepass(int mode)
+    : mode(mode), enabled(mode == DEPTH_PREPASS_ON), overdraw(0.0f), samples(1), measured(false), reportedOverdraw(0.0f),
+      numShaded(0)
+  {
+  }
+
+  // starts a frame: takes in whatever counts have come back and, in auto, picks whether
+  // this frame has a pre-pass given `numShaded` point lights
+  void begin(int numShaded)
+  {
+    this->numShaded = numShaded;
+    collect();
+
+    if (mode == DEPTH_PREPASS_AUTO && measured) {
+      decide();
+    }
+  }
+
+  // brackets the opaque draws that test with GL_LESS; `pixels` is the area drawn into
+  void beginCount(int pixels)
+  {
+    glBeginQuery(GL_SAMPLES_PASSED, samples.query(0));
+    pixelCounts[samples.current()] = pixels;
+  }
+
+  void endCount()
+  {
+    glEndQuery(GL_SAMPLES_PASSED);
+    samples.advance();
+  }
+
+  void release()
+  {
+    samples.release();
+  }
+
+private:
+  QueryRing samples;
+  int pixelCounts[QUERY_RING_FRAMES]; // what each frame's count is out of
+  bool measured; // a count has come back
+  float reportedOverdraw;
+  int numShaded;
+
+  // reads back finished counts, oldest first
+  void collect()
+  {
+    for (int slot = samples.next(); slot >= 0; slot = samples.next()) {
+      overdraw = (float)samples.result(slot, 0) / pixelCounts[slot];
+      samples.consumed();
+      measured = true;
+    }
+
+    if (fabsf(overdraw - reportedOverdraw) >= 0.25f) {
+      reportedOverdraw = overdraw;
+      printf("overdraw %.2f with %d lights, depth pre-pass %s\n", overdraw, numShaded, enabled ? "on" : "off");
+    }
+  }
+
+  // the pre-pass saves shading every fragment but the nearest, and costs drawing all of
+  // them again depth-only; it has to win by a margin to switch, so it doesn't flicker
+  void decide()
+  {
+    float fragmentCost = DEPTH_PREPASS_BASE_COST + numShaded * DEPTH_PREPASS_LIGHT_COST;
+    float saved = (overdraw - 1.0f) * fragmentCost;
+    float spent = overdraw + DEPTH_PREPASS_GEOMETRY_COST;
+    bool worthIt = saved > spent * (enabled ? 1.0f - DEPTH_PREPASS_HYSTERESIS : 1.0f + DEPTH_PREPASS_HYSTERESIS);
+
+    if (worthIt != enabled) {
+      enabled = worthIt;
+      printf("depth pre-pass %s: overdraw %.2f with %d lights\n", enabled ? "on" : "off", overdraw, numShaded);
+    }
+  }
+};
+#endif
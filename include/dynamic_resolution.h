@@ -0,0 +1,198 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+#include <query_ring.h>
+#include <shader.h>
+
+#include <math.h>
+#include <stdio.h>
+
+#define RESOLUTION_MIN_SCALE 0.5f // per axis, so a quarter of the pixels at worst
+#define RESOLUTION_KP 0.2f
+#define RESOLUTION_KI 0.05f
+#define RESOLUTION_KD 0.05f
+
+// renders the scene into an offscreen color+depth target at a fraction of the window's
+// size, picked each frame so the gpu stays inside a time budget, then stretches it over
+// the window with a sharpening filter. The target is allocated at full size once, and
+// only the corner in use is drawn and sampled, so changing the scale costs nothing.
+//
+// GL_TIME_ELAPSED queries around each frame feed a PID controller on the rendered pixel
+// area (which is what the gpu time scales with); its integral term is what holds the
+// area steady once the budget is met.
+class DynamicResolution
+{
+public:
+  float scale; // per axis, in [RESOLUTION_MIN_SCALE, 1]
+  float budgetMs; // gpu time per frame to aim for; 0 always draws at full size
+  float sharpness;
+  float lastGpuMs; // most recent measurement
+  unsigned int texture; // color target; texture id == texture unit, like the others
+  int width; // of the target, i.e. the window's framebuffer
+  int height;
+
+  DynamicResolution(float budgetMs, float sharpness) :
+    scale(1.0f), budgetMs(budgetMs), sharpness(sharpness), lastGpuMs(0.0f), texture(0), width(0), height(0),
+    fbo(0), depth(0), timers(1), integral(1.0f / RESOLUTION_KI), lastError(0.0f), reportedScale(1.0f)
+  {
+    glGenVertexArrays(1, &emptyVao); // core profile won't draw without one bound
+  }
+
+  // starts a frame: picks this frame's scale from whatever timings have come back,
+  // (re)allocates the target if the window's framebuffer changed size, and starts timing
+  void begin(int framebufferWidth, int framebufferHeight)
+  {
+    if (framebufferWidth != width || framebufferHeight != height) {
+      allocate(framebufferWidth, framebufferHeight);
+    }
+
+    collect();
+    glBeginQuery(GL_TIME_ELAPSED, timers.query(0));
+  }
+
+  int scaledWidth()
+  {
+    int w = (int)(width * scale);
+    return w > 0 ? w : 1;
+  }
+
+  int scaledHeight()
+  {
+    int h = (int)(height * scale);
+    return h > 0 ? h : 1;
+  }
+
+  // makes the offscreen target current, covering just the part in use this frame
+  void bindTarget()
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, scaledWidth(), scaledHeight());
+  }
+
+  // the offscreen target itself, for reading back what was drawn into it
+  unsigned int framebuffer()
+  {
+    return fbo;
+  }
+
+  // stretches this frame's part of the target over the whole default framebuffer and
+  // stops timing. `shader` is the upscale program.
+  void end(Shader *shader)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glDisable(GL_DEPTH_TEST);
+
+    shader->use();
+    shader->setInt("scene", texture);
+    shader->setVec2f("uvScale", (float)scaledWidth() / width, (float)scaledHeight() / height);
+    shader->setVec2f("texelSize", 1.0f / width, 1.0f / height);
+    shader->setFloat("sharpness", scale < 1.0f ? sharpness : 0.0f);
+    glActiveTexture(GL_TEXTURE0 + texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glEnable(GL_DEPTH_TEST);
+    glEndQuery(GL_TIME_ELAPSED);
+    timers.advance();
+  }
+
+  // frees every GL object; call with the context current before it goes away
+  void release()
+  {
+    releaseTarget();
+    timers.release();
+    glDeleteVertexArrays(1, &emptyVao);
+  }
+
+private:
+  unsigned int fbo;
+  unsigned int depth;
+  unsigned int emptyVao;
+  QueryRing timers;
+  float integral;
+  float lastError;
+  float reportedScale;
+
+  void releaseTarget()
+  {
+    if (fbo) {
+      glDeleteFramebuffers(1, &fbo);
+      glDeleteTextures(1, &texture);
+      glDeleteRenderbuffers(1, &depth);
+      fbo = texture = depth = 0;
+    }
+  }
+
+  void allocate(int w, int h)
+  {
+    releaseTarget();
+    width = w;
+    height = h;
+
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      printf("dynamic resolution target %dx%d is incomplete\n", w, h);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    printf("dynamic resolution target: %dx%d, texture id %u\n", w, h, texture);
+  }
+
+  // reads back finished timer queries, oldest first, and runs the controller on each
+  void collect()
+  {
+    for (int slot = timers.next(); slot >= 0; slot = timers.next()) {
+      lastGpuMs = timers.result(slot, 0) / 1000000.0f;
+      timers.consumed();
+      control(lastGpuMs);
+    }
+  }
+
+  void control(float gpuMs)
+  {
+    if (budgetMs <= 0.0f) {
+      scale = 1.0f;
+      return;
+    }
+
+    // error is how much of the budget is left over, so positive means there's room to grow
+    float minArea = RESOLUTION_MIN_SCALE * RESOLUTION_MIN_SCALE;
+    float error = (budgetMs - gpuMs) / budgetMs;
+    float derivative = error - lastError;
+    lastError = error;
+
+    // anti-windup: the integral alone never asks for more than the allowed range
+    integral += error;
+    integral = fminf(fmaxf(integral, minArea / RESOLUTION_KI), 1.0f / RESOLUTION_KI);
+
+    float area = RESOLUTION_KI * integral + RESOLUTION_KP * error + RESOLUTION_KD * derivative;
+    area = fminf(fmaxf(area, minArea), 1.0f);
+    scale = sqrtf(area);
+
+    if (fabsf(scale - reportedScale) >= 0.05f) {
+      reportedScale = scale;
+      printf("resolution scale %.2f (%dx%d), gpu %.2f ms of %.2f\n", scale, scaledWidth(), scaledHeight(), gpuMs, budgetMs);
+    }
+  }
+};
+#endif
@@ -0,0 +1,321 @@
+#ifndef ENTITY_STORE_H
+#define ENTITY_STORE_H
+
+#include <glm/glm.hpp>
+#include <transform_kernel.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+#define INVALID_ENTITY_INDEX 0xFFFFFFFFu
+
+// handles stay valid while the dense arrays get compacted underneath them; the generation
+// catches a stale handle whose entity was destroyed and whose slot has since been reused
+typedef struct {
+  unsigned int slot;
+  unsigned int generation;
+} EntityHandle;
+
+// every scene object's components, stored as parallel arrays so per-frame loops walk
+// memory linearly instead of chasing a pointer per object. Entity i (a dense index, not
+// a handle) owns element i of every array; destroying one swaps the last entity into
+// its place, so indices aren't stable across destroy() but handles are.
+//
+// entities can hang off a parent, in which case their position/rotation/scale are
+// relative to it. Anything that writes those arrays has to markDirty() the entity;
+// updateTransforms() then only recomputes dirty entities and the subtrees below them,
+// so static things cost nothing per frame.
+class EntityStore
+{
+public:
+  EntityStore() : changedFirst(0), changedEnd(0), hierarchyDirty(false) {}
+
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> rotationAxes;
+  std::vector<float> baseAngles; // radians
+  std::vector<float> spinRates; // radians per second, 0 for anything that doesn't turn
+  std::vector<float> angles; // baseAngle + time * spinRate, refreshed by animate()
+  std::vector<glm::vec3> scales;
+  std::vector<InstanceTransform> transforms; // world model + normal matrix, refreshed by updateTransforms()
+  std::vector<InstanceTransform> locals; // the same, relative to the parent
+  std::vector<EntityHandle> parents; // slot is INVALID_ENTITY_INDEX for roots
+  std::vector<unsigned char> dirty;
+  std::vector<unsigned int> meshIds;
+  std::vector<unsigned int> materialIds;
+  std::vector<unsigned int> passMasks; // which render passes draw this entity
+
+  unsigned int size() const
+  {
+    return positions.size();
+  }
+
+  void reserve(unsigned int count)
+  {
+    positions.reserve(count);
+    rotationAxes.reserve(count);
+    baseAngles.reserve(count);
+    spinRates.reserve(count);
+    angles.reserve(count);
+    scales.reserve(count);
+    transforms.reserve(count);
+    locals.reserve(count);
+    parents.reserve(count);
+    dirty.reserve(count);
+    meshIds.reserve(count);
+    materialIds.reserve(count);
+    passMasks.reserve(count);
+    indexToSlot.reserve(count);
+  }
+
+  EntityHandle create(unsigned int meshId, unsigned int materialId, glm::vec3 pos, unsigned int passMask)
+  {
+    EntityHandle handle;
+
+    if (!freeSlots.empty()) {
+      handle.slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      handle.slot = slotToIndex.size();
+      slotToIndex.push_back(INVALID_ENTITY_INDEX);
+      slotGenerations.push_back(0);
+    }
+
+    handle.generation = slotGenerations[handle.slot];
+    slotToIndex[handle.slot] = size();
+    indexToSlot.push_back(handle.slot);
+
+    positions.push_back(pos);
+    rotationAxes.push_back(glm::vec3(1.0f));
+    baseAngles.push_back(0.0f);
+    spinRates.push_back(0.0f);
+    angles.push_back(0.0f);
+    scales.push_back(glm::vec3(1.0f));
+    transforms.push_back(InstanceTransform());
+    locals.push_back(InstanceTransform());
+    parents.push_back(noParent());
+    dirty.push_back(1);
+    meshIds.push_back(meshId);
+    materialIds.push_back(materialId);
+    passMasks.push_back(passMask);
+    hierarchyDirty = true;
+    return handle;
+  }
+
+  void destroy(EntityHandle handle)
+  {
+    if (!alive(handle)) {
+      return;
+    }
+
+    unsigned int index = slotToIndex[handle.slot];
+    unsigned int last = size() - 1;
+
+    if (index != last) {
+      positions[index] = positions[last];
+      rotationAxes[index] = rotationAxes[last];
+      baseAngles[index] = baseAngles[last];
+      spinRates[index] = spinRates[last];
+      angles[index] = angles[last];
+      scales[index] = scales[last];
+      transforms[index] = transforms[last];
+      locals[index] = locals[last];
+      parents[index] = parents[last];
+      dirty[index] = 1;
+      meshIds[index] = meshIds[last];
+      materialIds[index] = materialIds[last];
+      passMasks[index] = passMasks[last];
+      indexToSlot[index] = indexToSlot[last];
+      slotToIndex[indexToSlot[index]] = index;
+    }
+
+    positions.pop_back();
+    rotationAxes.pop_back();
+    baseAngles.pop_back();
+    spinRates.pop_back();
+    angles.pop_back();
+    scales.pop_back();
+    transforms.pop_back();
+    locals.pop_back();
+    parents.pop_back();
+    dirty.pop_back();
+    meshIds.pop_back();
+    materialIds.pop_back();
+    passMasks.pop_back();
+    indexToSlot.pop_back();
+
+    slotToIndex[handle.slot] = INVALID_ENTITY_INDEX;
+    slotGenerations[handle.slot]++;
+    freeSlots.push_back(handle.slot);
+    hierarchyDirty = true; // any children are roots from here on
+  }
+
+  void setParent(EntityHandle child, EntityHandle parent)
+  {
+    unsigned int index = indexOf(child);
+
+    if (index != INVALID_ENTITY_INDEX) {
+      parents[index] = parent;
+      hierarchyDirty = true;
+    }
+  }
+
+  void markDirty(unsigned int index)
+  {
+    dirty[index] = 1;
+  }
+
+  bool alive(EntityHandle handle) const
+  {
+    return handle.slot < slotToIndex.size() && slotGenerations[handle.slot] == handle.generation &&
+           slotToIndex[handle.slot] != INVALID_ENTITY_INDEX;
+  }
+
+  // dense index of a live entity, INVALID_ENTITY_INDEX otherwise
+  unsigned int indexOf(EntityHandle handle) const
+  {
+    return alive(handle) ? slotToIndex[handle.slot] : INVALID_ENTITY_INDEX;
+  }
+
+  void animate(float time)
+  {
+    for (unsigned int i = 0; i < size(); i++) {
+      if (spinRates[i] != 0.0f) {
+        angles[i] = baseAngles[i] + time * spinRates[i];
+        dirty[i] = 1;
+      } else if (angles[i] != baseAngles[i]) {
+        angles[i] = baseAngles[i];
+        dirty[i] = 1;
+      }
+    }
+  }
+
+  // afterwards [changedFirst, changedEnd) covers every entity whose world transform moved
+  void updateTransforms()
+  {
+    if (hierarchyDirty) {
+      rebuildHierarchy();
+    }
+
+    // local matrices, one kernel batch per run of neighbouring dirty entities
+    for (unsigned int i = 0; i < size();) {
+      if (!dirty[i]) {
+        i++;
+        continue;
+      }
+
+      unsigned int first = i;
+
+      while (i < size() && dirty[i]) {
+        i++;
+      }
+
+      computeTransforms(&positions[first], &rotationAxes[first], &angles[first], &scales[first], &locals[first], i - first);
+    }
+
+    // world matrices, a level at a time. A level only reads the one above it, so the
+    // entities within a level are independent of each other. A parent that changed
+    // marks its children dirty on the way down, so whole subtrees follow it.
+    changedFirst = size();
+    changedEnd = 0;
+
+    for (unsigned int level = 0; level + 1 < levelStarts.size(); level++) {
+      for (unsigned int k = levelStarts[level]; k < levelStarts[level + 1]; k++) {
+        unsigned int i = order[k];
+        unsigned int parent = parentIndices[i];
+
+        if (parent != INVALID_ENTITY_INDEX && dirty[parent]) {
+          dirty[i] = 1;
+        }
+
+        if (!dirty[i]) {
+          continue;
+        }
+
+        if (parent == INVALID_ENTITY_INDEX) {
+          transforms[i] = locals[i];
+        } else {
+          combineTransforms(transforms[parent], locals[i], &transforms[i]);
+        }
+
+        changedFirst = i < changedFirst ? i : changedFirst;
+        changedEnd = i + 1 > changedEnd ? i + 1 : changedEnd;
+      }
+    }
+
+    if (changedFirst >= changedEnd) {
+      changedFirst = changedEnd = 0;
+    }
+
+    for (unsigned int i = changedFirst; i < changedEnd; i++) {
+      dirty[i] = 0;
+    }
+  }
+
+  unsigned int changedFirst;
+  unsigned int changedEnd;
+
+private:
+  bool hierarchyDirty;
+  std::vector<unsigned int> parentIndices; // dense index of each entity's parent, resolved by rebuildHierarchy()
+  std::vector<unsigned int> order; // dense indices, breadth first: every root, then their children, ...
+  std::vector<unsigned int> levelStarts; // level n is order[levelStarts[n], levelStarts[n + 1])
+  std::vector<unsigned int> slotToIndex;
+  std::vector<unsigned int> slotGenerations;
+  std::vector<unsigned int> indexToSlot;
+  std::vector<unsigned int> freeSlots;
+
+  static EntityHandle noParent()
+  {
+    EntityHandle handle = { INVALID_ENTITY_INDEX, 0 };
+    return handle;
+  }
+
+  // only runs after entities are created, destroyed or re-parented, never on a plain frame
+  void rebuildHierarchy()
+  {
+    std::vector<unsigned int> depths(size(), 0);
+    unsigned int maxDepth = 0;
+    parentIndices.resize(size());
+
+    for (unsigned int i = 0; i < size(); i++) {
+      parentIndices[i] = parents[i].slot == INVALID_ENTITY_INDEX ? INVALID_ENTITY_INDEX : indexOf(parents[i]);
+    }
+
+    for (unsigned int i = 0; i < size(); i++) {
+      for (unsigned int p = parentIndices[i]; p != INVALID_ENTITY_INDEX && depths[i] <= size(); p = parentIndices[p]) {
+        depths[i]++;
+      }
+
+      if (depths[i] > size()) {
+        printf("entity %u is its own ancestor, detaching it\n", i);
+        parentIndices[i] = INVALID_ENTITY_INDEX;
+        depths[i] = 0;
+      }
+
+      maxDepth = depths[i] > maxDepth ? depths[i] : maxDepth;
+    }
+
+    // counting sort by depth, so each level is one contiguous stretch of `order`
+    levelStarts.assign(maxDepth + 2, 0);
+
+    for (unsigned int i = 0; i < size(); i++) {
+      levelStarts[depths[i] + 1]++;
+    }
+
+    for (unsigned int level = 1; level < levelStarts.size(); level++) {
+      levelStarts[level] += levelStarts[level - 1];
+    }
+
+    std::vector<unsigned int> cursor(levelStarts.begin(), levelStarts.end() - 1);
+    order.resize(size());
+
+    for (unsigned int i = 0; i < size(); i++) {
+      order[cursor[depths[i]]++] = i;
+      dirty[i] = 1;
+    }
+
+    hierarchyDirty = false;
+  }
+};
+#endif
@@ -0,0 +1,65 @@
+#ifndef FRAME_HANDOFF_H
+#define FRAME_HANDOFF_H
+
+#include <atomic>
+#include <thread>
+
+// a bounded single-producer/single-consumer queue of N reusable slots, for passing whole
+// frames from the thread that simulates them to the thread that draws them. Slots are
+// filled in place, so nothing is copied or allocated per frame, and neither side ever
+// takes a lock. With N = 2 the next frame is built while the last one is drawn; the
+// producer waits if it gets N frames ahead. N must be a power of two.
+template <typename T, unsigned int N>
+class FrameHandoff
+{
+public:
+  FrameHandoff() : written(0), read(0) {}
+
+  // every slot, for setting them up before either thread starts using the queue
+  T *slot(unsigned int i)
+  {
+    return &slots[i];
+  }
+
+  // the next slot to fill in, once the consumer is done with whatever was in it
+  T *beginWrite()
+  {
+    unsigned int w = written.load(std::memory_order_relaxed);
+
+    while (w - read.load(std::memory_order_acquire) == N) {
+      std::this_thread::yield();
+    }
+
+    return &slots[w % N];
+  }
+
+  // hands the slot from beginWrite() to the consumer
+  void endWrite()
+  {
+    written.store(written.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // the oldest slot the producer has handed over, waiting until there is one
+  T *beginRead()
+  {
+    unsigned int r = read.load(std::memory_order_relaxed);
+
+    while (written.load(std::memory_order_acquire) == r) {
+      std::this_thread::yield();
+    }
+
+    return &slots[r % N];
+  }
+
+  // gives the slot from beginRead() back to the producer
+  void endRead()
+  {
+    read.store(read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+private:
+  T slots[N];
+  std::atomic<unsigned int> written; // slots ever handed to the consumer
+  std::atomic<unsigned int> read; // slots ever given back
+};
+#endif
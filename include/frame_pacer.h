@@ -0,0 +1,158 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+
+#include <chrono>
+#include <thread>
+
+#define PACER_MAX_QUEUED_FRAMES 8 // fence ring size; one more than the deepest queue allowed
+#define PACER_SPIN_MARGIN 0.002 // seconds before a deadline to stop sleeping and start spinning
+#define PACER_REPORT_INTERVAL 1.0 // seconds between printed reports
+
+// keeps frames evenly spaced and the gpu queue short. The main thread calls
+// waitForNextFrame() before sampling input; whoever owns the context calls frameSwapped()
+// right after each swap, which fences the frame, waits if too many are in flight, and
+// keeps the frame time and input-to-swap latency numbers it prints once a second.
+class FramePacer
+{
+public:
+  double frameInterval; // seconds; 0 doesn't limit
+  unsigned int maxQueuedFrames; // frames the gpu may be behind by; 0 doesn't wait
+
+  FramePacer(int targetFps, unsigned int maxQueuedFrames) :
+    frameInterval(targetFps > 0 ? 1.0 / targetFps : 0.0),
+    maxQueuedFrames(maxQueuedFrames < PACER_MAX_QUEUED_FRAMES ? maxQueuedFrames : PACER_MAX_QUEUED_FRAMES - 1),
+    nextDeadline(0.0), firstFence(0), numFences(0), lastSwap(0.0), reportStart(0.0)
+  {
+    resetStats();
+  }
+
+  // one clock for everything that gets compared, on any thread
+  static double now()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // holds the calling thread until the next frame is due. Sleeping can overshoot by a
+  // millisecond or more, so the last PACER_SPIN_MARGIN is spun instead. A frame that
+  // runs late just starts the schedule over rather than rushing the ones after it.
+  void waitForNextFrame()
+  {
+    if (frameInterval <= 0.0) {
+      return;
+    }
+
+    double t = now();
+
+    if (nextDeadline == 0.0 || t > nextDeadline + frameInterval) {
+      nextDeadline = t;
+    }
+
+    double sleepFor = nextDeadline - t - PACER_SPIN_MARGIN;
+
+    if (sleepFor > 0.0) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(sleepFor));
+    }
+
+    while (now() < nextDeadline) {
+      // spin
+    }
+
+    nextDeadline += frameInterval;
+  }
+
+  // call on the context's thread right after swapping the frame whose input was
+  // sampled at `inputTime` (a now() value)
+  void frameSwapped(double inputTime)
+  {
+    double swapped = now();
+    double gpuWait = throttleGpu();
+
+    if (lastSwap > 0.0) {
+      double frameTime = swapped - lastSwap;
+      double latency = swapped - inputTime;
+      frames++;
+      frameTimeTotal += frameTime;
+      latencyTotal += latency;
+      gpuWaitTotal += gpuWait;
+      frameTimeWorst = frameTime > frameTimeWorst ? frameTime : frameTimeWorst;
+      latencyWorst = latency > latencyWorst ? latency : latencyWorst;
+    } else {
+      reportStart = swapped;
+    }
+
+    lastSwap = swapped;
+
+    if (swapped - reportStart >= PACER_REPORT_INTERVAL && frames > 0) {
+      printf("frame time %.2f ms (worst %.2f), input-to-swap latency %.2f ms (worst %.2f), %.2f ms waiting on the gpu\n",
+             frameTimeTotal * 1000.0 / frames, frameTimeWorst * 1000.0, latencyTotal * 1000.0 / frames,
+             latencyWorst * 1000.0, gpuWaitTotal * 1000.0 / frames);
+      resetStats();
+      reportStart = swapped;
+    }
+  }
+
+  // deletes any fences still queued; call with the context current before it goes away
+  void release()
+  {
+    while (numFences > 0) {
+      glDeleteSync(fences[firstFence]);
+      firstFence = (firstFence + 1) % PACER_MAX_QUEUED_FRAMES;
+      numFences--;
+    }
+  }
+
+private:
+  double nextDeadline;
+  GLsync fences[PACER_MAX_QUEUED_FRAMES]; // ring, oldest at firstFence
+  unsigned int firstFence;
+  unsigned int numFences;
+  double lastSwap;
+  double reportStart;
+  unsigned int frames;
+  double frameTimeTotal;
+  double frameTimeWorst;
+  double latencyTotal;
+  double latencyWorst;
+  double gpuWaitTotal;
+
+  void resetStats()
+  {
+    frames = 0;
+    frameTimeTotal = frameTimeWorst = 0.0;
+    latencyTotal = latencyWorst = 0.0;
+    gpuWaitTotal = 0.0;
+  }
+
+  // fences the frame just swapped, then blocks until no more than maxQueuedFrames are
+  // unfinished; returns how long that took
+  double throttleGpu()
+  {
+    if (maxQueuedFrames == 0) {
+      return 0.0;
+    }
+
+    double start = now();
+    fences[(firstFence + numFences) % PACER_MAX_QUEUED_FRAMES] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    numFences++;
+
+    while (numFences > maxQueuedFrames) {
+      GLsync oldest = fences[firstFence];
+
+      // the flush bit makes sure the fence actually gets to the gpu before we wait on it
+      while (glClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {
+        // keep waiting; 100ms at a time
+      }
+
+      glDeleteSync(oldest);
+      firstFence = (firstFence + 1) % PACER_MAX_QUEUED_FRAMES;
+      numFences--;
+    }
+
+    return now() - start;
+  }
+};
+#endif
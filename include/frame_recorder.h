@@ -0,0 +1,805 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define RECORDER_READBACKS 3 // pixel buffers in flight; each is mapped this many frames after its read
+#define RECORDER_JOBS_PER_WORKER 2 // frames waiting for or being encoded, per worker
+#define RECORDER_HASH_BITS 15
+#define RECORDER_WINDOW 32768 // how far back deflate may point
+#define RECORDER_MAX_CHAIN 16 // match candidates tried per byte; more is smaller and slower
+
+enum RecordFormat {
+  RECORD_PNG, // one numbered file per frame
+  RECORD_RAW, // rgb24 frames back to back, top row first, no header
+  RECORD_Y4M // yuv4mpeg2, 4:2:0
+};
+
+// one frame on its way from the gpu to the output
+typedef struct {
+  std::vector<unsigned char> pixels; // rgba8, bottom row first, the way GL reads it
+  std::vector<unsigned char> encoded; // exactly what gets written out for this frame
+  unsigned int frame;
+} RecorderJob;
+
+// a png worker's own buffers, kept from frame to frame
+typedef struct {
+  std::vector<unsigned char> filtered; // every scanline behind its filter byte: what gets deflated
+  std::vector<unsigned char> rows[2]; // this scanline and the one above, as rgb
+  std::vector<unsigned char> candidates[5]; // this scanline under each png filter
+  std::vector<int> head; // last position seen for each hash of three bytes
+  std::vector<int> prev; // earlier positions with the same hash, by position % RECORDER_WINDOW
+} RecorderScratch;
+
+// deflate packs values lowest bit first, but huffman codes highest bit first
+typedef struct {
+  std::vector<unsigned char> *out;
+  unsigned int buffer;
+  int count;
+} RecorderBits;
+
+// gets frames off the gpu and onto disk without stalling the frame that drew them.
+// capture() only queues a glReadPixels into a pixel buffer and fences it; the buffer is
+// mapped a couple of frames later, once its fence has passed, and copied out to a job
+// that worker threads encode while the next frames render. Streams are written in frame
+// order; png files go out in whatever order they finish.
+//
+// The pngs are real deflate (fixed huffman codes, hash chain matching), so there's no
+// zlib to link; rendered frames compress well enough that way.
+class FrameRecorder
+{
+public:
+  int width;
+  int height;
+  unsigned int framesCaptured;
+
+  // `dest` is a printf pattern for the frame number with RECORD_PNG (or a directory, to
+  // get 00000.png, ...), otherwise the file to stream to. "-" streams to stdout, and the
+  // app's own printing goes to stderr from then on so it can't get into the stream.
+  FrameRecorder(RecordFormat format, const char *dest, int width, int height, int fps, unsigned int numWorkers) :
+    width(width), height(height), framesCaptured(0), format(format), stream(NULL), reportedOpenFailure(false),
+    firstReadback(0), numReadbacks(0), queueFirst(0), numQueued(0), nextToWrite(0), stopping(false),
+    startTime(0.0), readbackWait(0.0), encoderWait(0.0)
+  {
+    for (unsigned int i = 0; i < 256; i++) {
+      unsigned int c = i;
+
+      for (int k = 0; k < 8; k++) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+
+      crcTable[i] = c;
+    }
+
+    for (int i = 0; i < RECORDER_READBACKS; i++) {
+      buffers[i] = 0;
+    }
+
+    if (format == RECORD_PNG) {
+      pattern = dest;
+
+      if (pattern.find('%') == std::string::npos) {
+        pattern += "/%05d.png";
+      }
+    } else if (strcmp(dest, "-") == 0) {
+      fflush(stdout);
+      int fd = dup(fileno(stdout));
+      dup2(fileno(stderr), fileno(stdout));
+      stream = fdopen(fd, "wb");
+    } else {
+      stream = fopen(dest, "wb");
+    }
+
+    if (format != RECORD_PNG && stream == NULL) {
+      printf("can't open %s for recording\n", dest);
+    }
+
+    if (format == RECORD_Y4M && stream) {
+      // C420jpeg: chroma sits between each 2x2 block of pixels, which is what averaging gives
+      fprintf(stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    }
+
+    unsigned int numJobs = numWorkers * RECORDER_JOBS_PER_WORKER;
+    size_t pngBytes = (size_t)height * (1 + width * 3);
+    size_t encodedBytes = format == RECORD_PNG ? pngBytes + pngBytes / 8 + 1024 :
+                          format == RECORD_RAW ? (size_t)width * height * 3 :
+                          6 + (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+    // everything a frame needs is allocated here, so recording adds nothing to the frame loop
+    jobs.resize(numJobs);
+    freeJobs.reserve(numJobs);
+    queue.resize(numJobs);
+
+    for (unsigned int i = 0; i < numJobs; i++) {
+      jobs[i].pixels.resize((size_t)width * height * 4);
+      jobs[i].encoded.reserve(encodedBytes);
+      freeJobs.push_back(&jobs[i]);
+    }
+
+    scratch.resize(numWorkers);
+
+    for (unsigned int i = 0; i < numWorkers && format == RECORD_PNG; i++) {
+      scratch[i].filtered.resize(pngBytes);
+      scratch[i].rows[0].resize(width * 3);
+      scratch[i].rows[1].resize(width * 3);
+
+      for (int f = 0; f < 5; f++) {
+        scratch[i].candidates[f].resize(width * 3);
+      }
+
+      scratch[i].head.resize(1 << RECORDER_HASH_BITS);
+      scratch[i].prev.resize(RECORDER_WINDOW);
+    }
+
+    for (unsigned int i = 0; i < numWorkers; i++) {
+      workers.push_back(std::thread(&FrameRecorder::workerLoop, this, i));
+    }
+
+    static const char *formatNames[] = { "png", "raw rgb24", "y4m" };
+    printf("recording %dx%d at %d fps as %s to %s, %u encoder threads\n", width, height, fps, formatNames[format], dest, numWorkers);
+  }
+
+  ~FrameRecorder()
+  {
+    stopWorkers();
+
+    if (stream) {
+      fclose(stream);
+    }
+  }
+
+  // reads the color attachment of `fbo` (width x height from the corner) without waiting
+  // for it, and hands on any earlier reads that have finished. Needs the context current.
+  void capture(unsigned int fbo)
+  {
+    if (buffers[0] == 0) {
+      allocateBuffers();
+    }
+
+    if (numReadbacks == RECORDER_READBACKS) {
+      collect(true); // the gpu is a long way behind; wait for the oldest
+    }
+
+    unsigned int slot = (firstReadback + numReadbacks) % RECORDER_READBACKS;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    numReadbacks++;
+
+    collect(false);
+  }
+
+  // for frames that are already in memory (the software rasterizer's): rgba8, bottom row first
+  void submit(const unsigned char *rgba)
+  {
+    RecorderJob *job = beginJob();
+    memcpy(job->pixels.data(), rgba, job->pixels.size());
+    queueJob(job);
+  }
+
+  // waits for every captured frame to be read back, encoded and written, and closes the
+  // output. Needs the context current if capture() was used.
+  void finish()
+  {
+    while (numReadbacks > 0) {
+      collect(true);
+    }
+
+    stopWorkers();
+
+    if (stream) {
+      fclose(stream);
+      stream = NULL;
+    }
+
+    double elapsed = startTime > 0.0 ? now() - startTime : 0.0;
+    unsigned int frames = framesCaptured > 0 ? framesCaptured : 1;
+    printf("recorded %u frames in %.2f s (%.1f fps), %.2f ms per frame waiting on readback, %.2f ms on the encoders\n",
+           framesCaptured, elapsed, elapsed > 0.0 ? framesCaptured / elapsed : 0.0,
+           readbackWait * 1000.0 / frames, encoderWait * 1000.0 / frames);
+  }
+
+  // frees the pixel buffers; call with the context current before it goes away
+  void release()
+  {
+    for (unsigned int i = 0; i < numReadbacks; i++) {
+      glDeleteSync(fences[(firstReadback + i) % RECORDER_READBACKS]);
+    }
+
+    numReadbacks = 0;
+
+    if (buffers[0]) {
+      glDeleteBuffers(RECORDER_READBACKS, buffers);
+      buffers[0] = 0;
+    }
+  }
+
+private:
+  RecordFormat format;
+  std::string pattern; // png file names
+  FILE *stream; // raw and y4m
+  std::atomic<bool> reportedOpenFailure;
+  unsigned int crcTable[256];
+  unsigned int buffers[RECORDER_READBACKS]; // GL_PIXEL_PACK_BUFFERs, a ring, oldest at firstReadback
+  GLsync fences[RECORDER_READBACKS];
+  unsigned int firstReadback;
+  unsigned int numReadbacks;
+  std::vector<RecorderJob> jobs;
+  std::vector<RecorderJob *> freeJobs; // guarded by jobsLock
+  std::vector<RecorderJob *> queue; // ring of jobs to encode, in frame order; guarded by jobsLock
+  unsigned int queueFirst;
+  unsigned int numQueued;
+  unsigned int nextToWrite; // the frame a stream is waiting on; guarded by writeLock
+  bool stopping;
+  std::vector<RecorderScratch> scratch; // per worker
+  std::vector<std::thread> workers;
+  std::mutex jobsLock;
+  std::condition_variable jobsReady;
+  std::condition_variable jobsFreed;
+  std::mutex writeLock;
+  std::condition_variable written;
+  double startTime;
+  double readbackWait; // seconds, in total
+  double encoderWait;
+
+  static double now()
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void allocateBuffers()
+  {
+    glGenBuffers(RECORDER_READBACKS, buffers);
+
+    for (int i = 0; i < RECORDER_READBACKS; i++) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // hands finished reads to the encoders, oldest first. With `wait`, blocks on the oldest
+  // if it isn't done yet; otherwise stops at the first one still in flight.
+  void collect(bool wait)
+  {
+    while (numReadbacks > 0) {
+      GLsync fence = fences[firstReadback];
+
+      if (wait) {
+        double start = now();
+
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {
+          // keep waiting; 100ms at a time
+        }
+
+        readbackWait += now() - start;
+        wait = false;
+      } else if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        return;
+      }
+
+      glDeleteSync(fence);
+      RecorderJob *job = beginJob();
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[firstReadback]);
+      void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, job->pixels.size(), GL_MAP_READ_BIT);
+
+      if (mapped) {
+        memcpy(job->pixels.data(), mapped, job->pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      firstReadback = (firstReadback + 1) % RECORDER_READBACKS;
+      numReadbacks--;
+      queueJob(job);
+    }
+  }
+
+  // a free job to fill, waiting for the encoders to finish one if they're all taken
+  RecorderJob *beginJob()
+  {
+    std::unique_lock<std::mutex> lock(jobsLock);
+
+    if (freeJobs.empty()) {
+      double start = now();
+
+      while (freeJobs.empty()) {
+        jobsFreed.wait(lock);
+      }
+
+      encoderWait += now() - start;
+    }
+
+    RecorderJob *job = freeJobs.back();
+    freeJobs.pop_back();
+    return job;
+  }
+
+  void queueJob(RecorderJob *job)
+  {
+    if (startTime == 0.0) {
+      startTime = now();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(jobsLock);
+      job->frame = framesCaptured++;
+      queue[(queueFirst + numQueued) % queue.size()] = job;
+      numQueued++;
+    }
+
+    jobsReady.notify_one();
+  }
+
+  // lets the workers drain the queue, then joins them
+  void stopWorkers()
+  {
+    {
+      std::lock_guard<std::mutex> lock(jobsLock);
+      stopping = true;
+    }
+
+    jobsReady.notify_all();
+
+    for (unsigned int i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+
+    workers.clear();
+  }
+
+  void workerLoop(unsigned int index)
+  {
+    while (true) {
+      RecorderJob *job;
+
+      {
+        std::unique_lock<std::mutex> lock(jobsLock);
+
+        while (!stopping && numQueued == 0) {
+          jobsReady.wait(lock);
+        }
+
+        if (numQueued == 0) {
+          return;
+        }
+
+        job = queue[queueFirst];
+        queueFirst = (queueFirst + 1) % queue.size();
+        numQueued--;
+      }
+
+      job->encoded.clear();
+
+      if (format == RECORD_PNG) {
+        encodePng(job, &scratch[index]);
+      } else if (format == RECORD_RAW) {
+        encodeRaw(job);
+      } else {
+        encodeY4m(job);
+      }
+
+      write(job);
+
+      {
+        std::lock_guard<std::mutex> lock(jobsLock);
+        freeJobs.push_back(job);
+      }
+
+      jobsFreed.notify_one();
+    }
+  }
+
+  void write(RecorderJob *job)
+  {
+    if (format == RECORD_PNG) {
+      char path[1024];
+      snprintf(path, sizeof(path), pattern.c_str(), job->frame);
+      FILE *file = fopen(path, "wb");
+
+      if (file) {
+        fwrite(job->encoded.data(), 1, job->encoded.size(), file);
+        fclose(file);
+      } else if (!reportedOpenFailure.exchange(true)) {
+        // just the once; a missing directory would fill the log
+        printf("can't write %s\n", path);
+      }
+
+      return;
+    }
+
+    // streams take frames strictly in order, so a worker that finishes early waits its turn
+    std::unique_lock<std::mutex> lock(writeLock);
+
+    while (nextToWrite != job->frame) {
+      written.wait(lock);
+    }
+
+    if (stream) {
+      fwrite(job->encoded.data(), 1, job->encoded.size(), stream);
+    }
+
+    nextToWrite++;
+    lock.unlock();
+    written.notify_all();
+  }
+
+  // the row `y` counts down from the top, as image files do
+  const unsigned char *rowFromTop(RecorderJob *job, int y)
+  {
+    return &job->pixels[(size_t)(height - 1 - y) * width * 4];
+  }
+
+  void encodeRaw(RecorderJob *job)
+  {
+    job->encoded.resize((size_t)width * height * 3);
+    unsigned char *out = job->encoded.data();
+
+    for (int y = 0; y < height; y++) {
+      const unsigned char *src = rowFromTop(job, y);
+
+      for (int x = 0; x < width; x++, src += 4) {
+        *out++ = src[0];
+        *out++ = src[1];
+        *out++ = src[2];
+      }
+    }
+  }
+
+  // bt.601, studio range, which is what players assume a y4m holds
+  void encodeY4m(RecorderJob *job)
+  {
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+    job->encoded.resize(6 + (size_t)width * height + 2 * (size_t)chromaWidth * chromaHeight);
+    memcpy(job->encoded.data(), "FRAME\n", 6);
+    unsigned char *lumaPlane = job->encoded.data() + 6;
+    unsigned char *uPlane = lumaPlane + (size_t)width * height;
+    unsigned char *vPlane = uPlane + (size_t)chromaWidth * chromaHeight;
+
+    for (int y = 0; y < height; y++) {
+      const unsigned char *src = rowFromTop(job, y);
+      unsigned char *luma = lumaPlane + (size_t)y * width;
+
+      for (int x = 0; x < width; x++, src += 4) {
+        luma[x] = (unsigned char)(((66 * src[0] + 129 * src[1] + 25 * src[2] + 128) >> 8) + 16);
+      }
+    }
+
+    // chroma from the average of each 2x2 block (edges repeat on odd sizes)
+    for (int cy = 0; cy < chromaHeight; cy++) {
+      const unsigned char *top = rowFromTop(job, cy * 2);
+      const unsigned char *bottom = rowFromTop(job, cy * 2 + 1 < height ? cy * 2 + 1 : cy * 2);
+
+      for (int cx = 0; cx < chromaWidth; cx++) {
+        int x0 = cx * 8;
+        int x1 = cx * 2 + 1 < width ? x0 + 4 : x0;
+        int r = (top[x0] + top[x1] + bottom[x0] + bottom[x1] + 2) >> 2;
+        int g = (top[x0 + 1] + top[x1 + 1] + bottom[x0 + 1] + bottom[x1 + 1] + 2) >> 2;
+        int b = (top[x0 + 2] + top[x1 + 2] + bottom[x0 + 2] + bottom[x1 + 2] + 2) >> 2;
+        uPlane[cy * chromaWidth + cx] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        vPlane[cy * chromaWidth + cx] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+      }
+    }
+  }
+
+  void encodePng(RecorderJob *job, RecorderScratch *scratch)
+  {
+    std::vector<unsigned char> *out = &job->encoded;
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out->insert(out->end(), signature, signature + 8);
+
+    unsigned char header[13];
+    putBigEndian(header, width);
+    putBigEndian(header + 4, height);
+    header[8] = 8; // bits per channel
+    header[9] = 2; // rgb
+    header[10] = header[11] = header[12] = 0; // deflate, adaptive filtering, no interlace
+    putChunk(out, "IHDR", header, 13);
+
+    filterRows(job, scratch);
+
+    // IDAT is written in place: its length and crc are filled in once the data's there
+    size_t start = out->size();
+    unsigned char placeholder[4] = { 0, 0, 0, 0 };
+    out->insert(out->end(), placeholder, placeholder + 4);
+    out->insert(out->end(), (const unsigned char *)"IDAT", (const unsigned char *)"IDAT" + 4);
+    deflate(scratch, out);
+    size_t length = out->size() - start - 8;
+    putBigEndian(&(*out)[start], (unsigned int)length);
+    unsigned char crc[4];
+    putBigEndian(crc, crc32(&(*out)[start + 4], length + 4));
+    out->insert(out->end(), crc, crc + 4);
+
+    putChunk(out, "IEND", NULL, 0);
+  }
+
+  // every scanline goes out under whichever png filter leaves the smallest residuals,
+  // which is the usual guess at what will compress best
+  void filterRows(RecorderJob *job, RecorderScratch *scratch)
+  {
+    int stride = width * 3;
+    unsigned char *filtered = scratch->filtered.data();
+
+    for (int y = 0; y < height; y++) {
+      unsigned char *row = scratch->rows[y & 1].data();
+      const unsigned char *above = scratch->rows[(y + 1) & 1].data();
+      const unsigned char *src = rowFromTop(job, y);
+
+      for (int x = 0; x < width; x++, src += 4) {
+        row[x * 3] = src[0];
+        row[x * 3 + 1] = src[1];
+        row[x * 3 + 2] = src[2];
+      }
+
+      unsigned int costs[5] = { 0, 0, 0, 0, 0 };
+
+      for (int i = 0; i < stride; i++) {
+        int a = i >= 3 ? row[i - 3] : 0;
+        int b = y > 0 ? above[i] : 0;
+        int c = i >= 3 && y > 0 ? above[i - 3] : 0;
+        int p = a + b - c;
+        int pa = abs(p - a);
+        int pb = abs(p - b);
+        int pc = abs(p - c);
+        int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        unsigned char values[5] = {
+          row[i], (unsigned char)(row[i] - a), (unsigned char)(row[i] - b),
+          (unsigned char)(row[i] - ((a + b) >> 1)), (unsigned char)(row[i] - paeth)
+        };
+
+        for (int f = 0; f < 5; f++) {
+          scratch->candidates[f][i] = values[f];
+          costs[f] += abs((signed char)values[f]);
+        }
+      }
+
+      int best = 0;
+
+      for (int f = 1; f < 5; f++) {
+        best = costs[f] < costs[best] ? f : best;
+      }
+
+      *filtered++ = (unsigned char)best;
+      memcpy(filtered, scratch->candidates[best].data(), stride);
+      filtered += stride;
+    }
+  }
+
+  // zlib stream of the filtered scanlines: one block of fixed huffman codes, with matches
+  // found through hash chains over the last RECORDER_WINDOW bytes
+  void deflate(RecorderScratch *scratch, std::vector<unsigned char> *out)
+  {
+    const unsigned char *data = scratch->filtered.data();
+    int size = (int)scratch->filtered.size();
+    int *head = scratch->head.data();
+    int *prev = scratch->prev.data();
+    RecorderBits bits = { out, 0, 0 };
+
+    out->push_back(0x78); // deflate, 32k window
+    out->push_back(0x01); // no dictionary, fastest; makes the header a multiple of 31
+    putBits(&bits, 1, 1); // last block
+    putBits(&bits, 1, 2); // fixed codes
+
+    for (int i = 0; i < (1 << RECORDER_HASH_BITS); i++) {
+      head[i] = -1;
+    }
+
+    int i = 0;
+
+    while (i < size) {
+      int bestLength = 0;
+      int bestDistance = 0;
+
+      if (i + 2 < size) {
+        int maxLength = size - i < 258 ? size - i : 258;
+        int candidate = head[hash(data + i)];
+
+        for (int chain = 0; candidate >= 0 && i - candidate <= RECORDER_WINDOW && chain < RECORDER_MAX_CHAIN; chain++) {
+          // anything longer has to match at bestLength too, so that byte is checked first
+          if (data[candidate + bestLength] == data[i + bestLength]) {
+            int length = 0;
+
+            while (length < maxLength && data[candidate + length] == data[i + length]) {
+              length++;
+            }
+
+            if (length > bestLength) {
+              bestLength = length;
+              bestDistance = i - candidate;
+
+              if (length == maxLength) {
+                break;
+              }
+            }
+          }
+
+          candidate = prev[candidate % RECORDER_WINDOW];
+        }
+      }
+
+      if (bestLength >= 3) {
+        putMatch(&bits, bestLength, bestDistance);
+
+        for (int end = i + bestLength; i < end; i++) {
+          insert(data, size, i, head, prev);
+        }
+      } else {
+        putLiteral(&bits, data[i]);
+        insert(data, size, i, head, prev);
+        i++;
+      }
+    }
+
+    putLiteral(&bits, 256); // end of block
+
+    if (bits.count > 0) {
+      out->push_back((unsigned char)bits.buffer);
+    }
+
+    unsigned char checksum[4];
+    putBigEndian(checksum, adler32(data, size));
+    out->insert(out->end(), checksum, checksum + 4);
+  }
+
+  static unsigned int hash(const unsigned char *p)
+  {
+    return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - RECORDER_HASH_BITS);
+  }
+
+  static void insert(const unsigned char *data, int size, int i, int *head, int *prev)
+  {
+    if (i + 2 < size) {
+      unsigned int h = hash(data + i);
+      prev[i % RECORDER_WINDOW] = head[h];
+      head[h] = i;
+    }
+  }
+
+  static void putBits(RecorderBits *bits, unsigned int value, int count)
+  {
+    bits->buffer |= value << bits->count;
+    bits->count += count;
+
+    while (bits->count >= 8) {
+      bits->out->push_back((unsigned char)bits->buffer);
+      bits->buffer >>= 8;
+      bits->count -= 8;
+    }
+  }
+
+  static void putCode(RecorderBits *bits, unsigned int code, int count)
+  {
+    unsigned int reversed = 0;
+
+    for (int i = 0; i < count; i++) {
+      reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+
+    putBits(bits, reversed, count);
+  }
+
+  // the fixed literal/length code from the deflate spec
+  static void putLiteral(RecorderBits *bits, int symbol)
+  {
+    if (symbol < 144) {
+      putCode(bits, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+      putCode(bits, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+      putCode(bits, symbol - 256, 7);
+    } else {
+      putCode(bits, 0xc0 + symbol - 280, 8);
+    }
+  }
+
+  static void putMatch(RecorderBits *bits, int length, int distance)
+  {
+    static const int lengthBase[29] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+    static const int lengthExtra[29] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+    static const int distanceBase[30] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+      4097, 6145, 8193, 12289, 16385, 24577
+    };
+    static const int distanceExtra[30] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    int l = 28;
+
+    while (lengthBase[l] > length) {
+      l--;
+    }
+
+    putLiteral(bits, 257 + l);
+    putBits(bits, length - lengthBase[l], lengthExtra[l]);
+
+    int d = 29;
+
+    while (distanceBase[d] > distance) {
+      d--;
+    }
+
+    putCode(bits, d, 5);
+    putBits(bits, distance - distanceBase[d], distanceExtra[d]);
+  }
+
+  static unsigned int adler32(const unsigned char *data, int size)
+  {
+    unsigned int a = 1;
+    unsigned int b = 0;
+
+    while (size > 0) {
+      int n = size < 5552 ? size : 5552; // the most bytes before b could overflow
+      size -= n;
+
+      while (n-- > 0) {
+        a += *data++;
+        b += a;
+      }
+
+      a %= 65521;
+      b %= 65521;
+    }
+
+    return (b << 16) | a;
+  }
+
+  unsigned int crc32(const unsigned char *data, size_t size)
+  {
+    unsigned int c = 0xffffffffu;
+
+    for (size_t i = 0; i < size; i++) {
+      c = crcTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+
+    return c ^ 0xffffffffu;
+  }
+
+  static void putBigEndian(unsigned char *p, unsigned int value)
+  {
+    p[0] = (unsigned char)(value >> 24);
+    p[1] = (unsigned char)(value >> 16);
+    p[2] = (unsigned char)(value >> 8);
+    p[3] = (unsigned char)value;
+  }
+
+  void putChunk(std::vector<unsigned char> *out, const char *type, const unsigned char *data, unsigned int size)
+  {
+    unsigned char length[4];
+    putBigEndian(length, size);
+    out->insert(out->end(), length, length + 4);
+    size_t start = out->size();
+    out->insert(out->end(), (const unsigned char *)type, (const unsigned char *)type + 4);
+
+    if (size > 0) {
+      out->insert(out->end(), data, data + size);
+    }
+
+    unsigned char crc[4];
+    putBigEndian(crc, crc32(&(*out)[start], size + 4));
+    out->insert(out->end(), crc, crc + 4);
+  }
+};
+#endif
@@ -0,0 +1,34 @@
+#ifndef GL_CAPS_H
+#define GL_CAPS_H
+
+#include <glad/glad.h>
+
+#include <string.h>
+
+// what the current context can do beyond the 4.1 core glad was generated for; both
+// need the context current, and both ask the driver every time, so callers check once
+// at setup and keep the answer
+
+inline bool contextVersionAtLeast(int major, int minor)
+{
+  int contextMajor = 0;
+  int contextMinor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+  glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+  return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+inline bool contextHasExtension(const char *name)
+{
+  int numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+
+  for (int i = 0; i < numExtensions; i++) {
+    if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+#endif
@@ -0,0 +1,159 @@
+#ifndef GPU_ANIMATOR_H
+#define GPU_ANIMATOR_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <instance_buffer.h>
+#include <shader.h>
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define GPU_ANIMATOR_LIGHT_TEXELS 3 // position, color, attenuation
+#define GPU_ANIMATOR_NO_PARENT -1.0f
+#define GPU_ANIMATOR_NO_LIGHT -1.0f
+
+// what animate.vs needs to move one light, fixed after setup
+typedef struct {
+  glm::vec4 motion; // orbit radius, bob height, orbit rate, bob rate
+  glm::vec3 colorRate;
+  glm::vec4 attenuation; // constant, linear, quadratic, unused
+} GpuLightParams;
+
+// the same for one entity; indices are dense entity/light indices, stored as floats
+typedef struct {
+  glm::vec4 posAngle; // position, base angle
+  glm::vec4 axisSpin; // rotation axis, spin rate
+  glm::vec4 scaleParent; // scale, parent (GPU_ANIMATOR_NO_PARENT for roots)
+  glm::vec4 light; // x: the light whose position this entity takes, or GPU_ANIMATOR_NO_LIGHT
+} GpuEntityParams;
+
+// everything that moves as a pure function of time, animated on the gpu: a transform
+// feedback pass turns the per-light constants into positions and colors, then a second
+// one builds every entity's instance record right in the InstanceBuffer. The lit shaders
+// read the lights back through the animatedLights samplerBuffer (SHADER_GPU_LIGHTS).
+//
+// Nothing is uploaded per frame; the parameters only go up when set again, so anything
+// that changes the scene's structure after setup has to call setEntities() again.
+class GpuAnimator
+{
+public:
+  unsigned int lightTexture; // samplerBuffer over the animated lights; texture id == texture unit
+  unsigned int numLights;
+  unsigned int numEntities;
+
+  GpuAnimator(Shader *lightProgram, Shader *entityProgram)
+    : numLights(0), numEntities(0), lightProgram(lightProgram), entityProgram(entityProgram), configured(false)
+  {
+    glGenVertexArrays(1, &lightVAO);
+    glGenBuffers(1, &lightParams);
+    glGenBuffers(1, &lightOutput);
+    glGenVertexArrays(1, &entityVAO); // no attributes; entities are fetched by gl_VertexID
+    glGenBuffers(1, &entityParams);
+
+    glBindVertexArray(lightVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, lightParams);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GpuLightParams), (void *)offsetof(GpuLightParams, motion));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(GpuLightParams), (void *)offsetof(GpuLightParams, colorRate));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GpuLightParams), (void *)offsetof(GpuLightParams, attenuation));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &lightTexture);
+    glGenTextures(1, &entityTexture);
+  }
+
+  void setLights(const GpuLightParams *lights, unsigned int count)
+  {
+    numLights = count;
+    glBindBuffer(GL_ARRAY_BUFFER, lightParams);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(GpuLightParams), lights, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, lightOutput);
+    glBufferData(GL_ARRAY_BUFFER, count * GPU_ANIMATOR_LIGHT_TEXELS * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // the buffer texture keeps pointing at lightOutput, so this only needs doing again
+    // because glBufferData gave it new storage
+    glActiveTexture(GL_TEXTURE0 + lightTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightOutput);
+  }
+
+  void setEntities(const GpuEntityParams *entities, unsigned int count)
+  {
+    numEntities = count;
+    glBindBuffer(GL_TEXTURE_BUFFER, entityParams);
+    glBufferData(GL_TEXTURE_BUFFER, count * sizeof(GpuEntityParams), entities, GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glActiveTexture(GL_TEXTURE0 + entityTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, entityTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, entityParams);
+  }
+
+  // both passes for `time`; `instances` has to have room for every entity already, which
+  // the frame's InstanceBuffer::update() sees to
+  void animate(float time, InstanceBuffer *instances)
+  {
+    if (!configured) {
+      configured = true;
+      entityProgram->use();
+      entityProgram->setInt("entityParams", entityTexture);
+      entityProgram->setInt("animatedLights", lightTexture);
+    }
+
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    if (numLights > 0) {
+      lightProgram->use();
+      lightProgram->setFloat("time", time);
+      glBindVertexArray(lightVAO);
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, lightOutput);
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, 0, numLights);
+      glEndTransformFeedback();
+    }
+
+    // transform feedback writes are in place before any later command reads them, so the
+    // entity pass can look up the lights it follows right away
+    if (numEntities > 0 && numEntities <= instances->capacity) {
+      entityProgram->use();
+      entityProgram->setFloat("time", time);
+      glBindVertexArray(entityVAO);
+      glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, instances->ID, 0, numEntities * sizeof(InstanceTransform));
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, 0, numEntities);
+      glEndTransformFeedback();
+    }
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+  }
+
+  void release()
+  {
+    glDeleteTextures(1, &lightTexture);
+    glDeleteTextures(1, &entityTexture);
+    glDeleteBuffers(1, &lightParams);
+    glDeleteBuffers(1, &lightOutput);
+    glDeleteBuffers(1, &entityParams);
+    glDeleteVertexArrays(1, &lightVAO);
+    glDeleteVertexArrays(1, &entityVAO);
+  }
+
+private:
+  Shader *lightProgram;
+  Shader *entityProgram;
+  bool configured;
+  unsigned int lightVAO;
+  unsigned int lightParams;
+  unsigned int lightOutput;
+  unsigned int entityVAO;
+  unsigned int entityParams;
+  unsigned int entityTexture;
+};
+#endif
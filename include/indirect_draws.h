@@ -0,0 +1,91 @@
+#ifndef INDIRECT_DRAWS_H
+#define INDIRECT_DRAWS_H
+
+#include <glad/glad.h>
+#include <gl_caps.h>
+#include <instance_buffer.h>
+
+#include <stdio.h>
+
+// glMultiDrawArraysIndirect is GL 4.3; glad is generated for 4.1, so the entry point is
+// declared here and loaded by hand when the context is new enough
+typedef void (APIENTRYP PFNGLMULTIDRAWARRAYSINDIRECTPROC)(GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+// the record glDrawArraysIndirect and glMultiDrawArraysIndirect read. baseInstance is
+// where the draw's instanced attributes start (4.2+; it must be 0 before that).
+typedef struct {
+  unsigned int count;
+  unsigned int instanceCount;
+  unsigned int first;
+  unsigned int baseInstance;
+} DrawArraysIndirectCommand;
+
+// a frame's entity draws as indirect commands in one buffer. On GL 4.3 a whole group of
+// commands (one mesh, one material) is a single glMultiDrawArraysIndirect, with
+// baseInstance pointing each draw at its own instance records, so the cpu cost stops
+// depending on how many runs the culling broke the entities into. On 4.1 there's no
+// baseInstance and no multi-draw, so the same commands are walked on the cpu instead:
+// the instance attributes are re-pointed and each command is one instanced draw.
+class IndirectDraws
+{
+public:
+  bool multiDraw; // glMultiDrawArraysIndirect is there; otherwise one draw call per command
+
+  IndirectDraws(GLADloadproc load) : multiDraw(false), capacity(0), multiDrawArraysIndirect(NULL)
+  {
+    if (contextVersionAtLeast(4, 3)) {
+      multiDrawArraysIndirect = (PFNGLMULTIDRAWARRAYSINDIRECTPROC)load("glMultiDrawArraysIndirect");
+    }
+
+    multiDraw = multiDrawArraysIndirect != NULL;
+    glGenBuffers(1, &buffer);
+    printf("entity draws: %s\n", multiDraw ? "glMultiDrawArraysIndirect" : "one draw call per command (needs gl 4.3 for multi-draw)");
+  }
+
+  // the frame's commands, every pass's at once; orphans last frame's so the gpu never
+  // has to finish with them first. Nothing to do for the fallback, which reads them on
+  // the cpu.
+  void upload(const DrawArraysIndirectCommand *commands, unsigned int count)
+  {
+    if (!multiDraw || count == 0) {
+      return;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+
+    if (count > capacity) {
+      capacity = count;
+    }
+
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, capacity * sizeof(DrawArraysIndirectCommand), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, count * sizeof(DrawArraysIndirectCommand), commands);
+  }
+
+  // draws commands [first, first + count) of the uploaded array with the bound program
+  // and vertex array; `commands` is that same array, for the fallback
+  void draw(const DrawArraysIndirectCommand *commands, unsigned int first, unsigned int count, InstanceBuffer *instances)
+  {
+    if (multiDraw) {
+      instances->bindAttributes(0); // baseInstance does the offsetting
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+      multiDrawArraysIndirect(GL_TRIANGLES, (void *)(first * sizeof(DrawArraysIndirectCommand)), count, 0);
+      return;
+    }
+
+    for (unsigned int i = first; i < first + count; i++) {
+      instances->bindAttributes(commands[i].baseInstance);
+      glDrawArraysInstanced(GL_TRIANGLES, commands[i].first, commands[i].count, commands[i].instanceCount);
+    }
+  }
+
+  void release()
+  {
+    glDeleteBuffers(1, &buffer);
+  }
+
+private:
+  unsigned int buffer;
+  unsigned int capacity; // in commands
+  PFNGLMULTIDRAWARRAYSINDIRECTPROC multiDrawArraysIndirect;
+};
+#endif
@@ -0,0 +1,81 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <transform_kernel.h>
+
+#define INSTANCE_MODEL_LOCATION 3 // mat4, locations 3-6
+#define INSTANCE_NORMAL_LOCATION 7 // mat3, locations 7-9
+
+// per-instance transforms for every entity, refreshed once a frame and read by
+// instanced draws through attributes 3-9 (divisor 1). GL 4.1 has no baseInstance, so
+// a draw that starts part way in points the attributes at its first record instead.
+class InstanceBuffer
+{
+public:
+  unsigned int ID;
+  unsigned int capacity; // in records
+
+  InstanceBuffer() : capacity(0)
+  {
+    glGenBuffers(1, &ID);
+  }
+
+  // orphans last frame's storage so the driver never has to wait on draws still reading it
+  void upload(const InstanceTransform *transforms, unsigned int count)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, ID);
+
+    if (count > capacity) {
+      capacity = count;
+    }
+
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceTransform), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceTransform), transforms);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // rewrites just records [first, first + count) in place from `changed`, for frames where
+  // most entities held still. Growing the buffer drops what was in it, which is fine as
+  // long as the caller's range covers everything then -- the entity store re-dirties every
+  // entity whenever it grows.
+  void update(const InstanceTransform *changed, unsigned int first, unsigned int count, unsigned int total)
+  {
+    if (count == 0 && total <= capacity) {
+      return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, ID);
+
+    if (total > capacity) {
+      capacity = total;
+      glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceTransform), NULL, GL_STREAM_DRAW);
+    }
+
+    glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(InstanceTransform), count * sizeof(InstanceTransform), changed);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // sets up the currently bound vertex array so instance 0 reads record `first`
+  void bindAttributes(unsigned int first)
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, ID);
+
+    for (unsigned int i = 0; i < 4; i++) {
+      unsigned int offset = first * sizeof(InstanceTransform) + i * sizeof(glm::vec4);
+      glVertexAttribPointer(INSTANCE_MODEL_LOCATION + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void *)(size_t)offset);
+      glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + i);
+      glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + i, 1);
+    }
+
+    for (unsigned int i = 0; i < 3; i++) {
+      unsigned int offset = first * sizeof(InstanceTransform) + sizeof(glm::mat4) + i * sizeof(glm::vec4);
+      glVertexAttribPointer(INSTANCE_NORMAL_LOCATION + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform), (void *)(size_t)offset);
+      glEnableVertexAttribArray(INSTANCE_NORMAL_LOCATION + i);
+      glVertexAttribDivisor(INSTANCE_NORMAL_LOCATION + i, 1);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+};
+#endif
@@ -0,0 +1,91 @@
+#ifndef LIGHT_KERNEL_H
+#define LIGHT_KERNEL_H
+
+#include <transform_kernel.h>
+
+#include <glm/glm.hpp>
+
+#include <math.h>
+
+// the point lights' animation, as a pure function of one time sample. Every light circles
+// the y axis at its own radius and rate, bobs around its own height, and cycles its color
+// through |sin| at three more rates; all of those are per-light constants set up once, so
+// a frame is five sines per light and nothing else. The color lands in specular, with
+// diffuse and ambient at 0.65 and 0.3 of it, which is what the light uniforms want.
+typedef struct {
+  const float *radii; // distance from the y axis
+  const float *heights; // middle of the bob
+  const float *orbitRates; // radians per second
+  const float *bobRates;
+  const glm::vec3 *colorRates; // per channel
+} LightMotion;
+
+inline void animateLightsScalar(const LightMotion *motion, float time, glm::vec3 *positions, glm::vec3 *ambient,
+                                glm::vec3 *diffuse, glm::vec3 *specular, unsigned int first, unsigned int count)
+{
+  for (unsigned int i = first; i < first + count; i++) {
+    float orbit = time * motion->orbitRates[i];
+    positions[i] = glm::vec3(motion->radii[i] * sinf(orbit), motion->heights[i] + sinf(time * motion->bobRates[i]) * 1.3f,
+                             motion->radii[i] * cosf(orbit));
+
+    glm::vec3 phase = time * motion->colorRates[i];
+    glm::vec3 color(fabsf(sinf(phase.x)), fabsf(sinf(phase.y)), fabsf(sinf(phase.z)));
+    specular[i] = color;
+    diffuse[i] = color * 0.65f;
+    ambient[i] = color * 0.3f;
+  }
+}
+
+#ifdef TRANSFORM_KERNEL_SIMD
+template <typename L>
+inline typename L::V absSinLanes(typename L::V x)
+{
+  typename L::V s = sinLanes<L>(x);
+  return L::select(L::lt(s, L::set1(0.0f)), L::sub(L::set1(0.0f), s), s);
+}
+
+// one group of L::WIDTH lights starting at `i`
+template <typename L>
+inline void animateLightsLanes(const LightMotion *motion, typename L::V time, glm::vec3 *positions, glm::vec3 *ambient,
+                               glm::vec3 *diffuse, glm::vec3 *specular, unsigned int i)
+{
+  typedef typename L::V V;
+  V radius = L::load(motion->radii + i);
+  V orbit = L::mul(time, L::load(motion->orbitRates + i));
+  V bob = L::mul(time, L::load(motion->bobRates + i));
+
+  V x = L::mul(radius, sinLanes<L>(orbit));
+  V y = L::add(L::load(motion->heights + i), L::mul(sinLanes<L>(bob), L::set1(1.3f)));
+  V z = L::mul(radius, cosLanes<L>(orbit));
+  L::storeVec3(positions + i, x, y, z);
+
+  V rateR, rateG, rateB;
+  L::loadVec3(motion->colorRates + i, rateR, rateG, rateB);
+  V r = absSinLanes<L>(L::mul(time, rateR));
+  V g = absSinLanes<L>(L::mul(time, rateG));
+  V b = absSinLanes<L>(L::mul(time, rateB));
+  V diffuseScale = L::set1(0.65f);
+  V ambientScale = L::set1(0.3f);
+  L::storeVec3(specular + i, r, g, b);
+  L::storeVec3(diffuse + i, L::mul(r, diffuseScale), L::mul(g, diffuseScale), L::mul(b, diffuseScale));
+  L::storeVec3(ambient + i, L::mul(r, ambientScale), L::mul(g, ambientScale), L::mul(b, ambientScale));
+}
+#endif
+
+// lights [0, count) at `time`: full SIMD groups first, the remainder on the scalar path
+inline void animateLights(const LightMotion *motion, float time, glm::vec3 *positions, glm::vec3 *ambient,
+                          glm::vec3 *diffuse, glm::vec3 *specular, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef TRANSFORM_KERNEL_SIMD
+  TransformLanes::V t = TransformLanes::set1(time);
+
+  for (; i + TransformLanes::WIDTH <= count; i += TransformLanes::WIDTH) {
+    animateLightsLanes<TransformLanes>(motion, t, positions, ambient, diffuse, specular, i);
+  }
+#endif
+
+  animateLightsScalar(motion, time, positions, ambient, diffuse, specular, i, count - i);
+}
+#endif
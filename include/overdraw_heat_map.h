@@ -0,0 +1,122 @@
+#ifndef OVERDRAW_HEAT_MAP_H
+#define OVERDRAW_HEAT_MAP_H
+
+#include <glad/glad.h>
+#include <shader.h>
+
+#include <stdio.h>
+
+#define OVERDRAW_HEAT_MAX 8.0f // fragments per pixel that show as white
+
+// a debug view of where the lit shader runs more than once per pixel. The main pass's
+// opaque geometry is drawn again into a count target, every fragment adding one to its
+// pixel, and the counts are then painted over the main pass's target as colors.
+//
+// The counts are a single float channel: blending doesn't happen on integer color
+// buffers, and a float holds whole numbers exactly far past any real overdraw.
+class OverdrawHeatMap
+{
+public:
+  OverdrawHeatMap(Shader *shader) : shader(shader), texture(0), fbo(0), depth(0), width(0), height(0), configured(false)
+  {
+    glGenVertexArrays(1, &emptyVao); // core profile won't draw without one bound
+  }
+
+  // makes the count target current for a width x height pass, cleared to zero, with
+  // additive blending on
+  void begin(int w, int h)
+  {
+    if (w > width || h > height) {
+      allocate(w > width ? w : width, h > height ? h : height);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, w, h);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+  }
+
+  void end()
+  {
+    glDisable(GL_BLEND);
+  }
+
+  // the counts as colors over the bound framebuffer, pixel for pixel; its viewport has
+  // to be the size passed to begin()
+  void draw()
+  {
+    shader->use();
+
+    if (!configured) {
+      configured = true;
+      shader->setInt("counts", texture);
+      shader->setFloat("maxCount", OVERDRAW_HEAT_MAX);
+    }
+
+    glActiveTexture(GL_TEXTURE0 + texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_DEPTH_TEST);
+  }
+
+  void release()
+  {
+    releaseTarget();
+    glDeleteVertexArrays(1, &emptyVao);
+  }
+
+private:
+  Shader *shader;
+  unsigned int texture; // texture id == texture unit
+  unsigned int fbo;
+  unsigned int depth;
+  unsigned int emptyVao;
+  int width;
+  int height;
+  bool configured;
+
+  void releaseTarget()
+  {
+    if (fbo) {
+      glDeleteFramebuffers(1, &fbo);
+      glDeleteTextures(1, &texture);
+      glDeleteRenderbuffers(1, &depth);
+      fbo = texture = depth = 0;
+    }
+  }
+
+  void allocate(int w, int h)
+  {
+    releaseTarget();
+    width = w;
+    height = h;
+    configured = false; // a new texture id, so a new unit
+
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      printf("overdraw count target %dx%d is incomplete\n", w, h);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+};
+#endif
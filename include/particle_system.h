@@ -0,0 +1,273 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <instance_buffer.h>
+#include <shader.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+#define MAX_PARTICLE_EMITTERS 16 // particle_sim.vs and particle.vs size their arrays to this
+#define PARTICLE_INSTANCE_TEXELS 7 // an InstanceTransform as vec4s; the origin is texel 3
+
+// one particle as it sits in the simulation buffers
+typedef struct {
+  glm::vec4 posAge; // position, seconds since it spawned (negative: not born yet)
+  glm::vec4 velLife; // velocity, seconds it lives for
+} Particle;
+
+// a source of particles hanging off an entity: they spawn within `spread` of its origin,
+// head off at `speed` (biased upwards) and fall under `gravity`. Negative gravity rises.
+typedef struct {
+  unsigned int entity; // dense entity index; its instance record says where the emitter is
+  int light; // only emits while this light is active; -1 always emits
+  float speed;
+  float gravity;
+  float lifetime; // the longest a particle lives, in seconds
+  float spread;
+  glm::vec3 color; // additive, so this is also how bright they are
+  float size; // billboard half-size, in world units
+} ParticleEmitter;
+
+// particles simulated and drawn without the cpu ever seeing them. Each frame a transform
+// feedback pass reads every particle from one buffer and writes its next state into the
+// other, respawning the dead ones at their emitter, and the two swap. Emitters find their
+// entity in the InstanceBuffer itself, so they follow it however it was animated.
+//
+// Drawing is one instanced draw of camera-facing quads, additive, tested against the
+// scene's depth but not writing it. They fade out where they get close to the surface
+// behind them, which needs the scene's depth as a texture: it's copied out of the main
+// pass's target first, since sampling the attachment being drawn into isn't allowed.
+class ParticleSystem
+{
+public:
+  unsigned int count; // particles, shared evenly between the emitters
+  std::vector<ParticleEmitter> emitters;
+
+  ParticleSystem(unsigned int count, Shader *simShader, Shader *drawShader)
+    : count(count), simShader(simShader), drawShader(drawShader), current(0), lastTime(-1.0f), configured(false),
+      depthTexture(0), depthFBO(0), depthWidth(0), depthHeight(0)
+  {
+    glGenBuffers(2, buffers);
+    glGenVertexArrays(2, simVAOs);
+    glGenVertexArrays(2, drawVAOs);
+    glGenTextures(1, &instanceTexture);
+  }
+
+  void addEmitter(const ParticleEmitter &emitter)
+  {
+    if (emitters.size() < MAX_PARTICLE_EMITTERS) {
+      emitters.push_back(emitter);
+    }
+  }
+
+  // once every emitter is in: seeds the particles, all unborn, with their births spread
+  // over one lifetime so the emitters start out at a steady rate instead of in bursts
+  void start()
+  {
+    unsigned int perEmitter = emitters.empty() ? 0 : count / emitters.size();
+    count = perEmitter * emitters.size();
+    std::vector<Particle> seed(count);
+    unsigned int state = 0x9e3779b9u;
+
+    for (unsigned int i = 0; i < count; i++) {
+      state = state * 1664525u + 1013904223u; // lcg; all that's needed is a spread of ages
+      float r = (state >> 8) * (1.0f / 16777216.0f);
+      seed[i].posAge = glm::vec4(0.0f, 0.0f, 0.0f, -r * emitters[i / perEmitter].lifetime);
+      seed[i].velLife = glm::vec4(0.0f);
+    }
+
+    for (int b = 0; b < 2; b++) {
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[b]);
+      glBufferData(GL_ARRAY_BUFFER, count * sizeof(Particle), seed.data(), GL_DYNAMIC_COPY);
+
+      // the same buffer is the simulation's input one frame and the draw's instances the next
+      glBindVertexArray(simVAOs[b]);
+      bindParticleAttributes(0);
+      glBindVertexArray(drawVAOs[b]);
+      bindParticleAttributes(1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for (unsigned int e = 0; e < emitters.size(); e++) {
+      emitterFirst[e] = e * perEmitter;
+    }
+
+    printf("particles: %u across %u emitters, %.1fMB\n", count, (unsigned int)emitters.size(),
+           2.0f * count * sizeof(Particle) / (1024.0f * 1024.0f));
+  }
+
+  // one step to `time`; lights from `lightsUsed` on are off, so their emitters go quiet
+  void simulate(float time, int lightsUsed, InstanceBuffer *instances)
+  {
+    float dt = lastTime < 0.0f ? 0.0f : glm::clamp(time - lastTime, 0.0f, 0.1f);
+    lastTime = time;
+
+    if (count == 0) {
+      return;
+    }
+
+    simShader->use();
+
+    if (!configured) {
+      configured = true;
+      setEmitterUniforms(simShader);
+      setEmitterUniforms(drawShader);
+      simShader->use();
+      simShader->setInt("instances", instanceTexture);
+    }
+
+    // pointed at the instance buffer every frame, since it reallocates as it grows
+    glActiveTexture(GL_TEXTURE0 + instanceTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, instanceTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instances->ID);
+
+    simShader->setFloat("time", time);
+    simShader->setFloat("dt", dt);
+    simShader->setInt("lightsUsed", lightsUsed);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(simVAOs[current]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[1 - current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, count);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    current = 1 - current;
+  }
+
+  // draws into the main pass's target `fbo`, whose part in use is width x height; the
+  // pass's FrameBlock has to be bound still
+  void draw(unsigned int fbo, int width, int height)
+  {
+    if (count == 0) {
+      return;
+    }
+
+    if (width > depthWidth || height > depthHeight) {
+      allocateDepth(width > depthWidth ? width : depthWidth, height > depthHeight ? height : depthHeight);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFBO);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    drawShader->use();
+    drawShader->setInt("sceneDepth", depthTexture);
+    glActiveTexture(GL_TEXTURE0 + depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glBindVertexArray(drawVAOs[current]);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+  }
+
+  void release()
+  {
+    glDeleteBuffers(2, buffers);
+    glDeleteVertexArrays(2, simVAOs);
+    glDeleteVertexArrays(2, drawVAOs);
+    glDeleteTextures(1, &instanceTexture);
+
+    if (depthFBO) {
+      glDeleteFramebuffers(1, &depthFBO);
+      glDeleteTextures(1, &depthTexture);
+    }
+  }
+
+private:
+  Shader *simShader;
+  Shader *drawShader;
+  unsigned int buffers[2];
+  unsigned int simVAOs[2]; // simVAOs[i] reads buffers[i] per vertex
+  unsigned int drawVAOs[2]; // drawVAOs[i] reads buffers[i] per instance
+  unsigned int current; // which buffer holds the latest state
+  float lastTime;
+  bool configured;
+  int emitterFirst[MAX_PARTICLE_EMITTERS];
+  unsigned int instanceTexture; // samplerBuffer over the InstanceBuffer; texture id == texture unit
+  unsigned int depthTexture; // the scene's depth, copied out for the soft fade
+  unsigned int depthFBO;
+  int depthWidth;
+  int depthHeight;
+
+  // attributes 0 and 1 from the bound GL_ARRAY_BUFFER, advancing per vertex or per instance
+  void bindParticleAttributes(unsigned int divisor)
+  {
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, divisor);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Particle), (void *)sizeof(glm::vec4));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, divisor);
+  }
+
+  void setEmitterUniforms(Shader *shader)
+  {
+    int entities[MAX_PARTICLE_EMITTERS];
+    int lights[MAX_PARTICLE_EMITTERS];
+    glm::vec4 motion[MAX_PARTICLE_EMITTERS];
+    glm::vec4 look[MAX_PARTICLE_EMITTERS];
+
+    for (unsigned int e = 0; e < emitters.size(); e++) {
+      entities[e] = emitters[e].entity;
+      lights[e] = emitters[e].light;
+      motion[e] = glm::vec4(emitters[e].speed, emitters[e].gravity, emitters[e].lifetime, emitters[e].spread);
+      look[e] = glm::vec4(emitters[e].color, emitters[e].size);
+    }
+
+    shader->use();
+    shader->setInt("numEmitters", emitters.size());
+    glUniform1iv(glGetUniformLocation(shader->ID, "emitterFirst"), emitters.size(), emitterFirst);
+    glUniform1iv(glGetUniformLocation(shader->ID, "emitterEntity"), emitters.size(), entities);
+    glUniform1iv(glGetUniformLocation(shader->ID, "emitterLight"), emitters.size(), lights);
+    shader->setVec4fv("emitterMotion", emitters.size(), &motion[0][0]);
+    shader->setVec4fv("emitterLook", emitters.size(), &look[0][0]);
+  }
+
+  void allocateDepth(int w, int h)
+  {
+    if (depthFBO) {
+      glDeleteFramebuffers(1, &depthFBO);
+      glDeleteTextures(1, &depthTexture);
+    }
+
+    depthWidth = w;
+    depthHeight = h;
+
+    // the same format as DynamicResolution's depth, which the blit needs
+    glGenTextures(1, &depthTexture);
+    glActiveTexture(GL_TEXTURE0 + depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenFramebuffers(1, &depthFBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      printf("particle depth copy %dx%d is incomplete\n", w, h);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+};
+#endif
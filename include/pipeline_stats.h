@@ -0,0 +1,144 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <glad/glad.h>
+#include <gl_caps.h>
+#include <query_ring.h>
+
+#include <stdio.h>
+#include <string.h>
+
+// GL_ARB_pipeline_statistics_query (core in 4.6, under the same values); glad is
+// generated for 4.1, so the targets are spelled out here
+#ifndef GL_VERTICES_SUBMITTED_ARB
+#define GL_VERTICES_SUBMITTED_ARB 0x82EE
+#define GL_PRIMITIVES_SUBMITTED_ARB 0x82EF
+#define GL_VERTEX_SHADER_INVOCATIONS_ARB 0x82F0
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+#define PIPELINE_STATS_SHADOWS 0 // the point shadow atlas and the directional shadow map
+#define PIPELINE_STATS_MAIN 1 // everything drawn into the main pass's target
+#define PIPELINE_STATS_PASSES 2
+#define PIPELINE_STATS_COUNTERS 4 // vertices, vertex shader runs, primitives, fragment shader runs
+#define PIPELINE_STATS_REPORT_FRAMES 120 // printed as a per-frame average over this many
+
+// what each pass costs the gpu's fixed stages, counted by the gpu itself: vertices and
+// primitives submitted, how often the vertex shader actually ran for them (less than the
+// vertices when the post-transform cache hits) and how many fragment shader invocations
+// came out the other end. One query per counter per pass per frame, in a QueryRing.
+//
+// Drivers without the extension get a one-line note and no queries at all.
+class PipelineStats
+{
+public:
+  bool supported;
+  double average[PIPELINE_STATS_PASSES][PIPELINE_STATS_COUNTERS]; // per frame, over the last report
+
+  PipelineStats() : supported(false), queries(NULL), framesSummed(0)
+  {
+    supported = contextVersionAtLeast(4, 6) || contextHasExtension("GL_ARB_pipeline_statistics_query");
+    memset(average, 0, sizeof(average));
+    memset(totals, 0, sizeof(totals));
+
+    if (!supported) {
+      printf("pipeline statistics: not available (needs gl 4.6 or GL_ARB_pipeline_statistics_query)\n");
+      return;
+    }
+
+    queries = new QueryRing(PIPELINE_STATS_PASSES * PIPELINE_STATS_COUNTERS);
+  }
+
+  // brackets one pass; queries of different targets can all be running at once, but the
+  // passes can't nest
+  void begin(int pass)
+  {
+    if (!supported) {
+      return;
+    }
+
+    for (int c = 0; c < PIPELINE_STATS_COUNTERS; c++) {
+      glBeginQuery(targets(c), queries->query(pass * PIPELINE_STATS_COUNTERS + c));
+    }
+  }
+
+  void end()
+  {
+    if (!supported) {
+      return;
+    }
+
+    for (int c = 0; c < PIPELINE_STATS_COUNTERS; c++) {
+      glEndQuery(targets(c));
+    }
+  }
+
+  // after the frame's passes are all in: takes in whichever earlier frames have finished
+  void endFrame()
+  {
+    if (!supported) {
+      return;
+    }
+
+    queries->advance();
+    collect();
+  }
+
+  void release()
+  {
+    if (supported) {
+      queries->release();
+      delete queries;
+    }
+  }
+
+private:
+  QueryRing *queries; // only made when supported; pass-major within a frame
+  GLuint64 totals[PIPELINE_STATS_PASSES][PIPELINE_STATS_COUNTERS];
+  unsigned int framesSummed; // into totals, since the last report
+
+  static GLenum targets(int counter)
+  {
+    static const GLenum all[PIPELINE_STATS_COUNTERS] = {
+      GL_VERTICES_SUBMITTED_ARB, GL_VERTEX_SHADER_INVOCATIONS_ARB, GL_PRIMITIVES_SUBMITTED_ARB, GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+    };
+    return all[counter];
+  }
+
+  // reads back finished frames, oldest first; right after advance(), so a full ring
+  // means the next frame needs the oldest one's queries and it's waited for
+  void collect()
+  {
+    for (int slot = queries->next(); slot >= 0; slot = queries->next()) {
+      for (int p = 0; p < PIPELINE_STATS_PASSES; p++) {
+        for (int c = 0; c < PIPELINE_STATS_COUNTERS; c++) {
+          totals[p][c] += queries->result(slot, p * PIPELINE_STATS_COUNTERS + c);
+        }
+      }
+
+      queries->consumed();
+
+      if (++framesSummed == PIPELINE_STATS_REPORT_FRAMES) {
+        report();
+      }
+    }
+  }
+
+  void report()
+  {
+    static const char *const names[PIPELINE_STATS_PASSES] = { "shadows", "main pass" };
+
+    for (int p = 0; p < PIPELINE_STATS_PASSES; p++) {
+      for (int c = 0; c < PIPELINE_STATS_COUNTERS; c++) {
+        average[p][c] = (double)totals[p][c] / framesSummed;
+        totals[p][c] = 0;
+      }
+
+      printf("%s per frame: %.1fk vertices (%.1fk shaded), %.1fk primitives, %.2fM fragments\n", names[p],
+             average[p][0] / 1000.0, average[p][1] / 1000.0, average[p][2] / 1000.0, average[p][3] / 1000000.0);
+    }
+
+    framesSummed = 0;
+  }
+};
+#endif
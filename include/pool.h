@@ -0,0 +1,122 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// fixed-size storage for N objects of one type, handed out like malloc (uninitialized)
+// from an index free list. Nothing touches the heap after construction, and released
+// slots are reused most-recently-freed first while they're still warm in cache.
+template <typename T, unsigned int N>
+class Pool
+{
+public:
+  unsigned int live;
+
+  Pool() : live(0), used(0), freeHead(-1) {}
+
+  T *alloc()
+  {
+    int slot;
+
+    if (freeHead >= 0) {
+      slot = freeHead;
+      freeHead = next[slot];
+    } else if (used < N) {
+      slot = used++;
+    } else {
+      printf("pool of %u x %u byte objects is full\n", N, (unsigned int)sizeof(T));
+      return NULL;
+    }
+
+    live++;
+    return items() + slot;
+  }
+
+  void release(T *item)
+  {
+    if (item == NULL) {
+      return;
+    }
+
+    int slot = item - items();
+    next[slot] = freeHead;
+    freeHead = slot;
+    live--;
+  }
+
+private:
+  unsigned int used; // slots ever handed out; everything past this is untouched
+  int freeHead;
+  int next[N];
+  alignas(T) unsigned char storage[N * sizeof(T)];
+
+  T *items()
+  {
+    return (T *)storage;
+  }
+};
+
+// bump allocator for data that only lives until the end of the frame (draw lists and the
+// like). One block is allocated up front; reset() rewinds it once the frame is submitted.
+class FrameArena
+{
+public:
+  unsigned int capacity;
+  unsigned int used;
+  unsigned int highWater; // most bytes any single frame has needed
+
+  FrameArena(unsigned int capacity) : capacity(capacity), used(0), highWater(0)
+  {
+    buffer = (unsigned char *)malloc(capacity);
+  }
+
+  ~FrameArena()
+  {
+    free(buffer);
+  }
+
+  // NULL when the frame has outgrown the arena; callers fall back to doing less
+  void *alloc(unsigned int size, unsigned int align = 16)
+  {
+    unsigned int start = (used + align - 1) & ~(align - 1);
+
+    if (start + size > capacity) {
+      printf("frame arena out of space (%u of %u bytes used)\n", used, capacity);
+      return NULL;
+    }
+
+    used = start + size;
+    return buffer + start;
+  }
+
+  template <typename T>
+  T *allocArray(unsigned int count)
+  {
+    return (T *)alloc(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+  }
+
+  // makes room for at least `size` bytes; only between frames, since it moves the block
+  void reserve(unsigned int size)
+  {
+    if (size > capacity && used == 0) {
+      free(buffer);
+      buffer = (unsigned char *)malloc(size);
+      capacity = size;
+    }
+  }
+
+  void reset()
+  {
+    if (used > highWater) {
+      highWater = used;
+    }
+
+    used = 0;
+  }
+
+private:
+  unsigned char *buffer;
+};
+#endif
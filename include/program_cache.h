@@ -0,0 +1,213 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#define PROGRAM_CACHE_DIR "shader_cache"
+#define PROGRAM_CACHE_MAGIC 0x43505448 // "HTPC", little-endian
+
+// stores linked program binaries on disk so later launches can skip the compile+link.
+// entries are keyed by a hash of both sources, the injected defines and the driver
+// strings, so a driver update or shader edit just produces a miss rather than a bad load.
+class ProgramCache
+{
+public:
+  int hits;
+  int misses;
+  int rejected;
+  double totalMs;
+
+  ProgramCache() : hits(0), misses(0), rejected(0), totalMs(0.0), supported(-1) {}
+
+  uint64_t key(const std::string &vertexCode, const std::string &fragmentCode, const std::string &defines)
+  {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a offset basis
+    h = fnv1a(h, vertexCode.c_str(), vertexCode.size());
+    h = fnv1a(h, fragmentCode.c_str(), fragmentCode.size());
+    h = fnv1a(h, defines.c_str(), defines.size());
+    h = fnv1a(h, glGetString(GL_VENDOR));
+    h = fnv1a(h, glGetString(GL_RENDERER));
+    h = fnv1a(h, glGetString(GL_VERSION));
+    return h;
+  }
+
+  bool isSupported()
+  {
+    if (supported < 0) {
+      int numFormats = 0;
+      glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+      supported = numFormats > 0 ? 1 : 0;
+
+      if (!supported) {
+        std::cout << "shader cache: driver exposes no program binary formats, caching disabled" << std::endl;
+      }
+    }
+
+    return supported == 1;
+  }
+
+  // tries to fill `program` from disk; false on a missing entry, a damaged one or a
+  // driver rejection, in which case the caller should create a fresh program and compile
+  // from source. Anything that was there but unusable is deleted so it's rewritten.
+  bool load(unsigned int program, uint64_t key)
+  {
+    if (!isSupported()) {
+      return false;
+    }
+
+    std::ifstream file(path(key).c_str(), std::ios::binary | std::ios::ate);
+
+    if (!file) {
+      return false;
+    }
+
+    // the length field is only trusted once it agrees with the file's real size
+    std::streamoff fileSize = file.tellg();
+    uint32_t header[3]; // magic, format, length
+    file.seekg(0);
+    file.read((char *)header, sizeof(header));
+
+    if (!file || header[0] != PROGRAM_CACHE_MAGIC || header[2] == 0 ||
+        (std::streamoff)header[2] != fileSize - (std::streamoff)sizeof(header)) {
+      file.close();
+      return discard(key, "is damaged");
+    }
+
+    std::vector<char> binary(header[2]);
+    file.read(binary.data(), binary.size());
+
+    if (!file) {
+      file.close();
+      return discard(key, "couldn't be read");
+    }
+
+    file.close();
+    glProgramBinary(program, header[1], binary.data(), (GLsizei)binary.size());
+
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    if (!success) {
+      rejected++;
+      return discard(key, "was rejected by the driver");
+    }
+
+    return true;
+  }
+
+  // call before glLinkProgram so the driver keeps a retrievable binary around
+  void prepare(unsigned int program)
+  {
+    if (isSupported()) {
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+  }
+
+  void store(unsigned int program, uint64_t key)
+  {
+    if (!isSupported()) {
+      return;
+    }
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0) {
+      return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+    mkdir(PROGRAM_CACHE_DIR, 0755);
+    std::ofstream file(path(key).c_str(), std::ios::binary | std::ios::trunc);
+
+    if (!file) {
+      std::cout << "shader cache: could not write " << path(key) << std::endl;
+      return;
+    }
+
+    uint32_t header[3] = { PROGRAM_CACHE_MAGIC, format, (uint32_t)length };
+    file.write((const char *)header, sizeof(header));
+    file.write(binary.data(), binary.size());
+  }
+
+  void logResult(bool hit, const std::string &label, std::chrono::steady_clock::time_point start)
+  {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    totalMs += ms;
+
+    if (hit) {
+      hits++;
+    } else {
+      misses++;
+    }
+
+    printf("shader cache %s: %s (%.2f ms)\n", hit ? "hit" : "miss", label.c_str(), ms);
+  }
+
+  void report()
+  {
+    printf("shader cache: %d hits, %d misses, %d rejected, %.2f ms total\n", hits, misses, rejected, totalMs);
+  }
+
+private:
+  int supported;
+
+  // deletes an unusable entry so the recompile replaces it; always false, for load()
+  bool discard(uint64_t key, const char *why)
+  {
+    std::cout << "shader cache: " << path(key) << " " << why << ", recompiling" << std::endl;
+    remove(path(key).c_str());
+    return false;
+  }
+
+  static uint64_t fnv1a(uint64_t h, const void *data, size_t size)
+  {
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    for (size_t i = 0; i < size; i++) {
+      h ^= bytes[i];
+      h *= 1099511628211ULL; // FNV-1a prime
+    }
+
+    // separator so "ab"+"c" and "a"+"bc" hash differently
+    h ^= 0xff;
+    h *= 1099511628211ULL;
+    return h;
+  }
+
+  static uint64_t fnv1a(uint64_t h, const GLubyte *glString)
+  {
+    const char *str = glString ? (const char *)glString : "";
+    return fnv1a(h, str, strlen(str));
+  }
+
+  static std::string path(uint64_t key)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%016llx.bin", PROGRAM_CACHE_DIR, (unsigned long long)key);
+    return name;
+  }
+};
+
+// one cache shared by every Shader in the process
+inline ProgramCache &programCache()
+{
+  static ProgramCache cache;
+  return cache;
+}
+
+#endif
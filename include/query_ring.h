@@ -0,0 +1,89 @@
+#ifndef QUERY_RING_H
+#define QUERY_RING_H
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#define QUERY_RING_FRAMES 4 // frames of queries in flight; results are read a few frames late
+
+// GL queries for the last few frames, reused round robin so reading a result never has
+// to stall on the frame just submitted. Each frame gets `perFrame` queries; the owner
+// begins and ends them itself, then calls advance() once the frame's are all issued.
+//
+// Results come back oldest frame first through next(), which only hands out a frame
+// whose queries have all finished -- unless the ring is full, in which case the next
+// frame needs that one's queries and it waits rather than drop them.
+class QueryRing
+{
+public:
+  QueryRing(unsigned int perFrame) : perFrame(perFrame), queries(QUERY_RING_FRAMES * perFrame), issued(0), collected(0)
+  {
+    glGenQueries(queries.size(), queries.data());
+  }
+
+  // the frame being issued; owners index any per-frame data of their own with it
+  unsigned int current()
+  {
+    return issued % QUERY_RING_FRAMES;
+  }
+
+  // query `i` of the frame being issued
+  unsigned int query(unsigned int i)
+  {
+    return queries[current() * perFrame + i];
+  }
+
+  void advance()
+  {
+    issued++;
+  }
+
+  // the oldest unread frame's slot, if its results can be read now; -1 otherwise. Read
+  // them with result(), then call consumed() and ask again.
+  int next()
+  {
+    if (collected == issued) {
+      return -1;
+    }
+
+    unsigned int slot = collected % QUERY_RING_FRAMES;
+
+    if (issued - collected < QUERY_RING_FRAMES) {
+      for (unsigned int i = 0; i < perFrame; i++) {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[slot * perFrame + i], GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (!available) {
+          return -1;
+        }
+      }
+    }
+
+    return slot;
+  }
+
+  GLuint64 result(int slot, unsigned int i)
+  {
+    GLuint64 value = 0;
+    glGetQueryObjectui64v(queries[slot * perFrame + i], GL_QUERY_RESULT, &value);
+    return value;
+  }
+
+  void consumed()
+  {
+    collected++;
+  }
+
+  void release()
+  {
+    glDeleteQueries(queries.size(), queries.data());
+  }
+
+private:
+  unsigned int perFrame;
+  std::vector<unsigned int> queries; // frame-major
+  unsigned int issued; // frames ever issued
+  unsigned int collected; // frames ever read back
+};
+#endif
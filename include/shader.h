@@ -2,23 +2,84 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <gl_caps.h>
+#include <program_cache.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+
+// from GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile; glad is generated
+// without extensions so the enum and entry point are declared here
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// uniform blocks shared between programs sit at fixed binding points. GLSL 410 can't say
+// layout(binding = N) on a block, so every program is pointed at them after linking.
+#define FRAME_BLOCK_BINDING 0
+#define MATERIAL_BLOCK_BINDING 1
+
+// set by ShaderBatch once the driver says it can compile in the background
+inline bool &parallelShaderCompileEnabled()
+{
+  static bool enabled = false;
+  return enabled;
+}
+
+// declarations every stage of every program starts with, after #version and its
+// defines: the uniform blocks shared between programs, set once at startup by whoever
+// owns their C++ layout, so no shader declares its own copy
+inline std::string &sharedShaderDeclarations()
+{
+  static std::string declarations;
+  return declarations;
+}
 
 class Shader
 {
 public:
   unsigned int ID;
+  int currentMaterial; // id of the material whose samplers are loaded, -1 for none
 
-  // constructor generates the shader
-  Shader(const char* vertexPath, const char* fragmentPath)
+  // constructor submits the shader; it's compiled and linked by the time use() returns.
+  // `defines` (e.g. "#define SHADOWS\n") is injected into every stage right after #version,
+  // followed by sharedShaderDeclarations().
+  // A geometry stage is optional, and so are transform feedback outputs: the named
+  // varyings are captured interleaved, in order, into whatever buffer is bound at index 0.
+  Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = "", const char *geometryPath = NULL,
+         const char *const *feedbackVaryings = NULL, int numFeedbackVaryings = 0)
+    : currentMaterial(-1), vertex(0), fragment(0), geometry(0), pending(false), cacheKey(0)
   {
+    start = std::chrono::steady_clock::now();
+    label = std::string(vertexPath) + " + " + fragmentPath;
+
+    if (geometryPath) {
+      label += std::string(" + ") + geometryPath;
+    }
+
+    if (!defines.empty()) {
+      // "#define A\n#define B 4\n" shows up in the logs as "[A, B 4]"
+      std::string names = defines;
+      size_t pos;
+
+      while ((pos = names.find("#define ")) != std::string::npos) {
+        names.erase(pos, 8);
+      }
+
+      while ((pos = names.find('\n')) != std::string::npos && pos + 1 < names.size()) {
+        names.replace(pos, 1, ", ");
+      }
+
+      label += " [" + names.substr(0, names.size() - 1) + "]";
+    }
+
     // 1. retrieve the vertex/fragment source code from filePath
     std::string vertexCode;
     std::string fragmentCode;
+    std::string geometryCode;
     std::ifstream vShaderFile;
     std::ifstream fShaderFile;
 
@@ -43,69 +104,228 @@ public:
       // convert stream into string
       vertexCode   = vShaderStream.str();
       fragmentCode = fShaderStream.str();
+
+      if (geometryPath) {
+        std::ifstream gShaderFile;
+        std::stringstream gShaderStream;
+        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        gShaderFile.open(geometryPath);
+        gShaderStream << gShaderFile.rdbuf();
+        gShaderFile.close();
+        geometryCode = gShaderStream.str();
+      }
     } catch (std::ifstream::failure& e) {
       std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
     }
 
+    std::string prelude = defines + sharedShaderDeclarations();
+    vertexCode = injectDefines(vertexCode, prelude);
+    fragmentCode = injectDefines(fragmentCode, prelude);
+
+    if (geometryPath) {
+      geometryCode = injectDefines(geometryCode, prelude);
+    }
+
+    // 2. try a previously linked binary for these exact sources + driver
+    ProgramCache &cache = programCache();
+    std::string feedback;
+
+    for (int i = 0; i < numFeedbackVaryings; i++) {
+      feedback += std::string("// captures ") + feedbackVaryings[i] + "\n";
+    }
+
+    cacheKey = cache.key(vertexCode + geometryCode, fragmentCode, defines + feedback);
+    ID = glCreateProgram();
+
+    if (cache.load(ID, cacheKey)) {
+      bindUniformBlocks();
+      cache.logResult(true, label, start);
+      return;
+    }
+
+    // a rejected binary leaves the program in a failed-link state; start over clean
+    glDeleteProgram(ID);
+
     const char* vShaderCode = vertexCode.c_str();
     const char * fShaderCode = fragmentCode.c_str();
 
-    // 2. compile shaders
-    unsigned int vertex, fragment;
+    // 3. compile shaders; status isn't checked here so the driver can keep working on
+    // this program while we submit the next one (see finish())
 
     // vertex shader
     vertex = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vertex, 1, &vShaderCode, NULL);
     glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
 
     // fragment Shader
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(fragment, 1, &fShaderCode, NULL);
     glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
+
+    // geometry shader, if there is one
+    if (geometryPath) {
+      const char *gShaderCode = geometryCode.c_str();
+      geometry = glCreateShader(GL_GEOMETRY_SHADER);
+      glShaderSource(geometry, 1, &gShaderCode, NULL);
+      glCompileShader(geometry);
+    }
 
     // shader Program
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
+
+    if (geometry) {
+      glAttachShader(ID, geometry);
+    }
+
+    if (numFeedbackVaryings > 0) {
+      glTransformFeedbackVaryings(ID, numFeedbackVaryings, feedbackVaryings, GL_INTERLEAVED_ATTRIBS);
+    }
+
+    cache.prepare(ID);
     glLinkProgram(ID);
-    checkCompileErrors(ID, "PROGRAM");
+    pending = true;
+  }
+
+  // non-blocking check; only the parallel compile extensions let us ask without stalling,
+  // so without them a program stays "not ready" until its first use() finishes it
+  bool isReady()
+  {
+    if (!pending) {
+      return true;
+    }
+
+    if (!parallelShaderCompileEnabled()) {
+      return false;
+    }
+
+    int done = 0;
+    glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+
+    if (done) {
+      finish();
+    }
+
+    return done;
+  }
+
+  // blocks until the driver is done with this program, then reports errors and caches it
+  void finish()
+  {
+    if (!pending) {
+      return;
+    }
+
+    pending = false;
+    checkCompileErrors(vertex, "VERTEX");
+    checkCompileErrors(fragment, "FRAGMENT");
+
+    if (geometry) {
+      checkCompileErrors(geometry, "GEOMETRY");
+    }
+
+    ProgramCache &cache = programCache();
+
+    if (checkCompileErrors(ID, "PROGRAM")) {
+      cache.store(ID, cacheKey);
+      bindUniformBlocks();
+    }
+
+    cache.logResult(false, label, start);
 
     // delete the shaders as they're linked into our program now and no longer necessary
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+
+    if (geometry) {
+      glDeleteShader(geometry);
+    }
   }
 
   void use()
   {
+    finish();
     glUseProgram(ID);
   }
 
-  // utility uniform functions
-  void setBool(const std::string &name, bool value) const
+  // utility uniform functions; plain char pointers so per-frame calls don't build std::strings
+  void setBool(const char *name, bool value) const
+  {
+    glUniform1i(glGetUniformLocation(ID, name), (int)value);
+  }
+
+  void setInt(const char *name, int value) const
   {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(glGetUniformLocation(ID, name), value);
   }
 
-  void setInt(const std::string &name, int value) const
+  void setFloat(const char *name, float value) const
   {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(glGetUniformLocation(ID, name), value);
   }
 
-  void setFloat(const std::string &name, float value) const
+  void setVec2f(const char *name, float v1, float v2) const
   {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform2f(glGetUniformLocation(ID, name), v1, v2);
   }
 
-  void setVec3f(const std::string &name, float v1, float v2, float v3) const
+  void setVec3f(const char *name, float v1, float v2, float v3) const
   {
-    glUniform3f(glGetUniformLocation(ID, name.c_str()), v1, v2, v3);
+    glUniform3f(glGetUniformLocation(ID, name), v1, v2, v3);
+  }
+
+  // arrays of `count` vec4s/mat4s, packed one after another
+  void setVec4fv(const char *name, int count, const float *values) const
+  {
+    glUniform4fv(glGetUniformLocation(ID, name), count, values);
+  }
+
+  void setMat4fv(const char *name, int count, const float *values) const
+  {
+    glUniformMatrix4fv(glGetUniformLocation(ID, name), count, GL_FALSE, values);
   }
 
 private:
-  // utility function for checking shader compilation/linking errors.
-  void checkCompileErrors(unsigned int shader, std::string type)
+  unsigned int vertex, fragment, geometry;
+  bool pending;
+  uint64_t cacheKey;
+  std::string label;
+  std::chrono::steady_clock::time_point start;
+
+  void bindUniformBlocks()
+  {
+    unsigned int frameBlock = glGetUniformBlockIndex(ID, "FrameBlock");
+
+    if (frameBlock != GL_INVALID_INDEX) {
+      glUniformBlockBinding(ID, frameBlock, FRAME_BLOCK_BINDING);
+    }
+
+    unsigned int materialBlock = glGetUniformBlockIndex(ID, "MaterialBlock");
+
+    if (materialBlock != GL_INVALID_INDEX) {
+      glUniformBlockBinding(ID, materialBlock, MATERIAL_BLOCK_BINDING);
+    }
+  }
+
+  // #version has to stay the first line, so defines go in just after it
+  static std::string injectDefines(const std::string &code, const std::string &defines)
+  {
+    if (defines.empty()) {
+      return code;
+    }
+
+    size_t versionEnd = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+
+    if (versionEnd == std::string::npos) {
+      return defines + code;
+    }
+
+    return code.substr(0, versionEnd + 1) + defines + code.substr(versionEnd + 1);
+  }
+
+  // utility function for checking shader compilation/linking errors; true when it went fine.
+  bool checkCompileErrors(unsigned int shader, std::string type)
   {
     int success;
     char infoLog[1024];
@@ -125,6 +345,66 @@ private:
         std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
       }
     }
+
+    return success;
   }
 };
+
+// submits a group of programs up front and lets the driver compile them side by side.
+// Shaders never block in their constructor, so building every Shader first and doing
+// other startup work (texture loading) afterwards overlaps the two; each program is
+// only waited on when it's first used.
+class ShaderBatch
+{
+public:
+  ShaderBatch(GLADloadproc load)
+  {
+    start = std::chrono::steady_clock::now();
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads = NULL;
+
+    if (contextHasExtension("GL_KHR_parallel_shader_compile")) {
+      maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+    } else if (contextHasExtension("GL_ARB_parallel_shader_compile")) {
+      maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+    }
+
+    if (maxThreads) {
+      maxThreads(0xFFFFFFFF); // let the implementation pick
+      parallelShaderCompileEnabled() = true;
+    }
+
+    printf("shader batch: parallel compile %s\n", maxThreads ? "enabled" : "unavailable, relying on deferred status checks");
+  }
+
+  void add(Shader *shader)
+  {
+    shaders.push_back(shader);
+  }
+
+  // finishes whatever the driver has completed without waiting on the rest
+  int poll()
+  {
+    int ready = 0;
+
+    for (unsigned int i = 0; i < shaders.size(); i++) {
+      if (shaders[i]->isReady()) {
+        ready++;
+      }
+    }
+
+    return ready;
+  }
+
+  void report()
+  {
+    int ready = poll();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("shader batch: %d/%d programs ready %.2f ms after submit\n", ready, (int)shaders.size(), ms);
+    programCache().report();
+  }
+
+private:
+  std::vector<Shader *> shaders;
+  std::chrono::steady_clock::time_point start;
+};
 #endif
\ No newline at end of file
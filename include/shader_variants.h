@@ -0,0 +1,133 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <shader.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// feature bits understood by lighting_shader.vs/.fs; each one becomes a #define
+#define SHADER_HAS_EMISSION     (1 << 0)
+#define SHADER_HAS_SPECULAR_MAP (1 << 1)
+#define SHADER_SHADOWS          (1 << 2)
+#define SHADER_REFLECTION       (1 << 3)
+#define SHADER_DEPTH_ONLY       (1 << 4)
+#define SHADER_VOXEL            (1 << 5) // texture array lookup by a per-vertex layer
+#define SHADER_POINT_SHADOWS    (1 << 6) // point lights look themselves up in the shadow atlas
+#define SHADER_GPU_LIGHTS       (1 << 7) // point lights come from GpuAnimator's buffer, not uniforms
+#define SHADER_OVERDRAW         (1 << 8) // counts fragments instead of shading them
+// the upper bits hold the size of the point light array the variant was built for
+#define SHADER_LIGHTS_SHIFT 16
+#define SHADER_LIGHTS(n) ((unsigned int)(n) << SHADER_LIGHTS_SHIFT)
+#define SHADER_LIGHTS_OF(features) ((features) >> SHADER_LIGHTS_SHIFT)
+
+typedef struct {
+  unsigned int features;
+  Shader *shader;
+  bool configured; // free for the owner to track one-time uniform setup
+} ShaderVariant;
+
+// one vertex/fragment pair compiled with different feature #defines. Variants are
+// built (or pulled from the program cache) the first time a feature set is asked for.
+class ShaderVariants
+{
+public:
+  ShaderVariants(const char *vertexPath, const char *fragmentPath, ShaderBatch *batch = NULL)
+    : vertexPath(vertexPath), fragmentPath(fragmentPath), batch(batch) {}
+
+  ~ShaderVariants()
+  {
+    for (unsigned int i = 0; i < variants.size(); i++) {
+      delete variants[i].shader;
+    }
+  }
+
+  Shader *get(unsigned int features)
+  {
+    for (unsigned int i = 0; i < variants.size(); i++) {
+      if (variants[i].features == features) {
+        return variants[i].shader;
+      }
+    }
+
+    ShaderVariant variant;
+    variant.features = features;
+    variant.shader = new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines(features));
+    variant.configured = false;
+    variants.push_back(variant);
+
+    if (batch) {
+      batch->add(variant.shader);
+    }
+
+    return variant.shader;
+  }
+
+  unsigned int count()
+  {
+    return variants.size();
+  }
+
+  ShaderVariant *at(unsigned int i)
+  {
+    return &variants[i];
+  }
+
+  static std::string defines(unsigned int features)
+  {
+    std::string result;
+
+    if (features & SHADER_HAS_EMISSION) {
+      result += "#define HAS_EMISSION\n";
+    }
+
+    if (features & SHADER_HAS_SPECULAR_MAP) {
+      result += "#define HAS_SPECULAR_MAP\n";
+    }
+
+    if (features & SHADER_SHADOWS) {
+      result += "#define SHADOWS\n";
+    }
+
+    if (features & SHADER_REFLECTION) {
+      result += "#define REFLECTION\n";
+    }
+
+    if (features & SHADER_DEPTH_ONLY) {
+      result += "#define DEPTH_ONLY\n";
+    }
+
+    if (features & SHADER_VOXEL) {
+      result += "#define VOXEL\n";
+    }
+
+    if (features & SHADER_POINT_SHADOWS) {
+      result += "#define POINT_SHADOWS\n";
+    }
+
+    if (features & SHADER_GPU_LIGHTS) {
+      result += "#define GPU_LIGHTS\n";
+    }
+
+    if (features & SHADER_OVERDRAW) {
+      result += "#define OVERDRAW\n";
+    }
+
+    if (SHADER_LIGHTS_OF(features) > 0) {
+      char maxLights[48];
+      snprintf(maxLights, sizeof(maxLights), "#define MAX_NUM_OF_LIGHTS %u\n", SHADER_LIGHTS_OF(features));
+      result += maxLights;
+    }
+
+    return result;
+  }
+
+private:
+  std::string vertexPath;
+  std::string fragmentPath;
+  ShaderBatch *batch;
+  std::vector<ShaderVariant> variants;
+};
+#endif
@@ -0,0 +1,270 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <shader.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+#define SHADOW_ATLAS_SIZE 4096 // square, DEPTH_COMPONENT16: 32MB however many lights there are
+#define SHADOW_ATLAS_TIERS 3
+#define SHADOW_ATLAS_NEAR 0.05f
+#define SHADOW_ATLAS_NO_TIER -1
+
+// one tier of the atlas: a horizontal band cut into blocks of 3x2 faces of one size
+typedef struct {
+  int faceSize; // texels per cube face
+  int top; // first row of the band
+  int height;
+} ShadowAtlasTier;
+
+static const ShadowAtlasTier shadowAtlasTiers[SHADOW_ATLAS_TIERS] = {
+  { 256, 0, 2048 }, // 5x4 = 20 lights
+  { 128, 2048, 1024 }, // 10x4 = 40 lights
+  { 64, 3072, 1024 }, // 21x8 = 168 lights
+};
+
+// where a point light's six faces live in the atlas and what's in them
+typedef struct {
+  int tier; // SHADOW_ATLAS_NO_TIER when the light has no tile
+  int slot; // block within the tier
+  bool rendered; // the block holds this light's depth from renderedPos
+  bool dirty; // ... but the light, its tile, or something near it has changed since
+  glm::vec3 renderedPos;
+  float renderedFar;
+  unsigned int renderedFrame;
+} PointShadowState;
+
+// omnidirectional shadows for many point lights in one fixed-size depth texture. Every
+// light owns a block of six cube faces, sized by how much it matters on screen; all six
+// are drawn in one pass by a geometry shader that sends each triangle to the face
+// viewports through gl_ViewportIndex. Faces store linear distance to the light.
+//
+// A block is only redrawn once it's dirty, and then only when update() picks it: the
+// most important, longest-waiting dirty lights go first until the frame's budget of
+// texels runs out, and the rest keep last frame's shadows and wait their turn.
+class PointShadowAtlas
+{
+public:
+  unsigned int texture; // texture id == texture unit, like the rest
+  unsigned int fbo;
+  std::vector<PointShadowState> lights;
+  std::vector<glm::vec4> tiles; // per light, for the shaders' pointShadowTiles[]
+
+  PointShadowAtlas(unsigned int maxLights) : frame(0)
+  {
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // sampled as a sampler2DShadow, so the hardware does 2x2 pcf for free
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      printf("point shadow atlas framebuffer is incomplete\n");
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    PointShadowState empty;
+    empty.tier = SHADOW_ATLAS_NO_TIER;
+    empty.slot = 0;
+    empty.rendered = false;
+    empty.dirty = false;
+    empty.renderedPos = glm::vec3(0.0f);
+    empty.renderedFar = 0.0f;
+    empty.renderedFrame = 0;
+    lights.resize(maxLights, empty);
+    tiles.resize(maxLights, glm::vec4(0.0f));
+
+    unsigned int numSlots = 0;
+
+    for (int i = 0; i < SHADOW_ATLAS_TIERS; i++) {
+      taken[i].resize(slotsIn(i), false);
+      numSlots += slotsIn(i);
+    }
+
+    printf("point shadow atlas: %dx%d, texture id %u, room for %u lights\n", SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, texture, numSlots);
+  }
+
+  // moves the light to a block in `tier` (or a smaller one if that's full), or drops its
+  // block for SHADOW_ATLAS_NO_TIER. Keeping the same tier keeps the block and its contents.
+  void assign(unsigned int light, int tier)
+  {
+    PointShadowState *state = &lights[light];
+
+    if (state->tier == tier) {
+      return;
+    }
+
+    if (state->tier != SHADOW_ATLAS_NO_TIER) {
+      taken[state->tier][state->slot] = false;
+    }
+
+    state->tier = SHADOW_ATLAS_NO_TIER;
+    state->rendered = false;
+    tiles[light] = glm::vec4(0.0f);
+
+    for (int t = tier; t != SHADOW_ATLAS_NO_TIER && t < SHADOW_ATLAS_TIERS; t++) {
+      for (unsigned int slot = 0; slot < taken[t].size(); slot++) {
+        if (!taken[t][slot]) {
+          taken[t][slot] = true;
+          state->tier = t;
+          state->slot = slot;
+          state->dirty = true;
+          return;
+        }
+      }
+    }
+  }
+
+  // the light moved, or something that casts into it did
+  void invalidate(unsigned int light)
+  {
+    lights[light].dirty = true;
+  }
+
+  void invalidateAll()
+  {
+    for (unsigned int i = 0; i < lights.size(); i++) {
+      lights[i].dirty = true;
+    }
+  }
+
+  // picks which dirty lights get redrawn this frame, best first, until `budgetTexels`
+  // would be exceeded (the first pick always fits, so nothing starves behind a big one).
+  // `priority` is per light; 0 means not worth drawing this frame. Returns the count.
+  unsigned int plan(const float *priority, unsigned int numLights, unsigned int budgetTexels, unsigned int *picked)
+  {
+    unsigned int count = 0;
+    unsigned int spent = 0;
+
+    frame++;
+
+    for (;;) {
+      int best = -1;
+      float bestScore = 0.0f;
+
+      for (unsigned int i = 0; i < numLights; i++) {
+        PointShadowState *state = &lights[i];
+
+        if (state->tier == SHADOW_ATLAS_NO_TIER || !state->dirty || priority[i] <= 0.0f) {
+          continue;
+        }
+
+        // a light that has never been drawn casts no shadow at all, so it goes first
+        float waited = state->rendered ? (float)(frame - state->renderedFrame) : 1000.0f;
+        float score = priority[i] * waited;
+
+        if (score > bestScore) {
+          best = i;
+          bestScore = score;
+        }
+      }
+
+      if (best < 0) {
+        break;
+      }
+
+      int faceSize = shadowAtlasTiers[lights[best].tier].faceSize;
+      unsigned int cost = 6 * faceSize * faceSize;
+
+      if (count > 0 && spent + cost > budgetTexels) {
+        break;
+      }
+
+      spent += cost;
+      lights[best].dirty = false; // taken off the list now; set again if it changes meanwhile
+      picked[count++] = best;
+    }
+
+    return count;
+  }
+
+  // clears the light's block and sets up the face viewports and the cube-depth program
+  // for drawing its casters; everything drawn until end() lands in all six faces
+  void beginLight(unsigned int light, glm::vec3 pos, float far, Shader *shader)
+  {
+    PointShadowState *state = &lights[light];
+    const ShadowAtlasTier *tier = &shadowAtlasTiers[state->tier];
+    int x, y;
+    blockCorner(state->tier, state->slot, &x, &y);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x, y, tier->faceSize * 3, tier->faceSize * 2);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+
+    // faces in the usual cube map order (+x, -x, +y, -y, +z, -z), 3 across and 2 down
+    static const glm::vec3 dirs[6] = {
+      glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
+      glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 ups[6] = {
+      glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
+      glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+    glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_ATLAS_NEAR, far);
+    glm::mat4 faceMatrices[6];
+
+    for (int f = 0; f < 6; f++) {
+      faceMatrices[f] = projection * glm::lookAt(pos, pos + dirs[f], ups[f]);
+      glViewportIndexedf(f, x + (f % 3) * tier->faceSize, y + (f / 3) * tier->faceSize, tier->faceSize, tier->faceSize);
+    }
+
+    shader->use();
+    shader->setMat4fv("faceMatrices", 6, &faceMatrices[0][0][0]);
+    shader->setVec3f("shadowLightPos", pos.x, pos.y, pos.z);
+    shader->setFloat("shadowFar", far);
+
+    state->rendered = true;
+    state->renderedPos = pos;
+    state->renderedFar = far;
+    state->renderedFrame = frame;
+    tiles[light] = glm::vec4((float)x / SHADOW_ATLAS_SIZE, (float)y / SHADOW_ATLAS_SIZE, (float)tier->faceSize / SHADOW_ATLAS_SIZE, far);
+  }
+
+  // back to the default framebuffer; the caller sets its own viewport (glViewport resets all of them)
+  void end()
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+private:
+  std::vector<bool> taken[SHADOW_ATLAS_TIERS];
+  unsigned int frame;
+
+  unsigned int columnsIn(int tier)
+  {
+    return SHADOW_ATLAS_SIZE / (shadowAtlasTiers[tier].faceSize * 3);
+  }
+
+  unsigned int slotsIn(int tier)
+  {
+    return columnsIn(tier) * (shadowAtlasTiers[tier].height / (shadowAtlasTiers[tier].faceSize * 2));
+  }
+
+  void blockCorner(int tier, int slot, int *x, int *y)
+  {
+    int faceSize = shadowAtlasTiers[tier].faceSize;
+    *x = (slot % columnsIn(tier)) * faceSize * 3;
+    *y = shadowAtlasTiers[tier].top + (slot / columnsIn(tier)) * faceSize * 2;
+  }
+};
+#endif
@@ -0,0 +1,1190 @@
+#ifndef SOFT_RASTER_H
+#define SOFT_RASTER_H
+
+#include <glm/glm.hpp>
+#include <transform_kernel.h>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SOFT_LANES_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SOFT_LANES_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SOFT_LANES_NEON
+#endif
+
+#define SOFT_TILE_SIZE 64 // pixels per side of a tile; one tile is one job for one thread
+#define SOFT_TILE_PIXELS (SOFT_TILE_SIZE * SOFT_TILE_SIZE)
+#define SOFT_LANES 8 // pixels shaded side by side, always in one row of one tile
+#define SOFT_SHADOW_SIZE 2048
+#define SOFT_MAX_LIGHTS 128
+#define SOFT_NO_TRIANGLE 0xffffffffu
+#define SOFT_GUARD_BAND 4.0f // triangles are clipped this many screens out, which keeps the edge math precise
+#define SOFT_ATTRIBUTES 8 // world position, normal, texture coords
+#define SOFT_PLANE_Z 0
+#define SOFT_PLANE_W 1 // 1/w
+#define SOFT_PLANE_ATTRIBUTE(k) (2 + (k)) // attribute k over w
+
+// 8 floats at once, with compares that produce lane masks; the same shape as
+// TransformLanes, but always 8 wide so tiles and the shading code don't depend on the isa
+#if defined(SOFT_LANES_AVX)
+struct SoftLanes
+{
+  typedef __m256 V;
+
+  static V set1(float f) { return _mm256_set1_ps(f); }
+  static V ramp() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+  static V load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, V a) { _mm256_storeu_ps(p, a); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+  static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+  static V gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static V ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+  static V andMask(V a, V b) { return _mm256_and_ps(a, b); }
+  static V select(V m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+  static int bits(V m) { return _mm256_movemask_ps(m); }
+};
+#elif defined(SOFT_LANES_SSE)
+struct SoftLanes
+{
+  typedef struct { __m128 lo, hi; } V;
+
+  static V make(__m128 lo, __m128 hi) { V v; v.lo = lo; v.hi = hi; return v; }
+  static V set1(float f) { return make(_mm_set1_ps(f), _mm_set1_ps(f)); }
+  static V ramp() { return make(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_setr_ps(4.0f, 5.0f, 6.0f, 7.0f)); }
+  static V load(const float *p) { return make(_mm_loadu_ps(p), _mm_loadu_ps(p + 4)); }
+  static void store(float *p, V a) { _mm_storeu_ps(p, a.lo); _mm_storeu_ps(p + 4, a.hi); }
+  static V add(V a, V b) { return make(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+  static V sub(V a, V b) { return make(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+  static V mul(V a, V b) { return make(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+  static V div(V a, V b) { return make(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)); }
+  static V min(V a, V b) { return make(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)); }
+  static V max(V a, V b) { return make(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+  static V sqrt(V a) { return make(_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)); }
+  static V lt(V a, V b) { return make(_mm_cmplt_ps(a.lo, b.lo), _mm_cmplt_ps(a.hi, b.hi)); }
+  static V le(V a, V b) { return make(_mm_cmple_ps(a.lo, b.lo), _mm_cmple_ps(a.hi, b.hi)); }
+  static V gt(V a, V b) { return make(_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi)); }
+  static V ge(V a, V b) { return make(_mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi)); }
+  static V andMask(V a, V b) { return make(_mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi)); }
+  static V select(V m, V a, V b)
+  {
+    return make(_mm_or_ps(_mm_and_ps(m.lo, a.lo), _mm_andnot_ps(m.lo, b.lo)),
+                _mm_or_ps(_mm_and_ps(m.hi, a.hi), _mm_andnot_ps(m.hi, b.hi)));
+  }
+  static int bits(V m) { return _mm_movemask_ps(m.lo) | (_mm_movemask_ps(m.hi) << 4); }
+};
+#elif defined(SOFT_LANES_NEON)
+struct SoftLanes
+{
+  typedef struct { float32x4_t lo, hi; } V;
+
+  static V make(float32x4_t lo, float32x4_t hi) { V v; v.lo = lo; v.hi = hi; return v; }
+  static float32x4_t maskOf(uint32x4_t m) { return vreinterpretq_f32_u32(m); }
+  static uint32x4_t u(float32x4_t m) { return vreinterpretq_u32_f32(m); }
+  static V set1(float f) { return make(vdupq_n_f32(f), vdupq_n_f32(f)); }
+  static V ramp() { static const float r[8] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f }; return load(r); }
+  static V load(const float *p) { return make(vld1q_f32(p), vld1q_f32(p + 4)); }
+  static void store(float *p, V a) { vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+  static V add(V a, V b) { return make(vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)); }
+  static V sub(V a, V b) { return make(vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)); }
+  static V mul(V a, V b) { return make(vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)); }
+  static V div(V a, V b) { return make(vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi)); }
+  static V min(V a, V b) { return make(vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi)); }
+  static V max(V a, V b) { return make(vmaxq_f32(a.lo, b.lo), vmaxq_f32(a.hi, b.hi)); }
+  static V sqrt(V a) { return make(vsqrtq_f32(a.lo), vsqrtq_f32(a.hi)); }
+  static V lt(V a, V b) { return make(maskOf(vcltq_f32(a.lo, b.lo)), maskOf(vcltq_f32(a.hi, b.hi))); }
+  static V le(V a, V b) { return make(maskOf(vcleq_f32(a.lo, b.lo)), maskOf(vcleq_f32(a.hi, b.hi))); }
+  static V gt(V a, V b) { return make(maskOf(vcgtq_f32(a.lo, b.lo)), maskOf(vcgtq_f32(a.hi, b.hi))); }
+  static V ge(V a, V b) { return make(maskOf(vcgeq_f32(a.lo, b.lo)), maskOf(vcgeq_f32(a.hi, b.hi))); }
+  static V andMask(V a, V b) { return make(maskOf(vandq_u32(u(a.lo), u(b.lo))), maskOf(vandq_u32(u(a.hi), u(b.hi)))); }
+  static V select(V m, V a, V b) { return make(vbslq_f32(u(m.lo), a.lo, b.lo), vbslq_f32(u(m.hi), a.hi, b.hi)); }
+  static int bits(V m)
+  {
+    static const uint32_t weights[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    uint32x4_t lo = vandq_u32(u(m.lo), vld1q_u32(weights));
+    uint32x4_t hi = vandq_u32(u(m.hi), vld1q_u32(weights + 4));
+    return (int)vaddvq_u32(vorrq_u32(lo, hi));
+  }
+};
+#else
+// plain loops; the compiler vectorizes most of them on its own
+struct SoftLanes
+{
+  typedef struct { float f[SOFT_LANES]; } V;
+
+#define SOFT_LANES_EACH(expr) V r; for (int i = 0; i < SOFT_LANES; i++) { r.f[i] = (expr); } return r
+  static float maskOf(bool b) { uint32_t u = b ? 0xffffffffu : 0; float f; memcpy(&f, &u, 4); return f; }
+  static bool isSet(float f) { uint32_t u; memcpy(&u, &f, 4); return u != 0; }
+  static V set1(float f) { SOFT_LANES_EACH(f); }
+  static V ramp() { SOFT_LANES_EACH((float)i); }
+  static V load(const float *p) { SOFT_LANES_EACH(p[i]); }
+  static void store(float *p, V a) { memcpy(p, a.f, sizeof(a.f)); }
+  static V add(V a, V b) { SOFT_LANES_EACH(a.f[i] + b.f[i]); }
+  static V sub(V a, V b) { SOFT_LANES_EACH(a.f[i] - b.f[i]); }
+  static V mul(V a, V b) { SOFT_LANES_EACH(a.f[i] * b.f[i]); }
+  static V div(V a, V b) { SOFT_LANES_EACH(a.f[i] / b.f[i]); }
+  static V min(V a, V b) { SOFT_LANES_EACH(b.f[i] < a.f[i] ? b.f[i] : a.f[i]); }
+  static V max(V a, V b) { SOFT_LANES_EACH(b.f[i] > a.f[i] ? b.f[i] : a.f[i]); }
+  static V sqrt(V a) { SOFT_LANES_EACH(sqrtf(a.f[i])); }
+  static V lt(V a, V b) { SOFT_LANES_EACH(maskOf(a.f[i] < b.f[i])); }
+  static V le(V a, V b) { SOFT_LANES_EACH(maskOf(a.f[i] <= b.f[i])); }
+  static V gt(V a, V b) { SOFT_LANES_EACH(maskOf(a.f[i] > b.f[i])); }
+  static V ge(V a, V b) { SOFT_LANES_EACH(maskOf(a.f[i] >= b.f[i])); }
+  static V andMask(V a, V b) { SOFT_LANES_EACH(maskOf(isSet(a.f[i]) && isSet(b.f[i]))); }
+  static V select(V m, V a, V b) { SOFT_LANES_EACH(isSet(m.f[i]) ? a.f[i] : b.f[i]); }
+  static int bits(V m) { int b = 0; for (int i = 0; i < SOFT_LANES; i++) { b |= isSet(m.f[i]) << i; } return b; }
+#undef SOFT_LANES_EACH
+};
+#endif
+
+typedef SoftLanes::V SoftV;
+
+// a vec3 per lane
+typedef struct {
+  SoftV x, y, z;
+} SoftVec3;
+
+// which terms of lighting_shader.fs a material gets, the same way its SHADER_* bits pick them
+typedef struct {
+  int diffuseTexture; // texture ids, as handed to addTexture()
+  int specularTexture;
+  int emissionValues;
+  int emissionMap;
+  float shininess;
+  bool specularMap;
+  bool emission;
+  bool shadows;
+  bool reflection;
+  bool unlit; // the light cubes: just `color`, no lighting
+  glm::vec3 color;
+} SoftMaterial;
+
+typedef struct {
+  glm::vec3 pos;
+  glm::vec3 ambient;
+  glm::vec3 diffuse;
+  glm::vec3 specular;
+  float constant;
+  float linear;
+  float quadratic;
+} SoftPointLight;
+
+// rgba8 texels, every mip level one after the other, row 0 at the bottom like GL's
+typedef struct {
+  int width;
+  int height;
+  int levels;
+  std::vector<uint32_t> texels;
+  std::vector<unsigned int> offsets; // level starts
+} SoftTexture;
+
+// a depth buffer stored tile by tile, so a thread working on one tile only touches one
+// contiguous block of memory; within a tile, rows run bottom to top
+typedef struct {
+  int width;
+  int height;
+  int tilesX;
+  int tilesY;
+  std::vector<float> depth;
+} SoftTarget;
+
+// one triangle after clipping and setup, in screen space. Edge functions and attribute
+// planes are relative to (originX, originY), the corner of its bounds, so they stay
+// precise however far from the corner of the screen it is.
+typedef struct {
+  float edgeA[3];
+  float edgeB[3];
+  float edgeC[3];
+  bool edgeInclusive[3]; // whether a pixel centre exactly on the edge is inside
+  float originX;
+  float originY;
+  int minX; // pixel bounds, inclusive and on screen
+  int minY;
+  int maxX;
+  int maxY;
+  float planes[2 + SOFT_ATTRIBUTES][3]; // SOFT_PLANE_*: value = a * x + b * y + c
+  const SoftMaterial *material;
+} SoftTriangle;
+
+// draws the same scene data as the GL path without a GPU. Triangles are set up and
+// binned to 64x64 tiles as they're submitted; endPass() then hands out tiles to a pool
+// of threads, one tile at a time. Each tile is rasterized into its own depth block and
+// a visibility buffer of triangle ids with 8-wide edge functions, and only then shaded,
+// 8 pixels at a time, so every pixel is lit exactly once however much overdraw there is.
+//
+// The shading follows lighting_shader.fs: the directional light with pcf from a shadow
+// map drawn by a depth-only pass, the shaded point lights max-combined with their
+// attenuation, the ambient fill, emission, and the skybox reflection.
+class SoftRasterizer
+{
+public:
+  // per frame shading state, filled in by the caller before endPass() of the main pass
+  glm::vec3 viewPos;
+  glm::mat4 lightSpaceMatrix;
+  glm::vec3 dirLightDir;
+  glm::vec3 dirLightAmbient;
+  glm::vec3 dirLightDiffuse;
+  glm::vec3 dirLightSpecular;
+  SoftPointLight pointLights[SOFT_MAX_LIGHTS];
+  int numPointLights;
+  glm::vec3 ambientFill;
+  int skyboxTexture; // cubemap id, -1 for none
+
+  std::vector<uint32_t> image; // the main pass's colors, rgba8, rows bottom to top
+  int width;
+  int height;
+
+  SoftRasterizer(unsigned int numThreads) :
+    numPointLights(0), skyboxTexture(-1), width(0), height(0), target(NULL), shading(false),
+    generation(0), busy(0), quit(false)
+  {
+    scratch.resize(numThreads + 1); // the thread that calls endPass() works too
+
+    for (unsigned int i = 0; i < scratch.size(); i++) {
+      scratch[i].resize(SOFT_TILE_PIXELS);
+    }
+
+    nextTile = 0;
+    resizeTarget(&shadowMap, SOFT_SHADOW_SIZE, SOFT_SHADOW_SIZE);
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+      workers.push_back(std::thread(&SoftRasterizer::workerLoop, this, i + 1));
+    }
+
+    printf("software rasterizer: %u threads, %dx%d tiles, %d lanes\n", numThreads + 1, SOFT_TILE_SIZE, SOFT_TILE_SIZE, SOFT_LANES);
+  }
+
+  ~SoftRasterizer()
+  {
+    {
+      std::lock_guard<std::mutex> lock(jobsLock);
+      quit = true;
+    }
+
+    jobsReady.notify_all();
+
+    for (unsigned int i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  // keeps a copy of a texture's pixels (3 or 4 channels) under its GL id, with mipmaps
+  void addTexture(unsigned int id, int w, int h, int channels, const unsigned char *data)
+  {
+    if (textures.size() <= id) {
+      textures.resize(id + 1);
+    }
+
+    fillTexture(&textures[id], w, h, channels, data, true);
+  }
+
+  // faces in GL's cube map order (+x, -x, +y, -y, +z, -z)
+  void addCubemapFace(unsigned int id, int face, int w, int h, int channels, const unsigned char *data)
+  {
+    if (cubeFaces.size() <= id * 6 + face) {
+      cubeFaces.resize(id * 6 + 6);
+    }
+
+    fillTexture(&cubeFaces[id * 6 + face], w, h, channels, data, false);
+  }
+
+  // starts the directional light's depth-only pass
+  void beginShadowPass(const glm::mat4 &lightViewProj)
+  {
+    beginPass(&shadowMap, lightViewProj, false);
+  }
+
+  // starts the main pass, drawn into `image` at w x h
+  void beginMainPass(int w, int h, const glm::mat4 &viewProj)
+  {
+    if (w != width || h != height) {
+      width = w;
+      height = h;
+      image.resize(w * h);
+      resizeTarget(&screen, w, h);
+    }
+
+    beginPass(&screen, viewProj, true);
+
+    // the skybox direction through any pixel, as a plane over the screen
+    glm::mat4 inverse = glm::inverse(viewProj);
+    glm::vec4 corner = inverse * glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f);
+    glm::vec4 right = inverse * glm::vec4(2.0f / w, 0.0f, 0.0f, 0.0f);
+    glm::vec4 up = inverse * glm::vec4(0.0f, 2.0f / h, 0.0f, 0.0f);
+    skyCorner = glm::vec3(corner) - corner.w * viewPos;
+    skyRight = glm::vec3(right) - right.w * viewPos;
+    skyUp = glm::vec3(up) - up.w * viewPos;
+  }
+
+  // non-indexed when `indices` is NULL; `vertices` is the WITH_ATTRIBUTES layout and
+  // `count` is the number of indices (or vertices) making up whole triangles
+  void draw(const float *vertices, const unsigned int *indices, unsigned int count, const InstanceTransform &transform, const SoftMaterial *material)
+  {
+    glm::mat3 normalMatrix(glm::vec3(transform.normalMatrix[0]), glm::vec3(transform.normalMatrix[1]), glm::vec3(transform.normalMatrix[2]));
+    glm::mat4 clip = passViewProj * transform.model;
+
+    for (unsigned int i = 0; i + 2 < count; i += 3) {
+      ClipVertex corners[3];
+
+      for (int c = 0; c < 3; c++) {
+        const float *v = vertices + (indices ? indices[i + c] : i + c) * 8;
+        glm::vec4 local(v[0], v[1], v[2], 1.0f);
+        corners[c].pos = clip * local;
+
+        if (shading) {
+          glm::vec3 world = glm::vec3(transform.model * local);
+          glm::vec3 normal = normalMatrix * glm::vec3(v[3], v[4], v[5]);
+          float attributes[SOFT_ATTRIBUTES] = { world.x, world.y, world.z, normal.x, normal.y, normal.z, v[6], v[7] };
+          memcpy(corners[c].attributes, attributes, sizeof(attributes));
+        }
+      }
+
+      clipTriangle(corners, material);
+    }
+  }
+
+  // draws every tile of the pass on every thread, and for the main pass shades it into `image`
+  void endPass()
+  {
+    {
+      std::lock_guard<std::mutex> lock(jobsLock);
+      nextTile = 0;
+      busy = workers.size();
+      generation++;
+    }
+
+    jobsReady.notify_all();
+    drawTiles(0);
+
+    std::unique_lock<std::mutex> lock(jobsLock);
+
+    while (busy > 0) {
+      jobsDone.wait(lock);
+    }
+  }
+
+private:
+  typedef struct {
+    glm::vec4 pos;
+    float attributes[SOFT_ATTRIBUTES];
+  } ClipVertex;
+
+  SoftTarget shadowMap;
+  SoftTarget screen;
+  SoftTarget *target; // the current pass's
+  bool shading; // main pass: fill the visibility buffer and shade; otherwise depth only
+  glm::mat4 passViewProj;
+  glm::vec3 skyCorner; // sky direction at pixel (0, 0), and per pixel right and up
+  glm::vec3 skyRight;
+  glm::vec3 skyUp;
+  std::vector<SoftTexture> textures; // by GL id
+  std::vector<SoftTexture> cubeFaces; // by GL id * 6 + face
+  std::vector<SoftTriangle> triangles; // this pass's, in submission order
+  std::vector<std::vector<unsigned int> > bins; // per tile, the triangles touching it, in order
+  std::vector<std::vector<unsigned int> > scratch; // per thread, one tile's triangle ids
+
+  std::vector<std::thread> workers;
+  std::mutex jobsLock;
+  std::condition_variable jobsReady;
+  std::condition_variable jobsDone;
+  std::atomic<unsigned int> nextTile;
+  unsigned int generation; // passes ever started
+  unsigned int busy; // workers still on this pass
+  bool quit;
+
+  static void resizeTarget(SoftTarget *t, int w, int h)
+  {
+    t->width = w;
+    t->height = h;
+    t->tilesX = (w + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    t->tilesY = (h + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    t->depth.resize(t->tilesX * t->tilesY * SOFT_TILE_PIXELS);
+  }
+
+  void beginPass(SoftTarget *t, const glm::mat4 &viewProj, bool shade)
+  {
+    target = t;
+    shading = shade;
+    passViewProj = viewProj;
+    triangles.clear();
+
+    // clear() keeps every bin's memory, so after the first few frames binning never allocates
+    if (bins.size() < (unsigned int)(t->tilesX * t->tilesY)) {
+      bins.resize(t->tilesX * t->tilesY);
+    }
+
+    for (unsigned int i = 0; i < bins.size(); i++) {
+      bins[i].clear();
+    }
+  }
+
+  static uint32_t packTexel(const unsigned char *p, int channels)
+  {
+    uint32_t a = channels == 4 ? p[3] : 255;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (a << 24);
+  }
+
+  static void fillTexture(SoftTexture *tex, int w, int h, int channels, const unsigned char *data, bool mipmaps)
+  {
+    tex->width = w;
+    tex->height = h;
+    tex->levels = 1;
+    tex->texels.resize(w * h);
+    tex->offsets.assign(1, 0);
+
+    for (int i = 0; i < w * h; i++) {
+      tex->texels[i] = packTexel(data + i * channels, channels);
+    }
+
+    // box filtered, like glGenerateMipmap
+    while (mipmaps && (w > 1 || h > 1)) {
+      int nw = w > 1 ? w / 2 : 1;
+      int nh = h > 1 ? h / 2 : 1;
+      unsigned int src = tex->offsets.back();
+      unsigned int dst = tex->texels.size();
+      tex->texels.resize(dst + nw * nh);
+      tex->offsets.push_back(dst);
+      tex->levels++;
+
+      for (int y = 0; y < nh; y++) {
+        for (int x = 0; x < nw; x++) {
+          int x0 = x * 2, x1 = x * 2 + 1 < w ? x * 2 + 1 : x * 2;
+          int y0 = y * 2, y1 = y * 2 + 1 < h ? y * 2 + 1 : y * 2;
+          uint32_t q[4] = { tex->texels[src + y0 * w + x0], tex->texels[src + y0 * w + x1],
+                            tex->texels[src + y1 * w + x0], tex->texels[src + y1 * w + x1] };
+          uint32_t out = 0;
+
+          for (int c = 0; c < 32; c += 8) {
+            uint32_t sum = ((q[0] >> c) & 255) + ((q[1] >> c) & 255) + ((q[2] >> c) & 255) + ((q[3] >> c) & 255);
+            out |= ((sum + 2) / 4) << c;
+          }
+
+          tex->texels[dst + y * nw + x] = out;
+        }
+      }
+
+      w = nw;
+      h = nh;
+    }
+  }
+
+  // repeat wrapping, nearest texel of the mip level `rho` (texture coords per pixel) picks
+  static glm::vec3 sample(const SoftTexture *tex, float u, float v, float rho)
+  {
+    if (tex == NULL || tex->texels.empty()) {
+      return glm::vec3(0.0f);
+    }
+
+    int level = 0;
+    float texelsPerPixel = rho * (tex->width > tex->height ? tex->width : tex->height);
+
+    if (texelsPerPixel > 1.0f) {
+      level = ilogbf(texelsPerPixel * 1.41421356f); // log2, rounded
+      level = level < tex->levels ? level : tex->levels - 1;
+    }
+
+    int w = tex->width >> level;
+    int h = tex->height >> level;
+    w = w > 0 ? w : 1;
+    h = h > 0 ? h : 1;
+
+    int x = (int)((u - floorf(u)) * w);
+    int y = (int)((v - floorf(v)) * h);
+    x = x < w ? x : w - 1;
+    y = y < h ? y : h - 1;
+
+    uint32_t t = tex->texels[tex->offsets[level] + y * w + x];
+    return glm::vec3(t & 255, (t >> 8) & 255, (t >> 16) & 255) * (1.0f / 255.0f);
+  }
+
+  // the face and coords GL would pick (the table in the spec's cube map section)
+  glm::vec3 sampleCube(int id, glm::vec3 d)
+  {
+    if (id < 0 || cubeFaces.size() < (unsigned int)id * 6 + 6) {
+      return glm::vec3(0.0f);
+    }
+
+    glm::vec3 a = glm::abs(d);
+    int face;
+    float ma, sc, tc;
+
+    if (a.x >= a.y && a.x >= a.z) {
+      face = d.x > 0.0f ? 0 : 1;
+      ma = a.x;
+      sc = d.x > 0.0f ? -d.z : d.z;
+      tc = -d.y;
+    } else if (a.y >= a.z) {
+      face = d.y > 0.0f ? 2 : 3;
+      ma = a.y;
+      sc = d.x;
+      tc = d.y > 0.0f ? d.z : -d.z;
+    } else {
+      face = d.z > 0.0f ? 4 : 5;
+      ma = a.z;
+      sc = d.z > 0.0f ? d.x : -d.x;
+      tc = -d.y;
+    }
+
+    if (ma <= 0.0f) {
+      return glm::vec3(0.0f);
+    }
+
+    float s = glm::clamp((sc / ma + 1.0f) * 0.5f, 0.0f, 0.9999f);
+    float t = glm::clamp((tc / ma + 1.0f) * 0.5f, 0.0f, 0.9999f);
+    return sample(&cubeFaces[id * 6 + face], s, t, 0.0f);
+  }
+
+  // drops what's off to one side, clips against the near plane and the guard band, then
+  // sets up whatever's left as a fan
+  void clipTriangle(const ClipVertex *corners, const SoftMaterial *material)
+  {
+    // x, y outside the guard band; z against the near and far planes
+    for (int axis = 0; axis < 3; axis++) {
+      float limit = axis < 2 ? SOFT_GUARD_BAND : 1.0f;
+      bool allAbove = true, allBelow = true;
+
+      for (int c = 0; c < 3; c++) {
+        allAbove = allAbove && corners[c].pos[axis] > corners[c].pos.w * limit;
+        allBelow = allBelow && corners[c].pos[axis] < -corners[c].pos.w * limit;
+      }
+
+      if (allAbove || allBelow) {
+        return;
+      }
+    }
+
+    // the near plane, then each side of the guard band; each plane adds at most one vertex
+    static const glm::vec4 planes[5] = {
+      glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+      glm::vec4(-1.0f, 0.0f, 0.0f, SOFT_GUARD_BAND), glm::vec4(1.0f, 0.0f, 0.0f, SOFT_GUARD_BAND),
+      glm::vec4(0.0f, -1.0f, 0.0f, SOFT_GUARD_BAND), glm::vec4(0.0f, 1.0f, 0.0f, SOFT_GUARD_BAND)
+    };
+    ClipVertex buffers[2][8];
+    ClipVertex *in = buffers[0];
+    ClipVertex *out = buffers[1];
+    int count = 3;
+    memcpy(in, corners, 3 * sizeof(ClipVertex));
+
+    for (int p = 0; p < 5 && count >= 3; p++) {
+      int outCount = 0;
+
+      for (int i = 0; i < count; i++) {
+        const ClipVertex *a = &in[i];
+        const ClipVertex *b = &in[(i + 1) % count];
+        float da = glm::dot(planes[p], a->pos);
+        float db = glm::dot(planes[p], b->pos);
+
+        if (da >= 0.0f) {
+          out[outCount++] = *a;
+        }
+
+        if ((da >= 0.0f) != (db >= 0.0f)) {
+          float t = da / (da - db);
+          ClipVertex *v = &out[outCount++];
+          v->pos = a->pos + (b->pos - a->pos) * t;
+
+          for (int k = 0; k < SOFT_ATTRIBUTES && shading; k++) {
+            v->attributes[k] = a->attributes[k] + (b->attributes[k] - a->attributes[k]) * t;
+          }
+        }
+      }
+
+      ClipVertex *swap = in;
+      in = out;
+      out = swap;
+      count = outCount;
+    }
+
+    for (int i = 1; i + 1 < count; i++) {
+      setupTriangle(&in[0], &in[i], &in[i + 1], material);
+    }
+  }
+
+  void setupTriangle(const ClipVertex *v0, const ClipVertex *v1, const ClipVertex *v2, const SoftMaterial *material)
+  {
+    const ClipVertex *v[3] = { v0, v1, v2 };
+    double sx[3], sy[3], invW[3];
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+
+    for (int c = 0; c < 3; c++) {
+      invW[c] = 1.0 / v[c]->pos.w;
+      // snapped to 1/256 of a pixel, so shared edges come out the same for both triangles
+      sx[c] = floor(((v[c]->pos.x * invW[c]) * 0.5 + 0.5) * target->width * 256.0 + 0.5) / 256.0;
+      sy[c] = floor(((v[c]->pos.y * invW[c]) * 0.5 + 0.5) * target->height * 256.0 + 0.5) / 256.0;
+      minX = fminf(minX, (float)sx[c]);
+      minY = fminf(minY, (float)sy[c]);
+      maxX = fmaxf(maxX, (float)sx[c]);
+      maxY = fmaxf(maxY, (float)sy[c]);
+    }
+
+    // pixels whose centres could be inside
+    SoftTriangle tri;
+    tri.minX = (int)ceilf(minX - 0.5f);
+    tri.minY = (int)ceilf(minY - 0.5f);
+    tri.maxX = (int)floorf(maxX - 0.5f);
+    tri.maxY = (int)floorf(maxY - 0.5f);
+    tri.minX = tri.minX > 0 ? tri.minX : 0;
+    tri.minY = tri.minY > 0 ? tri.minY : 0;
+    tri.maxX = tri.maxX < target->width - 1 ? tri.maxX : target->width - 1;
+    tri.maxY = tri.maxY < target->height - 1 ? tri.maxY : target->height - 1;
+
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY) {
+      return;
+    }
+
+    tri.originX = (float)tri.minX;
+    tri.originY = (float)tri.minY;
+
+    // edge i is opposite vertex i, so edge i over the area is vertex i's barycentric
+    double a[3], b[3], c[3];
+
+    for (int e = 0; e < 3; e++) {
+      int p = (e + 1) % 3, q = (e + 2) % 3;
+      double px = sx[p] - tri.originX, py = sy[p] - tri.originY;
+      a[e] = sy[p] - sy[q];
+      b[e] = sx[q] - sx[p];
+      c[e] = -(a[e] * px + b[e] * py);
+    }
+
+    double area = a[0] * (sx[0] - tri.originX) + b[0] * (sy[0] - tri.originY) + c[0];
+
+    if (area == 0.0) {
+      return;
+    }
+
+    // nothing is culled (the GL path doesn't either), so clockwise ones are just flipped
+    double sign = area > 0.0 ? 1.0 : -1.0;
+    double invArea = 1.0 / (area * sign);
+
+    for (int e = 0; e < 3; e++) {
+      a[e] *= sign;
+      b[e] *= sign;
+      c[e] *= sign;
+      tri.edgeA[e] = (float)a[e];
+      tri.edgeB[e] = (float)b[e];
+      tri.edgeC[e] = (float)c[e];
+      // of two triangles sharing an edge, exactly one owns the pixels right on it
+      tri.edgeInclusive[e] = a[e] > 0.0 || (a[e] == 0.0 && b[e] > 0.0);
+    }
+
+    int numPlanes = shading ? 2 + SOFT_ATTRIBUTES : 1;
+
+    for (int k = 0; k < numPlanes; k++) {
+      double f[3];
+
+      for (int i = 0; i < 3; i++) {
+        if (k == SOFT_PLANE_Z) {
+          f[i] = (v[i]->pos.z * invW[i]) * 0.5 + 0.5;
+        } else if (k == SOFT_PLANE_W) {
+          f[i] = invW[i];
+        } else {
+          f[i] = v[i]->attributes[k - SOFT_PLANE_ATTRIBUTE(0)] * invW[i];
+        }
+      }
+
+      tri.planes[k][0] = (float)((f[0] * a[0] + f[1] * a[1] + f[2] * a[2]) * invArea);
+      tri.planes[k][1] = (float)((f[0] * b[0] + f[1] * b[1] + f[2] * b[2]) * invArea);
+      tri.planes[k][2] = (float)((f[0] * c[0] + f[1] * c[1] + f[2] * c[2]) * invArea);
+    }
+
+    tri.material = material;
+    binTriangle(tri);
+  }
+
+  // adds the triangle to every tile its bounds touch, skipping tiles that lie wholly
+  // outside one of its edges
+  void binTriangle(const SoftTriangle &tri)
+  {
+    unsigned int index = triangles.size();
+    triangles.push_back(tri);
+
+    for (int ty = tri.minY / SOFT_TILE_SIZE; ty <= tri.maxY / SOFT_TILE_SIZE; ty++) {
+      for (int tx = tri.minX / SOFT_TILE_SIZE; tx <= tri.maxX / SOFT_TILE_SIZE; tx++) {
+        float x0 = tx * SOFT_TILE_SIZE + 0.5f - tri.originX, x1 = x0 + SOFT_TILE_SIZE - 1;
+        float y0 = ty * SOFT_TILE_SIZE + 0.5f - tri.originY, y1 = y0 + SOFT_TILE_SIZE - 1;
+        bool outside = false;
+
+        for (int e = 0; e < 3 && !outside; e++) {
+          float best = tri.edgeA[e] * (tri.edgeA[e] > 0.0f ? x1 : x0) + tri.edgeB[e] * (tri.edgeB[e] > 0.0f ? y1 : y0) + tri.edgeC[e];
+          outside = best < 0.0f;
+        }
+
+        if (!outside) {
+          bins[ty * target->tilesX + tx].push_back(index);
+        }
+      }
+    }
+  }
+
+  void workerLoop(unsigned int slot)
+  {
+    unsigned int seen = 0;
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(jobsLock);
+
+        while (!quit && generation == seen) {
+          jobsReady.wait(lock);
+        }
+
+        if (quit) {
+          return;
+        }
+
+        seen = generation;
+      }
+
+      drawTiles(slot);
+
+      std::lock_guard<std::mutex> lock(jobsLock);
+
+      if (--busy == 0) {
+        jobsDone.notify_one();
+      }
+    }
+  }
+
+  // takes tiles until there are none left
+  void drawTiles(unsigned int slot)
+  {
+    unsigned int numTiles = target->tilesX * target->tilesY;
+
+    for (unsigned int tile = nextTile++; tile < numTiles; tile = nextTile++) {
+      drawTile(tile, scratch[slot].data());
+    }
+  }
+
+  void drawTile(unsigned int tile, unsigned int *ids)
+  {
+    typedef SoftLanes L;
+    int tileX = (tile % target->tilesX) * SOFT_TILE_SIZE;
+    int tileY = (tile / target->tilesX) * SOFT_TILE_SIZE;
+    float *depth = target->depth.data() + tile * SOFT_TILE_PIXELS;
+    const std::vector<unsigned int> &bin = bins[tile];
+
+    for (int i = 0; i < SOFT_TILE_PIXELS; i++) {
+      depth[i] = 1.0f;
+    }
+
+    if (shading) {
+      memset(ids, 0xff, SOFT_TILE_PIXELS * sizeof(unsigned int));
+    }
+
+    L::V zero = L::set1(0.0f);
+    L::V ramp = L::ramp();
+
+    for (unsigned int t = 0; t < bin.size(); t++) {
+      const SoftTriangle *tri = &triangles[bin[t]];
+      int x0 = tri->minX > tileX ? tri->minX : tileX;
+      int y0 = tri->minY > tileY ? tri->minY : tileY;
+      int x1 = tri->maxX < tileX + SOFT_TILE_SIZE - 1 ? tri->maxX : tileX + SOFT_TILE_SIZE - 1;
+      int y1 = tri->maxY < tileY + SOFT_TILE_SIZE - 1 ? tri->maxY : tileY + SOFT_TILE_SIZE - 1;
+      // lane groups start on multiples of 8 within the tile
+      int start = tileX + ((x0 - tileX) & ~(SOFT_LANES - 1));
+      L::V lastX = L::set1((float)x1 + 0.5f);
+
+      for (int y = y0; y <= y1; y++) {
+        L::V fy = L::set1(y + 0.5f - tri->originY);
+        int row = (y - tileY) * SOFT_TILE_SIZE;
+
+        for (int x = start; x <= x1; x += SOFT_LANES) {
+          L::V fx = L::add(ramp, L::set1(x + 0.5f - tri->originX));
+          L::V inside = L::le(L::add(ramp, L::set1((float)x)), lastX);
+
+          for (int e = 0; e < 3; e++) {
+            L::V value = L::add(L::add(L::mul(L::set1(tri->edgeA[e]), fx), L::mul(L::set1(tri->edgeB[e]), fy)), L::set1(tri->edgeC[e]));
+            inside = L::andMask(inside, tri->edgeInclusive[e] ? L::ge(value, zero) : L::gt(value, zero));
+          }
+
+          if (L::bits(inside) == 0) {
+            continue;
+          }
+
+          float *d = depth + row + (x - tileX);
+          L::V z = plane(tri->planes[SOFT_PLANE_Z], fx, fy);
+          L::V old = L::load(d);
+          L::V pass = L::andMask(inside, L::lt(z, old));
+          int bits = L::bits(pass);
+
+          if (bits == 0) {
+            continue;
+          }
+
+          L::store(d, L::select(pass, z, old));
+
+          if (shading) {
+            for (int i = 0; i < SOFT_LANES; i++) {
+              if (bits & (1 << i)) {
+                ids[row + (x - tileX) + i] = bin[t];
+              }
+            }
+          }
+        }
+      }
+    }
+
+    if (shading) {
+      shadeTile(tileX, tileY, ids);
+    }
+  }
+
+  static SoftV plane(const float *p, SoftV fx, SoftV fy)
+  {
+    typedef SoftLanes L;
+    return L::add(L::add(L::mul(L::set1(p[0]), fx), L::mul(L::set1(p[1]), fy)), L::set1(p[2]));
+  }
+
+  // shades the tile 8 pixels at a time, one triangle's lanes at a time, straight into `image`
+  void shadeTile(int tileX, int tileY, const unsigned int *ids)
+  {
+    int w = target->width - tileX < SOFT_TILE_SIZE ? target->width - tileX : SOFT_TILE_SIZE;
+    int h = target->height - tileY < SOFT_TILE_SIZE ? target->height - tileY : SOFT_TILE_SIZE;
+    uint32_t colors[SOFT_LANES];
+
+    for (int ly = 0; ly < h; ly++) {
+      for (int lx = 0; lx < w; lx += SOFT_LANES) {
+        const unsigned int *group = ids + ly * SOFT_TILE_SIZE + lx;
+        int lanes = w - lx < SOFT_LANES ? w - lx : SOFT_LANES;
+        int todo = (1 << lanes) - 1;
+
+        while (todo) {
+          int first = 0;
+
+          while (!(todo & (1 << first))) {
+            first++;
+          }
+
+          unsigned int id = group[first];
+          int bits = 0;
+
+          for (int i = first; i < lanes; i++) {
+            bits |= (todo & (1 << i)) && group[i] == id ? 1 << i : 0;
+          }
+
+          todo &= ~bits;
+
+          if (id == SOFT_NO_TRIANGLE) {
+            shadeSky(tileX + lx, tileY + ly, bits, colors);
+          } else {
+            shadeLanes(&triangles[id], tileX + lx, tileY + ly, bits, colors);
+          }
+        }
+
+        memcpy(&image[(tileY + ly) * width + tileX + lx], colors, lanes * sizeof(uint32_t));
+      }
+    }
+  }
+
+  static uint32_t packColor(glm::vec3 c)
+  {
+    c = glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f;
+    return (uint32_t)c.r | ((uint32_t)c.g << 8) | ((uint32_t)c.b << 16) | 0xff000000u;
+  }
+
+  void shadeSky(int x, int y, int bits, uint32_t *colors)
+  {
+    for (int i = 0; i < SOFT_LANES; i++) {
+      if (bits & (1 << i)) {
+        glm::vec3 dir = skyCorner + skyRight * (x + i + 0.5f) + skyUp * (y + 0.5f);
+        colors[i] = packColor(sampleCube(skyboxTexture, dir));
+      }
+    }
+  }
+
+  // 2x2 pcf at the shadow map's resolution, which covers about as much ground as the
+  // GL path's 5x5 taps in its bigger map. (fx, fy) is in texels; `reference` is the
+  // biased depth that's in shadow behind anything closer.
+  float shadowAt(float fx, float fy, float reference)
+  {
+    int x = (int)floorf(fx);
+    int y = (int)floorf(fy);
+    float tx = fx - x, ty = fy - y;
+    float lit[4];
+
+    for (int i = 0; i < 4; i++) {
+      int sx = x + (i & 1), sy = y + (i >> 1);
+
+      // outside the map is the border color: nothing in the way
+      if (sx < 0 || sy < 0 || sx >= shadowMap.width || sy >= shadowMap.height) {
+        lit[i] = 0.0f;
+        continue;
+      }
+
+      unsigned int tile = (sy / SOFT_TILE_SIZE) * shadowMap.tilesX + sx / SOFT_TILE_SIZE;
+      float closest = shadowMap.depth[tile * SOFT_TILE_PIXELS + (sy % SOFT_TILE_SIZE) * SOFT_TILE_SIZE + sx % SOFT_TILE_SIZE];
+      lit[i] = reference > closest ? 1.0f : 0.0f;
+    }
+
+    return (lit[0] * (1.0f - tx) + lit[1] * tx) * (1.0f - ty) + (lit[2] * (1.0f - tx) + lit[3] * tx) * ty;
+  }
+
+  static SoftV dot(const SoftVec3 &a, const SoftVec3 &b)
+  {
+    typedef SoftLanes L;
+    return L::add(L::add(L::mul(a.x, b.x), L::mul(a.y, b.y)), L::mul(a.z, b.z));
+  }
+
+  static SoftVec3 scale(const SoftVec3 &a, SoftV s)
+  {
+    typedef SoftLanes L;
+    SoftVec3 r = { L::mul(a.x, s), L::mul(a.y, s), L::mul(a.z, s) };
+    return r;
+  }
+
+  static SoftVec3 normalize(const SoftVec3 &a)
+  {
+    typedef SoftLanes L;
+    return scale(a, L::div(L::set1(1.0f), L::sqrt(L::max(dot(a, a), L::set1(1e-20f)))));
+  }
+
+  // m * (p, 1), divided through by w
+  static SoftVec3 transformPoint(const glm::mat4 &m, const SoftVec3 &p)
+  {
+    typedef SoftLanes L;
+    L::V c[4];
+
+    for (int i = 0; i < 4; i++) {
+      c[i] = L::add(L::add(L::mul(L::set1(m[0][i]), p.x), L::mul(L::set1(m[1][i]), p.y)), L::add(L::mul(L::set1(m[2][i]), p.z), L::set1(m[3][i])));
+    }
+
+    L::V invW = L::div(L::set1(1.0f), c[3]);
+    SoftVec3 r = { L::mul(c[0], invW), L::mul(c[1], invW), L::mul(c[2], invW) };
+    return r;
+  }
+
+  static SoftVec3 splat(glm::vec3 v)
+  {
+    typedef SoftLanes L;
+    SoftVec3 r = { L::set1(v.x), L::set1(v.y), L::set1(v.z) };
+    return r;
+  }
+
+  // result = max(result, term) per channel, the way the shader combines lights
+  static void maxInto(SoftVec3 *result, const SoftVec3 &term)
+  {
+    typedef SoftLanes L;
+    result->x = L::max(result->x, term.x);
+    result->y = L::max(result->y, term.y);
+    result->z = L::max(result->z, term.z);
+  }
+
+  // color (ambient + diffuse * diff) * texture + specular * spec * specTex, all per lane
+  static SoftVec3 lightTerm(glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, SoftV diff, SoftV spec,
+                            const SoftVec3 &albedo, const SoftVec3 &specularTexels)
+  {
+    typedef SoftLanes L;
+    SoftVec3 r;
+    r.x = L::add(L::mul(L::add(L::set1(ambient.x), L::mul(L::set1(diffuse.x), diff)), albedo.x), L::mul(L::mul(L::set1(specular.x), spec), specularTexels.x));
+    r.y = L::add(L::mul(L::add(L::set1(ambient.y), L::mul(L::set1(diffuse.y), diff)), albedo.y), L::mul(L::mul(L::set1(specular.y), spec), specularTexels.y));
+    r.z = L::add(L::mul(L::add(L::set1(ambient.z), L::mul(L::set1(diffuse.z), diff)), albedo.z), L::mul(L::mul(L::set1(specular.z), spec), specularTexels.z));
+    return r;
+  }
+
+  // pow(max(dot(viewDir, reflect(-lightDir, normal)), 0), shininess), a lane at a time
+  static SoftV specularPower(const SoftVec3 &viewDir, const SoftVec3 &lightDir, const SoftVec3 &normal, SoftV nDotL, float shininess)
+  {
+    typedef SoftLanes L;
+    L::V two = L::set1(2.0f);
+    SoftVec3 reflected = { L::sub(L::mul(L::mul(two, nDotL), normal.x), lightDir.x),
+                           L::sub(L::mul(L::mul(two, nDotL), normal.y), lightDir.y),
+                           L::sub(L::mul(L::mul(two, nDotL), normal.z), lightDir.z) };
+    float base[SOFT_LANES];
+    L::store(base, L::max(dot(viewDir, reflected), L::set1(0.0f)));
+
+    for (int i = 0; i < SOFT_LANES; i++) {
+      base[i] = powf(base[i], shininess);
+    }
+
+    return L::load(base);
+  }
+
+  static SoftVec3 loadVec3(const glm::vec3 *v)
+  {
+    typedef SoftLanes L;
+    float x[SOFT_LANES], y[SOFT_LANES], z[SOFT_LANES];
+
+    for (int i = 0; i < SOFT_LANES; i++) {
+      x[i] = v[i].x;
+      y[i] = v[i].y;
+      z[i] = v[i].z;
+    }
+
+    SoftVec3 r = { L::load(x), L::load(y), L::load(z) };
+    return r;
+  }
+
+  void shadeLanes(const SoftTriangle *tri, int x, int y, int bits, uint32_t *colors)
+  {
+    typedef SoftLanes L;
+    const SoftMaterial *mat = tri->material;
+
+    if (mat->unlit) {
+      for (int i = 0; i < SOFT_LANES; i++) {
+        if (bits & (1 << i)) {
+          colors[i] = packColor(mat->color);
+        }
+      }
+
+      return;
+    }
+
+    // perspective correct attributes: attribute/w and 1/w are both planes on screen
+    L::V zero = L::set1(0.0f);
+    L::V fx = L::add(L::ramp(), L::set1(x + 0.5f - tri->originX));
+    L::V fy = L::set1(y + 0.5f - tri->originY);
+    L::V invW = L::div(L::set1(1.0f), plane(tri->planes[SOFT_PLANE_W], fx, fy));
+    L::V attr[SOFT_ATTRIBUTES];
+
+    for (int k = 0; k < SOFT_ATTRIBUTES; k++) {
+      attr[k] = L::mul(plane(tri->planes[SOFT_PLANE_ATTRIBUTE(k)], fx, fy), invW);
+    }
+
+    // texture coords per pixel, from the planes' slopes, for picking mip levels
+    const float *wPlane = tri->planes[SOFT_PLANE_W];
+    const float *uPlane = tri->planes[SOFT_PLANE_ATTRIBUTE(6)];
+    const float *vPlane = tri->planes[SOFT_PLANE_ATTRIBUTE(7)];
+    L::V dudx = L::mul(L::sub(L::set1(uPlane[0]), L::mul(attr[6], L::set1(wPlane[0]))), invW);
+    L::V dvdx = L::mul(L::sub(L::set1(vPlane[0]), L::mul(attr[7], L::set1(wPlane[0]))), invW);
+    L::V dudy = L::mul(L::sub(L::set1(uPlane[1]), L::mul(attr[6], L::set1(wPlane[1]))), invW);
+    L::V dvdy = L::mul(L::sub(L::set1(vPlane[1]), L::mul(attr[7], L::set1(wPlane[1]))), invW);
+    L::V rho = L::sqrt(L::max(L::add(L::mul(dudx, dudx), L::mul(dvdx, dvdx)), L::add(L::mul(dudy, dudy), L::mul(dvdy, dvdy))));
+
+    SoftVec3 pos = { attr[0], attr[1], attr[2] };
+    SoftVec3 rawNormal = { attr[3], attr[4], attr[5] };
+    SoftVec3 normal = normalize(rawNormal);
+    SoftVec3 toEye = { L::sub(L::set1(viewPos.x), pos.x), L::sub(L::set1(viewPos.y), pos.y), L::sub(L::set1(viewPos.z), pos.z) };
+    SoftVec3 viewDir = normalize(toEye);
+
+    SoftVec3 dir = splat(glm::normalize(-dirLightDir));
+    L::V nDotL = dot(normal, dir);
+
+    // where each pixel lands in the shadow map, and the biased depth it's compared with;
+    // past the far plane is never in shadow
+    float shadowX[SOFT_LANES], shadowY[SOFT_LANES], shadowReference[SOFT_LANES];
+
+    if (mat->shadows) {
+      L::V half = L::set1(0.5f);
+      SoftVec3 proj = transformPoint(lightSpaceMatrix, pos);
+      L::V depth = L::add(L::mul(proj.z, half), half);
+      L::V bias = L::max(L::mul(L::set1(0.02f), L::sub(L::set1(1.0f), nDotL)), L::set1(0.005f));
+      L::store(shadowX, L::sub(L::mul(L::add(L::mul(proj.x, half), half), L::set1((float)shadowMap.width)), half));
+      L::store(shadowY, L::sub(L::mul(L::add(L::mul(proj.y, half), half), L::set1((float)shadowMap.height)), half));
+      L::store(shadowReference, L::select(L::gt(depth, L::set1(1.0f)), L::set1(-1.0f), L::sub(depth, bias)));
+    }
+
+    // texture lookups are gathers, so they're done a lane at a time
+    float u[SOFT_LANES], v[SOFT_LANES], r[SOFT_LANES], shadows[SOFT_LANES];
+    glm::vec3 albedoTexels[SOFT_LANES], specularTexels[SOFT_LANES], emissionTexels[SOFT_LANES];
+    L::store(u, attr[6]);
+    L::store(v, attr[7]);
+    L::store(r, rho);
+
+    for (int i = 0; i < SOFT_LANES; i++) {
+      albedoTexels[i] = specularTexels[i] = emissionTexels[i] = glm::vec3(0.0f);
+      shadows[i] = 0.0f;
+
+      if (!(bits & (1 << i))) {
+        continue;
+      }
+
+      albedoTexels[i] = sample(textureAt(mat->diffuseTexture), u[i], v[i], r[i]);
+
+      if (mat->specularMap) {
+        specularTexels[i] = sample(textureAt(mat->specularTexture), u[i], v[i], r[i]);
+      }
+
+      if (mat->emission) {
+        emissionTexels[i] = sample(textureAt(mat->emissionMap), u[i], v[i], r[i]) *
+                            sample(textureAt(mat->emissionValues), u[i], v[i], r[i]);
+      }
+
+      if (mat->shadows) {
+        shadows[i] = shadowAt(shadowX[i], shadowY[i], shadowReference[i]);
+      }
+    }
+
+    SoftVec3 albedo = loadVec3(albedoTexels);
+    SoftVec3 specular = loadVec3(specularTexels);
+    L::V lit = L::sub(L::set1(1.0f), L::load(shadows));
+    L::V noSpecular = zero;
+
+    // the directional light
+    L::V diff = L::max(nDotL, zero);
+    L::V spec = mat->specularMap ? specularPower(viewDir, dir, normal, nDotL, mat->shininess) : noSpecular;
+    SoftVec3 result = lightTerm(dirLightAmbient, dirLightDiffuse, dirLightSpecular, L::mul(diff, lit), L::mul(spec, lit), albedo, specular);
+
+    // the point lights
+    for (int j = 0; j < numPointLights; j++) {
+      const SoftPointLight *light = &pointLights[j];
+      SoftVec3 toLight = { L::sub(L::set1(light->pos.x), pos.x), L::sub(L::set1(light->pos.y), pos.y), L::sub(L::set1(light->pos.z), pos.z) };
+      L::V distance = L::sqrt(L::max(dot(toLight, toLight), L::set1(1e-20f)));
+      SoftVec3 ld = scale(toLight, L::div(L::set1(1.0f), distance));
+      L::V attenuation = L::div(L::set1(1.0f), L::add(L::set1(light->constant),
+                                L::mul(distance, L::add(L::set1(light->linear), L::mul(distance, L::set1(light->quadratic))))));
+      L::V nDotLight = dot(normal, ld);
+      L::V lightSpec = mat->specularMap ? specularPower(viewDir, ld, normal, nDotLight, mat->shininess) : noSpecular;
+      SoftVec3 term = lightTerm(light->ambient, light->diffuse, light->specular, L::max(nDotLight, zero), lightSpec, albedo, specular);
+      maxInto(&result, scale(term, attenuation));
+    }
+
+    SoftVec3 fill = { L::mul(L::set1(ambientFill.x), albedo.x), L::mul(L::set1(ambientFill.y), albedo.y), L::mul(L::set1(ambientFill.z), albedo.z) };
+    maxInto(&result, fill);
+
+    if (mat->emission) {
+      maxInto(&result, loadVec3(emissionTexels));
+    }
+
+    // reflect(-viewDir, normal), for the skybox lookup
+    L::V twice = L::mul(L::set1(2.0f), dot(normal, viewDir));
+    SoftVec3 mirror = { L::sub(L::mul(twice, normal.x), viewDir.x), L::sub(L::mul(twice, normal.y), viewDir.y), L::sub(L::mul(twice, normal.z), viewDir.z) };
+    float rx[SOFT_LANES], ry[SOFT_LANES], rz[SOFT_LANES], mx[SOFT_LANES], my[SOFT_LANES], mz[SOFT_LANES];
+    L::store(rx, result.x);
+    L::store(ry, result.y);
+    L::store(rz, result.z);
+    L::store(mx, mirror.x);
+    L::store(my, mirror.y);
+    L::store(mz, mirror.z);
+
+    for (int i = 0; i < SOFT_LANES; i++) {
+      if (!(bits & (1 << i))) {
+        continue;
+      }
+
+      glm::vec3 color = glm::vec3(rx[i], ry[i], rz[i]) * 0.92f;
+
+      if (mat->reflection) {
+        color += sampleCube(skyboxTexture, glm::vec3(mx[i], my[i], mz[i])) * 0.08f;
+      }
+
+      colors[i] = packColor(color);
+    }
+  }
+
+  // NULL for ids that were never added, which sample() reads as black
+  const SoftTexture *textureAt(int id)
+  {
+    return id >= 0 && (unsigned int)id < textures.size() ? &textures[id] : NULL;
+  }
+};
+#endif
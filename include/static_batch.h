@@ -0,0 +1,203 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <instance_buffer.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#define STATIC_VERTEX_FLOATS 8 // position, normal, texture coords; the WITH_ATTRIBUTES layout
+
+// one merged, pre-transformed piece of static geometry: every static object of one
+// material (and pass mask) whose centre falls in the same grid cell. Drawn with a
+// single glDrawElements and skipped whole when its bounds are off screen.
+typedef struct {
+  unsigned int vao;
+  unsigned int indexCount;
+  unsigned int materialId;
+  unsigned int passMask;
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+  std::vector<float> vertices; // what was uploaded, kept for the software rasterizer
+  std::vector<unsigned int> indices;
+} StaticChunk;
+
+// collects static objects at load time, then bakes them into StaticChunks. Nothing
+// about a chunk changes afterwards, so they cost no cpu time per frame beyond culling.
+class StaticBatchBuilder
+{
+public:
+  StaticBatchBuilder(float chunkSize) : chunkSize(chunkSize) {}
+
+  // `vertices` is a non-indexed WITH_ATTRIBUTES array; identical vertices are merged
+  void add(const float *vertices, unsigned int numVertices, const InstanceTransform &transform, unsigned int materialId, unsigned int passMask)
+  {
+    glm::vec3 centre = glm::vec3(transform.model[3]);
+    PendingChunk *chunk = findChunk(materialId, passMask, (int)floorf(centre.x / chunkSize), (int)floorf(centre.z / chunkSize));
+    glm::mat3 normalMatrix(glm::vec3(transform.normalMatrix[0]), glm::vec3(transform.normalMatrix[1]), glm::vec3(transform.normalMatrix[2]));
+    unsigned int base = chunk->vertices.size() / STATIC_VERTEX_FLOATS;
+    unsigned int unique = 0;
+
+    for (unsigned int i = 0; i < numVertices; i++) {
+      const float *v = vertices + i * STATIC_VERTEX_FLOATS;
+      unsigned int match = unique;
+
+      for (unsigned int j = 0; j < i && match == unique; j++) {
+        if (memcmp(v, vertices + j * STATIC_VERTEX_FLOATS, STATIC_VERTEX_FLOATS * sizeof(float)) == 0) {
+          match = remap[j];
+        }
+      }
+
+      if (remap.size() <= i) {
+        remap.resize(i + 1);
+      }
+
+      remap[i] = match;
+      chunk->indices.push_back(base + match);
+
+      if (match != unique) {
+        continue;
+      }
+
+      glm::vec3 pos = glm::vec3(transform.model * glm::vec4(v[0], v[1], v[2], 1.0f));
+      glm::vec3 normal = normalMatrix * glm::vec3(v[3], v[4], v[5]);
+      float length = glm::length(normal);
+      normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+      float baked[STATIC_VERTEX_FLOATS] = { pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, v[6], v[7] };
+      chunk->vertices.insert(chunk->vertices.end(), baked, baked + STATIC_VERTEX_FLOATS);
+      chunk->boundsMin = glm::min(chunk->boundsMin, pos);
+      chunk->boundsMax = glm::max(chunk->boundsMax, pos);
+      unique++;
+    }
+  }
+
+  // uploads every chunk, grouped by material so drawing them in order switches state
+  // as little as possible. `identity` holds a single identity InstanceTransform, which
+  // the shaders' per-instance attributes read since the vertices are already in world space.
+  std::vector<StaticChunk> build(InstanceBuffer *identity)
+  {
+    std::vector<StaticChunk> chunks;
+    unsigned int numVertices = 0;
+
+    for (unsigned int i = 0; i < pending.size(); i++) {
+      PendingChunk *p = &pending[i];
+      StaticChunk chunk;
+      unsigned int buffers[2];
+
+      glGenVertexArrays(1, &chunk.vao);
+      glGenBuffers(2, buffers);
+      glBindVertexArray(chunk.vao);
+
+      glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+      glBufferData(GL_ARRAY_BUFFER, p->vertices.size() * sizeof(float), p->vertices.data(), GL_STATIC_DRAW);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, STATIC_VERTEX_FLOATS * sizeof(float), (void*)0);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, STATIC_VERTEX_FLOATS * sizeof(float), (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, STATIC_VERTEX_FLOATS * sizeof(float), (void*)(6 * sizeof(float)));
+      glEnableVertexAttribArray(2);
+      identity->bindAttributes(0);
+
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, p->indices.size() * sizeof(unsigned int), p->indices.data(), GL_STATIC_DRAW);
+      glBindVertexArray(0);
+
+      chunk.indexCount = p->indices.size();
+      chunk.materialId = p->materialId;
+      chunk.passMask = p->passMask;
+      chunk.boundsMin = p->boundsMin;
+      chunk.boundsMax = p->boundsMax;
+      chunk.vertices.swap(p->vertices);
+      chunk.indices.swap(p->indices);
+
+      // keep runs of one material together
+      unsigned int at = chunks.size();
+
+      while (at > 0 && chunks[at - 1].materialId > chunk.materialId) {
+        at--;
+      }
+
+      chunks.insert(chunks.begin() + at, chunk);
+      numVertices += chunk.vertices.size() / STATIC_VERTEX_FLOATS;
+    }
+
+    printf("static batches: %u chunks, %u vertices\n", (unsigned int)chunks.size(), numVertices);
+    pending.clear();
+    return chunks;
+  }
+
+private:
+  typedef struct {
+    unsigned int materialId;
+    unsigned int passMask;
+    int cellX;
+    int cellZ;
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+  } PendingChunk;
+
+  float chunkSize;
+  std::vector<PendingChunk> pending;
+  std::vector<unsigned int> remap; // source vertex -> first identical source vertex, reused across add()s
+
+  PendingChunk *findChunk(unsigned int materialId, unsigned int passMask, int cellX, int cellZ)
+  {
+    for (unsigned int i = 0; i < pending.size(); i++) {
+      PendingChunk *p = &pending[i];
+
+      if (p->materialId == materialId && p->passMask == passMask && p->cellX == cellX && p->cellZ == cellZ) {
+        return p;
+      }
+    }
+
+    PendingChunk chunk;
+    chunk.materialId = materialId;
+    chunk.passMask = passMask;
+    chunk.cellX = cellX;
+    chunk.cellZ = cellZ;
+    chunk.boundsMin = glm::vec3(INFINITY);
+    chunk.boundsMax = glm::vec3(-INFINITY);
+    pending.push_back(chunk);
+    return &pending.back();
+  }
+};
+
+// false only when the box is entirely outside one of the frustum planes of `viewProj`
+inline bool boundsVisible(const glm::mat4 &viewProj, glm::vec3 boundsMin, glm::vec3 boundsMax)
+{
+  glm::vec4 rowX(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+  glm::vec4 rowY(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+  glm::vec4 rowZ(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+  glm::vec4 rowW(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+  glm::vec4 planes[6] = { rowW + rowX, rowW - rowX, rowW + rowY, rowW - rowY, rowW + rowZ, rowW - rowZ };
+
+  for (unsigned int i = 0; i < 6; i++) {
+    // the box corner furthest along the plane normal
+    glm::vec3 corner(planes[i].x > 0.0f ? boundsMax.x : boundsMin.x,
+                     planes[i].y > 0.0f ? boundsMax.y : boundsMin.y,
+                     planes[i].z > 0.0f ? boundsMax.z : boundsMin.z);
+
+    if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// true when two boxes share any space
+inline bool boundsOverlap(glm::vec3 minA, glm::vec3 maxA, glm::vec3 minB, glm::vec3 maxB)
+{
+  return minA.x <= maxB.x && maxA.x >= minB.x &&
+         minA.y <= maxB.y && maxA.y >= minB.y &&
+         minA.z <= maxB.z && maxA.z >= minB.z;
+}
+#endif
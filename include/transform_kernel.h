@@ -0,0 +1,333 @@
+#ifndef TRANSFORM_KERNEL_H
+#define TRANSFORM_KERNEL_H
+
+#include <glm/glm.hpp>
+
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRANSFORM_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRANSFORM_KERNEL_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TRANSFORM_KERNEL_NEON
+#endif
+
+// one per-instance vertex record: the model matrix (attributes 3-6) followed by the
+// normal matrix (attributes 7-9). Normal matrix columns are padded to vec4 so every
+// column starts on a 16 byte boundary within the record.
+typedef struct {
+  glm::mat4 model;
+  glm::vec4 normalMatrix[3];
+} InstanceTransform;
+
+// model = translate(pos) * rotate(angle, axis) * scale(scale), matching what glm builds.
+//
+// The normal matrix is the cofactor of the upper 3x3 rather than its inverse transpose:
+// for R * S the cofactor columns are just R's columns times the other two scale factors,
+// so it needs no inverse, it only differs from transpose(inverse()) by the (positive)
+// determinant that the fragment shader normalizes away anyway, and it stays defined for
+// flattened objects like the plane (scale.y == 0), where the inverse doesn't exist.
+inline void computeTransformsScalar(const glm::vec3 *positions, const glm::vec3 *axes, const float *angles,
+                                    const glm::vec3 *scales, InstanceTransform *out, unsigned int count)
+{
+  for (unsigned int i = 0; i < count; i++) {
+    glm::vec3 a = glm::normalize(axes[i]);
+    float c = cosf(angles[i]);
+    float s = sinf(angles[i]);
+    glm::vec3 t = (1.0f - c) * a;
+
+    glm::vec3 r0(c + t.x * a.x, t.x * a.y + s * a.z, t.x * a.z - s * a.y);
+    glm::vec3 r1(t.y * a.x - s * a.z, c + t.y * a.y, t.y * a.z + s * a.x);
+    glm::vec3 r2(t.z * a.x + s * a.y, t.z * a.y - s * a.x, c + t.z * a.z);
+    glm::vec3 sc = scales[i];
+
+    out[i].model[0] = glm::vec4(r0 * sc.x, 0.0f);
+    out[i].model[1] = glm::vec4(r1 * sc.y, 0.0f);
+    out[i].model[2] = glm::vec4(r2 * sc.z, 0.0f);
+    out[i].model[3] = glm::vec4(positions[i], 1.0f);
+    out[i].normalMatrix[0] = glm::vec4(r0 * (sc.y * sc.z), 0.0f);
+    out[i].normalMatrix[1] = glm::vec4(r1 * (sc.x * sc.z), 0.0f);
+    out[i].normalMatrix[2] = glm::vec4(r2 * (sc.x * sc.y), 0.0f);
+  }
+}
+
+#if defined(TRANSFORM_KERNEL_SSE) || defined(TRANSFORM_KERNEL_AVX2)
+// 4 instances' worth of one column, given as x/y/z/w lanes, transposed back into the records
+inline void storeColumns4(float *dst, __m128 x, __m128 y, __m128 z, __m128 w)
+{
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+  _mm_storeu_ps(dst, x);
+  _mm_storeu_ps(dst + sizeof(InstanceTransform) / sizeof(float), y);
+  _mm_storeu_ps(dst + 2 * sizeof(InstanceTransform) / sizeof(float), z);
+  _mm_storeu_ps(dst + 3 * sizeof(InstanceTransform) / sizeof(float), w);
+}
+
+// xxxx, yyyy, zzzz  ->  x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+inline void storeVec3s4(float *dst, __m128 x, __m128 y, __m128 z)
+{
+  __m128 w = _mm_setzero_ps();
+  _MM_TRANSPOSE4_PS(x, y, z, w); // now one xyz_ per register
+  _mm_storeu_ps(dst, _mm_shuffle_ps(x, _mm_shuffle_ps(y, x, _MM_SHUFFLE(3, 2, 0, 0)), _MM_SHUFFLE(0, 2, 1, 0)));
+  _mm_storeu_ps(dst + 4, _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 0, 2, 1)));
+  _mm_storeu_ps(dst + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 0, 2, 2)), w, _MM_SHUFFLE(2, 1, 2, 0)));
+}
+#endif
+
+#if defined(TRANSFORM_KERNEL_SSE)
+struct TransformLanes
+{
+  typedef __m128 V;
+  typedef __m128 M;
+  enum { WIDTH = 4 };
+
+  static V set1(float f) { return _mm_set1_ps(f); }
+  static V load(const float *p) { return _mm_loadu_ps(p); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm_div_ps(a, b); }
+  static V sqrt(V a) { return _mm_sqrt_ps(a); }
+  static V round(V a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+  static M gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+  static M lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+  static V select(M m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+  // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3  ->  xxxx, yyyy, zzzz
+  static void loadVec3(const glm::vec3 *v, V &x, V &y, V &z)
+  {
+    const float *p = (const float *)v;
+    __m128 a = _mm_loadu_ps(p);
+    __m128 b = _mm_loadu_ps(p + 4);
+    __m128 c = _mm_loadu_ps(p + 8);
+
+    x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 3, 0)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 1, 0));
+    y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+  }
+
+  static void storeVec3(glm::vec3 *v, V x, V y, V z)
+  {
+    storeVec3s4((float *)v, x, y, z);
+  }
+
+  static void storeColumns(float *dst, V x, V y, V z, V w)
+  {
+    storeColumns4(dst, x, y, z, w);
+  }
+};
+#elif defined(TRANSFORM_KERNEL_AVX2)
+struct TransformLanes
+{
+  typedef __m256 V;
+  typedef __m256 M;
+  enum { WIDTH = 8 };
+
+  static V set1(float f) { return _mm256_set1_ps(f); }
+  static V load(const float *p) { return _mm256_loadu_ps(p); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V div(V a, V b) { return _mm256_div_ps(a, b); }
+  static V sqrt(V a) { return _mm256_sqrt_ps(a); }
+  static V round(V a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+  static M gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+  static M lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static V select(M m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+
+  static void loadVec3(const glm::vec3 *v, V &x, V &y, V &z)
+  {
+    const float *p = (const float *)v;
+    __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    x = _mm256_i32gather_ps(p, stride, 4);
+    y = _mm256_i32gather_ps(p + 1, stride, 4);
+    z = _mm256_i32gather_ps(p + 2, stride, 4);
+  }
+
+  static void storeVec3(glm::vec3 *v, V x, V y, V z)
+  {
+    storeVec3s4((float *)v, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+    storeVec3s4((float *)(v + 4), _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+  }
+
+  static void storeColumns(float *dst, V x, V y, V z, V w)
+  {
+    storeColumns4(dst, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z), _mm256_castps256_ps128(w));
+    storeColumns4(dst + 4 * sizeof(InstanceTransform) / sizeof(float), _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                  _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(w, 1));
+  }
+};
+#elif defined(TRANSFORM_KERNEL_NEON)
+struct TransformLanes
+{
+  typedef float32x4_t V;
+  typedef uint32x4_t M;
+  enum { WIDTH = 4 };
+
+  static V set1(float f) { return vdupq_n_f32(f); }
+  static V load(const float *p) { return vld1q_f32(p); }
+  static V add(V a, V b) { return vaddq_f32(a, b); }
+  static V sub(V a, V b) { return vsubq_f32(a, b); }
+  static V mul(V a, V b) { return vmulq_f32(a, b); }
+  static V div(V a, V b) { return vdivq_f32(a, b); }
+  static V sqrt(V a) { return vsqrtq_f32(a); }
+  static V round(V a) { return vrndnq_f32(a); }
+  static M gt(V a, V b) { return vcgtq_f32(a, b); }
+  static M lt(V a, V b) { return vcltq_f32(a, b); }
+  static V select(M m, V a, V b) { return vbslq_f32(m, a, b); }
+
+  static void loadVec3(const glm::vec3 *v, V &x, V &y, V &z)
+  {
+    float32x4x3_t xyz = vld3q_f32((const float *)v);
+    x = xyz.val[0];
+    y = xyz.val[1];
+    z = xyz.val[2];
+  }
+
+  static void storeVec3(glm::vec3 *v, V x, V y, V z)
+  {
+    float32x4x3_t xyz;
+    xyz.val[0] = x;
+    xyz.val[1] = y;
+    xyz.val[2] = z;
+    vst3q_f32((float *)v, xyz);
+  }
+
+  static void storeColumns(float *dst, V x, V y, V z, V w)
+  {
+    float32x4x2_t xy = vzipq_f32(x, y);
+    float32x4x2_t zw = vzipq_f32(z, w);
+    vst1q_f32(dst, vcombine_f32(vget_low_f32(xy.val[0]), vget_low_f32(zw.val[0])));
+    vst1q_f32(dst + sizeof(InstanceTransform) / sizeof(float), vcombine_f32(vget_high_f32(xy.val[0]), vget_high_f32(zw.val[0])));
+    vst1q_f32(dst + 2 * sizeof(InstanceTransform) / sizeof(float), vcombine_f32(vget_low_f32(xy.val[1]), vget_low_f32(zw.val[1])));
+    vst1q_f32(dst + 3 * sizeof(InstanceTransform) / sizeof(float), vcombine_f32(vget_high_f32(xy.val[1]), vget_high_f32(zw.val[1])));
+  }
+};
+#endif
+
+#ifdef TRANSFORM_KERNEL_SSE
+#define TRANSFORM_KERNEL_SIMD
+#endif
+#ifdef TRANSFORM_KERNEL_AVX2
+#define TRANSFORM_KERNEL_SIMD
+#endif
+#ifdef TRANSFORM_KERNEL_NEON
+#define TRANSFORM_KERNEL_SIMD
+#endif
+
+#ifdef TRANSFORM_KERNEL_SIMD
+// the angle in every lane brought into [-pi, pi]. k * 2pi is subtracted in three pieces
+// (Cody-Waite): the first has few enough bits that k times it is exact for |k| < 2^16,
+// so large arguments (time * rate, well into a session) keep their accuracy instead of
+// losing it to one rounded float 2pi.
+template <typename L>
+inline typename L::V reduceAngleLanes(typename L::V x)
+{
+  typename L::V k = L::round(L::mul(x, L::set1(0.159154943091895f))); // 1 / 2pi
+  x = L::sub(x, L::mul(k, L::set1(6.28125f)));
+  x = L::sub(x, L::mul(k, L::set1(1.93500518798828125e-3f)));
+  return L::sub(x, L::mul(k, L::set1(3.0199159819567528e-7f)));
+}
+
+// sin of every lane at once: reduce to [-pi, pi], then fold into [-pi/2, pi/2], where a
+// degree 11 odd polynomial is good to float precision
+template <typename L>
+inline typename L::V sinLanes(typename L::V x)
+{
+  typedef typename L::V V;
+  const float pi = 3.14159265358979f;
+
+  x = reduceAngleLanes<L>(x);
+  x = L::select(L::gt(x, L::set1(0.5f * pi)), L::sub(L::set1(pi), x), x);
+  x = L::select(L::lt(x, L::set1(-0.5f * pi)), L::sub(L::set1(-pi), x), x);
+
+  V x2 = L::mul(x, x);
+  V p = L::set1(-2.5052108e-8f);
+  p = L::add(L::mul(p, x2), L::set1(2.7557319e-6f));
+  p = L::add(L::mul(p, x2), L::set1(-1.9841270e-4f));
+  p = L::add(L::mul(p, x2), L::set1(8.3333333e-3f));
+  p = L::add(L::mul(p, x2), L::set1(-1.6666667e-1f));
+  p = L::add(L::mul(p, x2), L::set1(1.0f));
+  return L::mul(p, x);
+}
+
+// cos as sin(x + pi/2), with the pi/2 added after reducing so it isn't rounded into a
+// large argument first
+template <typename L>
+inline typename L::V cosLanes(typename L::V x)
+{
+  return sinLanes<L>(L::add(reduceAngleLanes<L>(x), L::set1(1.57079632679490f)));
+}
+
+template <typename L>
+inline void computeTransformsLanes(const glm::vec3 *positions, const glm::vec3 *axes, const float *angles,
+                                   const glm::vec3 *scales, InstanceTransform *out)
+{
+  typedef typename L::V V;
+  V px, py, pz, ax, ay, az, sx, sy, sz;
+  L::loadVec3(positions, px, py, pz);
+  L::loadVec3(axes, ax, ay, az);
+  L::loadVec3(scales, sx, sy, sz);
+
+  V inverseLength = L::div(L::set1(1.0f), L::sqrt(L::add(L::add(L::mul(ax, ax), L::mul(ay, ay)), L::mul(az, az))));
+  ax = L::mul(ax, inverseLength);
+  ay = L::mul(ay, inverseLength);
+  az = L::mul(az, inverseLength);
+
+  V angle = L::load(angles);
+  V s = sinLanes<L>(angle);
+  V c = cosLanes<L>(angle);
+  V t = L::sub(L::set1(1.0f), c);
+  V tx = L::mul(t, ax), ty = L::mul(t, ay), tz = L::mul(t, az);
+  V sax = L::mul(s, ax), say = L::mul(s, ay), saz = L::mul(s, az);
+
+  V r0x = L::add(c, L::mul(tx, ax)), r0y = L::add(L::mul(tx, ay), saz), r0z = L::sub(L::mul(tx, az), say);
+  V r1x = L::sub(L::mul(ty, ax), saz), r1y = L::add(c, L::mul(ty, ay)), r1z = L::add(L::mul(ty, az), sax);
+  V r2x = L::add(L::mul(tz, ax), say), r2y = L::sub(L::mul(tz, ay), sax), r2z = L::add(c, L::mul(tz, az));
+
+  V zero = L::set1(0.0f);
+  V one = L::set1(1.0f);
+  V syz = L::mul(sy, sz), sxz = L::mul(sx, sz), sxy = L::mul(sx, sy);
+  float *dst = (float *)out;
+
+  L::storeColumns(dst, L::mul(r0x, sx), L::mul(r0y, sx), L::mul(r0z, sx), zero);
+  L::storeColumns(dst + 4, L::mul(r1x, sy), L::mul(r1y, sy), L::mul(r1z, sy), zero);
+  L::storeColumns(dst + 8, L::mul(r2x, sz), L::mul(r2y, sz), L::mul(r2z, sz), zero);
+  L::storeColumns(dst + 12, px, py, pz, one);
+  L::storeColumns(dst + 16, L::mul(r0x, syz), L::mul(r0y, syz), L::mul(r0z, syz), zero);
+  L::storeColumns(dst + 20, L::mul(r1x, sxz), L::mul(r1y, sxz), L::mul(r1z, sxz), zero);
+  L::storeColumns(dst + 24, L::mul(r2x, sxy), L::mul(r2y, sxy), L::mul(r2z, sxy), zero);
+}
+#endif
+
+// child's world transform from its parent's world transform and its own local one. The
+// normal matrices compose the same way, since cofactor(A * B) == cofactor(A) * cofactor(B).
+inline void combineTransforms(const InstanceTransform &parent, const InstanceTransform &local, InstanceTransform *out)
+{
+  out->model = parent.model * local.model;
+
+  glm::mat3 normal = glm::mat3(glm::vec3(parent.normalMatrix[0]), glm::vec3(parent.normalMatrix[1]), glm::vec3(parent.normalMatrix[2])) *
+                     glm::mat3(glm::vec3(local.normalMatrix[0]), glm::vec3(local.normalMatrix[1]), glm::vec3(local.normalMatrix[2]));
+  out->normalMatrix[0] = glm::vec4(normal[0], 0.0f);
+  out->normalMatrix[1] = glm::vec4(normal[1], 0.0f);
+  out->normalMatrix[2] = glm::vec4(normal[2], 0.0f);
+}
+
+// the whole batch in one pass: full SIMD groups first, the remainder on the scalar path
+inline void computeTransforms(const glm::vec3 *positions, const glm::vec3 *axes, const float *angles,
+                              const glm::vec3 *scales, InstanceTransform *out, unsigned int count)
+{
+  unsigned int i = 0;
+
+#ifdef TRANSFORM_KERNEL_SIMD
+  for (; i + TransformLanes::WIDTH <= count; i += TransformLanes::WIDTH) {
+    computeTransformsLanes<TransformLanes>(positions + i, axes + i, angles + i, scales + i, out + i);
+  }
+#endif
+
+  computeTransformsScalar(positions + i, axes + i, angles + i, scales + i, out + i, count - i);
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <stdio.h>
+
+// a uniform buffer split into fixed-size std140 records ("slots"). Each slot is padded
+// out to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT so any one of them can be bound on its own
+// with glBindBufferRange.
+class UniformBuffer
+{
+public:
+  unsigned int ID;
+  unsigned int recordSize;
+  unsigned int stride;
+  unsigned int capacity;
+  unsigned int used;
+
+  UniformBuffer(unsigned int recordSize, unsigned int capacity)
+    : recordSize(recordSize), capacity(capacity), used(0), boundBinding(-1), boundSlot(-1)
+  {
+    int alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = (recordSize + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &ID);
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferData(GL_UNIFORM_BUFFER, stride * capacity, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  // hands out the next free slot, or -1 once the buffer is full
+  int allocate()
+  {
+    if (used >= capacity) {
+      printf("uniform buffer %u is full (%u records)\n", ID, capacity);
+      return -1;
+    }
+
+    return used++;
+  }
+
+  void write(int slot, const void *data, unsigned int size)
+  {
+    glBindBuffer(GL_UNIFORM_BUFFER, ID);
+    glBufferSubData(GL_UNIFORM_BUFFER, slot * stride, size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  // skips the call entirely when this slot is already what the binding point sees
+  void bindSlot(unsigned int binding, int slot)
+  {
+    if ((int)binding == boundBinding && slot == boundSlot) {
+      return;
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ID, slot * stride, recordSize);
+    boundBinding = binding;
+    boundSlot = slot;
+  }
+
+private:
+  int boundBinding;
+  int boundSlot;
+};
+#endif
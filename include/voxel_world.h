@@ -0,0 +1,550 @@
+#ifndef VOXEL_WORLD_H
+#define VOXEL_WORLD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <instance_buffer.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define VOXEL_CHUNK_SIZE 32
+#define VOXEL_CHUNK_VOLUME (VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE)
+#define VOXEL_PADDED_SIZE (VOXEL_CHUNK_SIZE + 2) // a chunk plus one voxel of each neighbour
+#define VOXEL_VERTEX_FLOATS 9 // position, normal, texture coords, texture array layer
+#define VOXEL_LAYER_LOCATION 10 // after the per-instance attributes
+
+// voxel types; 0 is always empty space
+#define VOXEL_AIR 0
+#define VOXEL_GRASS 1 // grass top, grass-edged sides
+#define VOXEL_MOSS 2 // grass top texture on every face
+
+// texture array layers, in the order main loads them
+#define VOXEL_LAYER_GRASS_TOP 0
+#define VOXEL_LAYER_GRASS_SIDE 1
+
+// a 32^3 block of voxel types, stored as indices into a small per-chunk palette. The
+// index width grows 0 -> 1 -> 2 -> 4 -> 8 bits as new types show up, so a uniform chunk
+// costs nothing and a typical terrain chunk (air, grass, moss) costs 2 bits a voxel.
+class VoxelChunk
+{
+public:
+  VoxelChunk() : bits(0)
+  {
+    palette.push_back(VOXEL_AIR);
+  }
+
+  unsigned char get(int x, int y, int z) const
+  {
+    return palette[readIndex(x + y * VOXEL_CHUNK_SIZE + z * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE)];
+  }
+
+  void set(int x, int y, int z, unsigned char type)
+  {
+    unsigned int entry = 0;
+
+    while (entry < palette.size() && palette[entry] != type) {
+      entry++;
+    }
+
+    if (entry == palette.size()) {
+      palette.push_back(type);
+
+      if (palette.size() > (1u << bits)) {
+        repack(bits == 0 ? 1 : bits * 2);
+      }
+    }
+
+    writeIndex(x + y * VOXEL_CHUNK_SIZE + z * VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE, entry);
+  }
+
+  // true when every voxel is air, so there's nothing to mesh
+  bool empty() const
+  {
+    return bits == 0 && palette[0] == VOXEL_AIR;
+  }
+
+  unsigned int bytes() const
+  {
+    return packed.size() * sizeof(uint32_t) + palette.size();
+  }
+
+private:
+  std::vector<unsigned char> palette; // palette entry -> voxel type; entries are never removed
+  unsigned int bits; // per voxel; 0 means every voxel is palette[0]
+  std::vector<uint32_t> packed; // indices never straddle two words since bits divides 32
+
+  unsigned int readIndex(unsigned int i) const
+  {
+    if (bits == 0) {
+      return 0;
+    }
+
+    unsigned int perWord = 32 / bits;
+    return (packed[i / perWord] >> ((i % perWord) * bits)) & ((1u << bits) - 1);
+  }
+
+  void writeIndex(unsigned int i, unsigned int entry)
+  {
+    if (bits == 0) {
+      return; // entry is 0 here: a new type would have forced a repack first
+    }
+
+    unsigned int perWord = 32 / bits;
+    unsigned int shift = (i % perWord) * bits;
+    uint32_t mask = ((1u << bits) - 1) << shift;
+    packed[i / perWord] = (packed[i / perWord] & ~mask) | (entry << shift);
+  }
+
+  void repack(unsigned int newBits)
+  {
+    std::vector<unsigned int> indices(VOXEL_CHUNK_VOLUME);
+
+    for (unsigned int i = 0; i < VOXEL_CHUNK_VOLUME; i++) {
+      indices[i] = readIndex(i);
+    }
+
+    bits = newBits;
+    packed.assign(VOXEL_CHUNK_VOLUME / (32 / bits), 0);
+
+    for (unsigned int i = 0; i < VOXEL_CHUNK_VOLUME; i++) {
+      writeIndex(i, indices[i]);
+    }
+  }
+};
+
+// gl side of one chunk; vertices are already in world space
+typedef struct {
+  unsigned int vao;
+  unsigned int vbo;
+  unsigned int ibo;
+  unsigned int indexCount;
+  bool dirty; // voxels changed since the last mesh was started
+  bool inFlight; // a worker is meshing it right now
+} VoxelChunkMesh;
+
+// one meshing request: a padded copy of the chunk in, vertex and index lists out. Jobs
+// are recycled, so once their vectors have grown remeshing doesn't allocate.
+typedef struct {
+  unsigned int chunk;
+  glm::ivec3 voxelOrigin; // chunk's first voxel, in world voxel coordinates
+  unsigned char padded[VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE];
+  std::vector<float> vertices;
+  std::vector<unsigned int> indices;
+} VoxelMeshJob;
+
+inline int voxelTextureLayer(unsigned char type, int axis, int side)
+{
+  if (type == VOXEL_GRASS && !(axis == 1 && side > 0)) {
+    return VOXEL_LAYER_GRASS_SIDE;
+  }
+
+  return VOXEL_LAYER_GRASS_TOP;
+}
+
+// hidden-face removal plus greedy merging: for every slice along every axis and facing,
+// mark the faces whose neighbour is air, then grow each marked face into the widest,
+// then tallest, rectangle of identical faces and emit that as one quad
+inline void greedyMeshChunk(VoxelMeshJob *job, glm::vec3 worldOrigin)
+{
+  const int n = VOXEL_CHUNK_SIZE;
+  int mask[VOXEL_CHUNK_SIZE * VOXEL_CHUNK_SIZE];
+
+  job->vertices.clear();
+  job->indices.clear();
+
+  for (int d = 0; d < 3; d++) {
+    int u = (d + 1) % 3;
+    int v = (d + 2) % 3;
+
+    for (int side = -1; side <= 1; side += 2) {
+      for (int slice = 0; slice < n; slice++) {
+        for (int j = 0; j < n; j++) {
+          for (int i = 0; i < n; i++) {
+            int c[3];
+            c[d] = slice;
+            c[u] = i;
+            c[v] = j;
+            int p = (c[0] + 1) + (c[1] + 1) * VOXEL_PADDED_SIZE + (c[2] + 1) * VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE;
+            int step = d == 0 ? 1 : d == 1 ? VOXEL_PADDED_SIZE : VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE;
+            unsigned char type = job->padded[p];
+            unsigned char neighbour = job->padded[p + side * step];
+
+            mask[i + j * n] = type != VOXEL_AIR && neighbour == VOXEL_AIR ? voxelTextureLayer(type, d, side) + 1 : 0;
+          }
+        }
+
+        for (int j = 0; j < n; j++) {
+          for (int i = 0; i < n;) {
+            int m = mask[i + j * n];
+
+            if (m == 0) {
+              i++;
+              continue;
+            }
+
+            int w = 1;
+
+            while (i + w < n && mask[i + w + j * n] == m) {
+              w++;
+            }
+
+            int h = 1;
+
+            for (bool grow = true; grow && j + h < n; h += grow ? 1 : 0) {
+              for (int k = 0; k < w && grow; k++) {
+                grow = mask[i + k + (j + h) * n] == m;
+              }
+            }
+
+            for (int y = 0; y < h; y++) {
+              for (int x = 0; x < w; x++) {
+                mask[i + x + (j + y) * n] = 0;
+              }
+            }
+
+            // corners in (u, v), counter-clockwise seen from +d since u x v == d
+            int corners[4][2] = { { i, j }, { i + w, j }, { i + w, j + h }, { i, j + h } };
+            unsigned int base = job->vertices.size() / VOXEL_VERTEX_FLOATS;
+
+            for (int k = 0; k < 4; k++) {
+              glm::vec3 pos;
+              pos[d] = (float)(slice + (side > 0 ? 1 : 0));
+              pos[u] = (float)corners[k][0];
+              pos[v] = (float)corners[k][1];
+              pos += glm::vec3(job->voxelOrigin);
+
+              glm::vec3 normal(0.0f);
+              normal[d] = (float)side;
+
+              // world-aligned coordinates keep the texture tiling once per voxel across merged quads
+              float s = d == 0 ? pos.z : pos.x;
+              float t = d == 1 ? pos.z : pos.y;
+              pos += worldOrigin;
+
+              float vertex[VOXEL_VERTEX_FLOATS] = { pos.x, pos.y, pos.z, normal.x, normal.y, normal.z, s, t, (float)(m - 1) };
+              job->vertices.insert(job->vertices.end(), vertex, vertex + VOXEL_VERTEX_FLOATS);
+            }
+
+            unsigned int front[6] = { 0, 1, 2, 0, 2, 3 };
+            unsigned int back[6] = { 0, 2, 1, 0, 3, 2 };
+
+            for (int k = 0; k < 6; k++) {
+              job->indices.push_back(base + (side > 0 ? front[k] : back[k]));
+            }
+
+            i += w;
+          }
+        }
+      }
+    }
+  }
+}
+
+// a box of chunks whose meshes are built on worker threads. Changing a voxel only marks
+// its chunk (and any neighbour sharing that face) dirty; update() hands dirty chunks to
+// the workers and uploads whatever they've finished, one draw per non-empty chunk.
+//
+// update() and everything that touches the meshes belong to the render thread; voxels
+// can be read and edited from any thread, since the chunk data and the dirty flags are
+// behind chunksLock.
+class VoxelWorld
+{
+public:
+  glm::ivec3 chunkCounts;
+  glm::vec3 origin; // world position of voxel (0, 0, 0)'s minimum corner
+  std::vector<VoxelChunk> chunks;
+  std::vector<VoxelChunkMesh> meshes;
+
+  VoxelWorld(glm::ivec3 chunkCounts, glm::vec3 origin, unsigned int numThreads)
+    : chunkCounts(chunkCounts), origin(origin), quit(false)
+  {
+    unsigned int numChunks = chunkCounts.x * chunkCounts.y * chunkCounts.z;
+    chunks.resize(numChunks);
+    meshes.resize(numChunks);
+
+    for (unsigned int i = 0; i < numChunks; i++) {
+      meshes[i].vao = 0;
+      meshes[i].indexCount = 0;
+      meshes[i].dirty = true;
+      meshes[i].inFlight = false;
+    }
+
+    // enough that every chunk can be in flight at once, so the queues never reallocate
+    pendingJobs.reserve(numChunks);
+    finishedJobs.reserve(numChunks);
+
+    for (unsigned int i = 0; i < numThreads; i++) {
+      workers.push_back(std::thread(&VoxelWorld::workerLoop, this));
+    }
+  }
+
+  ~VoxelWorld()
+  {
+    {
+      std::lock_guard<std::mutex> lock(jobsLock);
+      quit = true;
+    }
+
+    jobsReady.notify_all();
+
+    for (unsigned int i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+
+    for (unsigned int i = 0; i < allJobs.size(); i++) {
+      delete allJobs[i];
+    }
+  }
+
+  glm::ivec3 size() const
+  {
+    return chunkCounts * VOXEL_CHUNK_SIZE;
+  }
+
+  // outside the world is air
+  unsigned char get(int x, int y, int z)
+  {
+    std::lock_guard<std::mutex> lock(chunksLock);
+    return voxelAt(x, y, z);
+  }
+
+  void set(int x, int y, int z, unsigned char type)
+  {
+    glm::ivec3 extent = size();
+
+    if (x < 0 || y < 0 || z < 0 || x >= extent.x || y >= extent.y || z >= extent.z) {
+      return;
+    }
+
+    glm::ivec3 c(x / VOXEL_CHUNK_SIZE, y / VOXEL_CHUNK_SIZE, z / VOXEL_CHUNK_SIZE);
+    glm::ivec3 local(x % VOXEL_CHUNK_SIZE, y % VOXEL_CHUNK_SIZE, z % VOXEL_CHUNK_SIZE);
+    std::lock_guard<std::mutex> lock(chunksLock);
+    VoxelChunk *chunk = &chunks[chunkIndex(c.x, c.y, c.z)];
+
+    if (chunk->get(local.x, local.y, local.z) == type) {
+      return;
+    }
+
+    chunk->set(local.x, local.y, local.z, type);
+    markDirty(c);
+
+    // a voxel on a chunk face changes what the neighbour across that face can see
+    for (int axis = 0; axis < 3; axis++) {
+      if (local[axis] == 0) {
+        glm::ivec3 neighbour = c;
+        neighbour[axis]--;
+        markDirty(neighbour);
+      } else if (local[axis] == VOXEL_CHUNK_SIZE - 1) {
+        glm::ivec3 neighbour = c;
+        neighbour[axis]++;
+        markDirty(neighbour);
+      }
+    }
+  }
+
+  // render thread, once a frame: queues dirty chunks and uploads finished meshes. `identity`
+  // feeds the per-instance attributes, since chunk vertices are already in world space.
+  // Returns how many chunks got a new mesh this call.
+  unsigned int update(InstanceBuffer *identity)
+  {
+    unsigned int queued = 0;
+    std::unique_lock<std::mutex> chunksHeld(chunksLock);
+
+    for (unsigned int i = 0; i < meshes.size(); i++) {
+      if (!meshes[i].dirty || meshes[i].inFlight) {
+        continue;
+      }
+
+      meshes[i].dirty = false;
+
+      if (chunks[i].empty()) {
+        meshes[i].indexCount = 0;
+        continue;
+      }
+
+      VoxelMeshJob *job = takeJob();
+      job->chunk = i;
+      job->voxelOrigin = chunkCoords(i) * VOXEL_CHUNK_SIZE;
+      copyPadded(job);
+      meshes[i].inFlight = true;
+
+      {
+        std::lock_guard<std::mutex> lock(jobsLock);
+        pendingJobs.push_back(job);
+      }
+
+      queued++;
+    }
+
+    chunksHeld.unlock();
+
+    if (queued > 0) {
+      jobsReady.notify_all();
+    }
+
+    unsigned int uploaded = 0;
+    std::lock_guard<std::mutex> lock(finishedLock);
+
+    for (unsigned int i = 0; i < finishedJobs.size(); i++) {
+      upload(finishedJobs[i], identity);
+      freeJobs.push_back(finishedJobs[i]);
+      uploaded++;
+    }
+
+    finishedJobs.clear();
+    return uploaded;
+  }
+
+  glm::vec3 chunkMin(unsigned int i) const
+  {
+    return origin + glm::vec3(chunkCoords(i) * VOXEL_CHUNK_SIZE);
+  }
+
+  glm::vec3 chunkMax(unsigned int i) const
+  {
+    return chunkMin(i) + glm::vec3((float)VOXEL_CHUNK_SIZE);
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex chunksLock; // guards the voxels in chunks and meshes[].dirty
+  std::mutex jobsLock;
+  std::condition_variable jobsReady;
+  std::vector<VoxelMeshJob *> pendingJobs; // guarded by jobsLock
+  bool quit; // guarded by jobsLock
+  std::mutex finishedLock;
+  std::vector<VoxelMeshJob *> finishedJobs; // guarded by finishedLock
+  std::vector<VoxelMeshJob *> freeJobs; // render thread only
+  std::vector<VoxelMeshJob *> allJobs; // render thread only
+
+  unsigned int chunkIndex(int cx, int cy, int cz) const
+  {
+    return cx + cy * chunkCounts.x + cz * chunkCounts.x * chunkCounts.y;
+  }
+
+  glm::ivec3 chunkCoords(unsigned int i) const
+  {
+    return glm::ivec3(i % chunkCounts.x, (i / chunkCounts.x) % chunkCounts.y, i / (chunkCounts.x * chunkCounts.y));
+  }
+
+  // the callers hold chunksLock
+  unsigned char voxelAt(int x, int y, int z) const
+  {
+    glm::ivec3 extent = size();
+
+    if (x < 0 || y < 0 || z < 0 || x >= extent.x || y >= extent.y || z >= extent.z) {
+      return VOXEL_AIR;
+    }
+
+    return chunks[chunkIndex(x / VOXEL_CHUNK_SIZE, y / VOXEL_CHUNK_SIZE, z / VOXEL_CHUNK_SIZE)].get(x % VOXEL_CHUNK_SIZE, y % VOXEL_CHUNK_SIZE, z % VOXEL_CHUNK_SIZE);
+  }
+
+  void markDirty(glm::ivec3 c)
+  {
+    if (c.x >= 0 && c.y >= 0 && c.z >= 0 && c.x < chunkCounts.x && c.y < chunkCounts.y && c.z < chunkCounts.z) {
+      meshes[chunkIndex(c.x, c.y, c.z)].dirty = true;
+    }
+  }
+
+  VoxelMeshJob *takeJob()
+  {
+    if (freeJobs.empty()) {
+      allJobs.push_back(new VoxelMeshJob());
+      return allJobs.back();
+    }
+
+    VoxelMeshJob *job = freeJobs.back();
+    freeJobs.pop_back();
+    return job;
+  }
+
+  // under chunksLock, from update(). Workers never read the live chunks, only this
+  // snapshot, so voxels can keep being edited while a mesh is being built.
+  void copyPadded(VoxelMeshJob *job)
+  {
+    const VoxelChunk *chunk = &chunks[job->chunk];
+    glm::ivec3 o = job->voxelOrigin;
+
+    for (int z = -1; z <= VOXEL_CHUNK_SIZE; z++) {
+      for (int y = -1; y <= VOXEL_CHUNK_SIZE; y++) {
+        for (int x = -1; x <= VOXEL_CHUNK_SIZE; x++) {
+          bool inside = x >= 0 && y >= 0 && z >= 0 && x < VOXEL_CHUNK_SIZE && y < VOXEL_CHUNK_SIZE && z < VOXEL_CHUNK_SIZE;
+          job->padded[(x + 1) + (y + 1) * VOXEL_PADDED_SIZE + (z + 1) * VOXEL_PADDED_SIZE * VOXEL_PADDED_SIZE] =
+            inside ? chunk->get(x, y, z) : voxelAt(o.x + x, o.y + y, o.z + z);
+        }
+      }
+    }
+  }
+
+  void upload(VoxelMeshJob *job, InstanceBuffer *identity)
+  {
+    VoxelChunkMesh *mesh = &meshes[job->chunk];
+    mesh->inFlight = false;
+
+    if (mesh->vao == 0) {
+      glGenVertexArrays(1, &mesh->vao);
+      glGenBuffers(1, &mesh->vbo);
+      glGenBuffers(1, &mesh->ibo);
+      glBindVertexArray(mesh->vao);
+
+      glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VOXEL_VERTEX_FLOATS * sizeof(float), (void*)0);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VOXEL_VERTEX_FLOATS * sizeof(float), (void*)(3 * sizeof(float)));
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, VOXEL_VERTEX_FLOATS * sizeof(float), (void*)(6 * sizeof(float)));
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(VOXEL_LAYER_LOCATION, 1, GL_FLOAT, GL_FALSE, VOXEL_VERTEX_FLOATS * sizeof(float), (void*)(8 * sizeof(float)));
+      glEnableVertexAttribArray(VOXEL_LAYER_LOCATION);
+      identity->bindAttributes(0);
+
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+      glBindVertexArray(0);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+    glBufferData(GL_ARRAY_BUFFER, job->vertices.size() * sizeof(float), job->vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // the element buffer binding is vertex array state, so it goes through the vao
+    glBindVertexArray(mesh->vao);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, job->indices.size() * sizeof(unsigned int), job->indices.data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    mesh->indexCount = job->indices.size();
+  }
+
+  void workerLoop()
+  {
+    while (true) {
+      VoxelMeshJob *job;
+
+      {
+        std::unique_lock<std::mutex> lock(jobsLock);
+
+        while (!quit && pendingJobs.empty()) {
+          jobsReady.wait(lock);
+        }
+
+        if (quit) {
+          return;
+        }
+
+        job = pendingJobs.back();
+        pendingJobs.pop_back();
+      }
+
+      greedyMeshChunk(job, origin);
+
+      std::lock_guard<std::mutex> lock(finishedLock);
+      finishedJobs.push_back(job);
+    }
+  }
+};
+#endif
@@ -0,0 +1,6 @@
+#version 410 core
+// the transform feedback passes (animate.vs, particle_sim.vs) run with the rasterizer off;
+// this is only here to make a complete program
+void main()
+{
+}
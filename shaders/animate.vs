@@ -0,0 +1,81 @@
+#version 410 core
+// --gpu-animation: the per-frame animation, run as a transform feedback pass with the
+// rasterizer off. One point per light (ANIMATE_LIGHTS) or per entity; whatever the
+// outputs hold is captured straight into the buffers the other passes read.
+
+uniform float time;
+
+#ifdef ANIMATE_LIGHTS
+// the same motion as light_kernel.h, from the per-light constants set up at load time
+layout(location = 0) in vec4 aMotion; // orbit radius, bob height, orbit rate, bob rate
+layout(location = 1) in vec3 aColorRate;
+layout(location = 2) in vec4 aAttenuation; // constant, linear, quadratic, unused
+
+// three texels per light in the animatedLights buffer
+out vec4 lightPos;
+out vec4 lightColor; // the specular color; diffuse and ambient are 0.65 and 0.3 of it
+out vec4 lightAttenuation;
+
+void main()
+{
+  float orbit = time * aMotion.z;
+  lightPos = vec4(aMotion.x * sin(orbit), aMotion.y + sin(time * aMotion.w) * 1.3, aMotion.x * cos(orbit), 1.0);
+  lightColor = vec4(abs(sin(time * aColorRate)), 1.0);
+  lightAttenuation = aAttenuation;
+}
+#else
+// four texels per entity: position + base angle, rotation axis + spin rate,
+// scale + parent index, and the light it follows (-1 for none)
+uniform samplerBuffer entityParams;
+uniform samplerBuffer animatedLights;
+
+// the same record as InstanceTransform; the normal matrix columns are padded to vec4
+out mat4 model;
+out mat3x4 normalMatrix;
+
+#define MAX_PARENT_DEPTH 8
+
+// translate * rotate * scale and its cofactor, like computeTransformsScalar
+void localTransform(int i, out mat4 m, out mat3 n)
+{
+  vec4 posAngle = texelFetch(entityParams, i * 4);
+  vec4 axisSpin = texelFetch(entityParams, i * 4 + 1);
+  vec3 scale = texelFetch(entityParams, i * 4 + 2).xyz;
+  int light = int(texelFetch(entityParams, i * 4 + 3).x);
+  vec3 pos = light >= 0 ? texelFetch(animatedLights, light * 3).xyz : posAngle.xyz;
+
+  float angle = posAngle.w + time * axisSpin.w;
+  vec3 a = normalize(axisSpin.xyz);
+  float c = cos(angle);
+  float s = sin(angle);
+  vec3 t = (1.0 - c) * a;
+  vec3 r0 = vec3(c + t.x * a.x, t.x * a.y + s * a.z, t.x * a.z - s * a.y);
+  vec3 r1 = vec3(t.y * a.x - s * a.z, c + t.y * a.y, t.y * a.z + s * a.x);
+  vec3 r2 = vec3(t.z * a.x + s * a.y, t.z * a.y - s * a.x, c + t.z * a.z);
+
+  m = mat4(vec4(r0 * scale.x, 0.0), vec4(r1 * scale.y, 0.0), vec4(r2 * scale.z, 0.0), vec4(pos, 1.0));
+  n = mat3(r0 * (scale.y * scale.z), r1 * (scale.x * scale.z), r2 * (scale.x * scale.y));
+}
+
+void main()
+{
+  mat4 m;
+  mat3 n;
+  localTransform(gl_VertexID, m, n);
+
+  // up the parent chain; a parent's world transform is just its own chain applied on the left
+  int parent = int(texelFetch(entityParams, gl_VertexID * 4 + 2).w);
+
+  for (int depth = 0; depth < MAX_PARENT_DEPTH && parent >= 0; depth++) {
+    mat4 pm;
+    mat3 pn;
+    localTransform(parent, pm, pn);
+    m = pm * m;
+    n = pn * n;
+    parent = int(texelFetch(entityParams, parent * 4 + 2).w);
+  }
+
+  model = m;
+  normalMatrix = mat3x4(vec4(n[0], 0.0), vec4(n[1], 0.0), vec4(n[2], 0.0));
+}
+#endif
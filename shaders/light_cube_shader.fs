@@ -1,17 +1,21 @@
 #version 410 core
 out vec4 FragColor;
 
-struct Light {
-  vec3 position;
+// every light cube shares one material, so the light's current color comes in per draw
+#ifdef GPU_LIGHTS
+// ... or just which light it is, with the color already in GpuAnimator's buffer
+uniform samplerBuffer animatedLights;
+uniform int lightIndex;
 
-  vec3 ambient;
-  vec3 diffuse;
-  vec3 specular;
-};
-
-uniform Light light;
+void main()
+{
+  FragColor = vec4(texelFetch(animatedLights, lightIndex * 3 + 1).rgb, 1.0);
+}
+#else
+uniform vec3 lightColor;
 
 void main()
 {
-  FragColor = vec4(light.ambient + light.diffuse + light.specular, 1.0); // set all 4 vector values to 1.0
+  FragColor = vec4(lightColor, 1.0);
 }
+#endif
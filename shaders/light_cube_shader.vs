@@ -1,12 +1,9 @@
 #version 410 core
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout(location = 3) in mat4 aModel;
 
 void main()
 {
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+  gl_Position = frame.viewProj * aModel * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -8,7 +8,6 @@ in vec3 FragPos;
 in vec4 FragPosLightSpace;
 
 uniform vec3 lightPos;
-uniform vec3 viewPos;
 
 struct PointLight {
   vec3 pos;
@@ -21,9 +20,36 @@ struct PointLight {
   float linear;
   float quadratic;
 };
+#ifndef MAX_NUM_OF_LIGHTS
 #define MAX_NUM_OF_LIGHTS 100
+#endif
 uniform PointLight pointLights[MAX_NUM_OF_LIGHTS];
 
+#ifdef GPU_LIGHTS
+// --gpu-animation: animate.vs leaves every light in a buffer, three texels each
+// (position, specular color, attenuation), and light i is just the i-th
+uniform samplerBuffer animatedLights;
+
+PointLight PointLightAt(int i)
+{
+  PointLight light;
+  vec4 attenuation = texelFetch(animatedLights, i * 3 + 2);
+  light.pos = texelFetch(animatedLights, i * 3).xyz;
+  light.specular = texelFetch(animatedLights, i * 3 + 1).rgb;
+  light.diffuse = light.specular * 0.65;
+  light.ambient = light.specular * 0.3;
+  light.constant = attenuation.x;
+  light.linear = attenuation.y;
+  light.quadratic = attenuation.z;
+  return light;
+}
+#else
+PointLight PointLightAt(int i)
+{
+  return pointLights[i];
+}
+#endif
+
 struct DirLight {
   vec3 dir;
 
@@ -37,47 +63,107 @@ uniform DirLight dirLight;
 struct Material {
   sampler2D emission;
   sampler2D emission_map;
-  vec3 ambient;
   sampler2D diffuse;
   sampler2D specular;
-  float shininess;
 };
 
 uniform Material material;
+
+// per-material constants; one std140 record per material in a shared buffer
+layout(std140) uniform MaterialBlock {
+  vec3 ambient;
+  float shininess;
+  vec3 diffuseColor;
+  vec3 specularColor;
+} materialConstants;
 uniform int lightsUsed;
+uniform vec3 ambientFill; // what the point lights that weren't picked this frame would roughly add
 uniform samplerCube skybox;
 uniform sampler2D shadowMap;
 
+#ifdef VOXEL
+// voxel faces pick their tile out of one texture array instead of a per-material texture
+in float Layer;
+uniform sampler2DArray voxelTextures;
+
+vec3 DiffuseColor()
+{
+  return texture(voxelTextures, vec3(TexCoords, Layer)).rgb;
+}
+#else
+vec3 DiffuseColor()
+{
+  return texture(material.diffuse, TexCoords).rgb;
+}
+#endif
+
+#ifdef POINT_SHADOWS
+// every point light's six shadow faces sit in one 3x2 block of a shared depth atlas:
+// xy is the block's corner and z one face's size, both in atlas uv; w is the light's far
+// plane, or 0 while it has no shadow to look up
+uniform vec4 pointShadowTiles[MAX_NUM_OF_LIGHTS];
+uniform sampler2DShadow pointShadowAtlas;
+#endif
+
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow);
 float ShadowCalculation(vec4 fragPosLightSpace, vec3 lightDir, vec3 normal);
+float PointShadow(int i, vec3 fragPos, vec3 normal);
 
+#ifdef POINT_SHADOW_PASS
+// point_shadow.gs sends the triangle to the cube faces; the atlas keeps linear distance
+// to the light, so precision doesn't fall off towards the far plane
+in vec3 ShadowFragPos;
+uniform vec3 shadowLightPos;
+uniform float shadowFar;
+
+void main()
+{
+  gl_FragDepth = length(ShadowFragPos - shadowLightPos) / shadowFar;
+}
+#elif defined(DEPTH_ONLY)
+// the shadow passes and the depth pre-pass only need depth; nothing writes color
+void main()
+{
+}
+#elif defined(OVERDRAW)
+// the overdraw view: every fragment adds one to its pixel's count
+void main()
+{
+  FragColor = vec4(1.0);
+}
+#else
 void main()
 {
   // properties
   vec3 norm = normalize(Normal);
-  vec3 viewDir = normalize(viewPos - FragPos);
+  vec3 viewDir = normalize(frame.viewPos - FragPos);
 
   // phase 1: Directional lighting
   vec3 result = CalcDirLight(dirLight, norm, viewDir);
 
   // phase 2: Point lights
   for (int i = 0; i < lightsUsed; i++) {
-    vec3 pointResult = CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+    vec3 pointResult = CalcPointLight(PointLightAt(i), norm, FragPos, viewDir, PointShadow(i, FragPos, norm));
     result.x = max(result.x, pointResult.x);
     result.y = max(result.y, pointResult.y);
     result.z = max(result.z, pointResult.z);
   }
 
+  result = max(result, ambientFill * DiffuseColor());
+
+#ifdef HAS_EMISSION
   vec3 emissionResult = texture(material.emission_map, TexCoords).rgb * texture(material.emission, TexCoords).rgb;
   result.x = max(result.x, emissionResult.x);
   result.y = max(result.y, emissionResult.y);
   result.z = max(result.z, emissionResult.z);
+#endif
 
   // phase 3: Spot light
   //result += CalcSpotLight(spotLight, norm, FragPos, viewDir);
 
-  vec3 I = normalize(FragPos - viewPos);
+#ifdef REFLECTION
+  vec3 I = normalize(FragPos - frame.viewPos);
   // for reflection:
   vec3 R = reflect(I, normalize(Normal));
 
@@ -89,6 +175,9 @@ void main()
 
   // 0.68 and 0.58 "just because" -- need to darken the values, given we're summing them
   FragColor = vec4(result * 0.92 + reflect_result * 0.08, 1.0);
+#else
+  FragColor = vec4(result * 0.92, 1.0);
+#endif
 }
 
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
@@ -96,17 +185,26 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
   vec3 lightDir = normalize(-light.dir);
   // diffuse shading
   float diff = max(dot(normal, lightDir), 0.0);
+  // combine results
+  vec3 ambient  = light.ambient  * DiffuseColor();
+  vec3 diffuse  = light.diffuse  * diff * DiffuseColor();
+#ifdef HAS_SPECULAR_MAP
   // specular shading
   vec3 reflectDir = reflect(-lightDir, normal);
-  float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-  // combine results
-  vec3 ambient  = light.ambient  * vec3(texture(material.diffuse, TexCoords));
-  vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.diffuse, TexCoords));
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), materialConstants.shininess);
   vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+#else
+  vec3 specular = vec3(0.0); // the blank specular texture is black
+#endif
+#ifdef SHADOWS
   float shadow = ShadowCalculation(FragPosLightSpace, lightDir, normal);
+#else
+  float shadow = 0.0;
+#endif
   return (ambient + (1.0 - shadow) * (diffuse + specular));
 }
 
+#ifdef SHADOWS
 float ShadowCalculation(vec4 fragPosLightSpace, vec3 lightDir, vec3 normal)
 {
   // perform perspective divide
@@ -138,26 +236,83 @@ float ShadowCalculation(vec4 fragPosLightSpace, vec3 lightDir, vec3 normal)
   shadow /= 25.0;
   return shadow;
 }
+#endif
 
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+#ifdef POINT_SHADOWS
+float PointShadow(int i, vec3 fragPos, vec3 normal)
+{
+  vec4 tile = pointShadowTiles[i];
+
+  if (tile.w == 0.0) {
+    return 0.0;
+  }
+
+  // nudged off the surface along its normal so it doesn't shadow itself
+  vec3 d = fragPos + normal * 0.05 - PointLightAt(i).pos;
+  vec3 a = abs(d);
+  float distance = length(d);
+
+  if (distance >= tile.w) {
+    return 0.0;
+  }
+
+  // pick the cube face and where on it, the same way the face matrices projected it
+  int face;
+  float ma;
+  vec2 st;
+
+  if (a.x >= a.y && a.x >= a.z) {
+    face = d.x > 0.0 ? 0 : 1;
+    ma = a.x;
+    st = vec2(d.x > 0.0 ? -d.z : d.z, -d.y);
+  } else if (a.y >= a.z) {
+    face = d.y > 0.0 ? 2 : 3;
+    ma = a.y;
+    st = vec2(d.x, d.y > 0.0 ? d.z : -d.z);
+  } else {
+    face = d.z > 0.0 ? 4 : 5;
+    ma = a.z;
+    st = vec2(d.z > 0.0 ? d.x : -d.x, -d.y);
+  }
+
+  // stay half a texel inside the face so filtering never reads the neighbouring one
+  float halfTexel = 0.5 / (tile.z * textureSize(pointShadowAtlas, 0).x);
+  vec2 faceUv = clamp(st / ma * 0.5 + 0.5, halfTexel, 1.0 - halfTexel);
+  vec2 uv = tile.xy + (vec2(face % 3, face / 3) + faceUv) * tile.z;
+
+  return 1.0 - texture(pointShadowAtlas, vec3(uv, distance / tile.w - 0.002));
+}
+#else
+float PointShadow(int i, vec3 fragPos, vec3 normal)
+{
+  return 0.0;
+}
+#endif
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
 {
   vec3 lightDir = normalize(light.pos - fragPos);
   // diffuse shading
   float diff = max(dot(normal, lightDir), 0.0);
-  // specular shading
-  vec3 reflectDir = reflect(-lightDir, normal);
-  float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
   // attenuation
   float distance    = length(light.pos - fragPos);
   float attenuation = 1.0 / (light.constant + light.linear * distance +
                              light.quadratic * (distance * distance));
   // combine results
-  vec3 ambient  = light.ambient  * vec3(texture(material.diffuse, TexCoords));
-  vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.diffuse, TexCoords));
-  vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+  vec3 ambient  = light.ambient  * DiffuseColor();
+  vec3 diffuse  = light.diffuse  * diff * DiffuseColor();
   ambient  *= attenuation;
-  diffuse  *= attenuation;
-  specular *= attenuation;
+  diffuse  *= attenuation * (1.0 - shadow);
+#ifdef HAS_SPECULAR_MAP
+  // specular shading
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0), materialConstants.shininess);
+  vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
+  specular *= attenuation * (1.0 - shadow);
   return (ambient + diffuse + specular);
+#else
+  return (ambient + diffuse);
+#endif
 }
+#endif
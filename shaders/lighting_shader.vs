@@ -3,6 +3,13 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+// per instance, computed on the cpu for every entity at once
+layout(location = 3) in mat4 aModel;
+layout(location = 7) in mat3 aNormalMatrix;
+#ifdef VOXEL
+layout(location = 10) in float aLayer;
+out float Layer;
+#endif
 //layout(location = 2) in vec3 aColor;
 
 //out vec3 ourColor;
@@ -10,17 +17,21 @@ out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
 out vec4 FragPosLightSpace;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat4 lightSpaceMatrix;
+// the depth-only and lit variants must land on exactly the same depth for the pre-pass's GL_EQUAL
+invariant gl_Position;
 
 void main()
 {
-  FragPos = vec3(model * vec4(aPos, 1.0));
-  Normal = mat3(transpose(inverse(model))) * aNormal;
+  FragPos = vec3(aModel * vec4(aPos, 1.0));
   TexCoords = aTexCoord;
-  FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
-  gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef VOXEL
+  Layer = aLayer;
+#endif
+#ifndef DEPTH_ONLY
+  Normal = aNormalMatrix * aNormal;
+#endif
+#ifdef SHADOWS
+  FragPosLightSpace = frame.lightSpaceMatrix * vec4(FragPos, 1.0);
+#endif
+  gl_Position = frame.viewProj * vec4(FragPos, 1.0);
 }
\ No newline at end of file
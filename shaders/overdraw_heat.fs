@@ -0,0 +1,23 @@
+#version 410 core
+out vec4 FragColor;
+
+uniform sampler2D counts; // fragments per pixel, drawn at the same size as this pass
+uniform float maxCount;
+
+// black where nothing was drawn, then blue (drawn once) through green, yellow and red
+// to white at maxCount and above
+void main()
+{
+  float count = texelFetch(counts, ivec2(gl_FragCoord.xy), 0).r;
+
+  if (count < 0.5) {
+    FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+    return;
+  }
+
+  const vec3 ramp[5] = vec3[5](vec3(0.0, 0.2, 1.0), vec3(0.0, 0.9, 0.2), vec3(1.0, 0.9, 0.0), vec3(1.0, 0.1, 0.0),
+                               vec3(1.0, 1.0, 1.0));
+  float t = clamp((count - 1.0) / (maxCount - 1.0), 0.0, 1.0) * 4.0;
+  int i = min(int(t), 3);
+  FragColor = vec4(mix(ramp[i], ramp[i + 1], t - float(i)), 1.0);
+}
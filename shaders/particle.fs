@@ -0,0 +1,27 @@
+#version 410 core
+out vec4 FragColor;
+
+in vec2 Corner;
+in vec3 Color;
+in float ViewDepth;
+
+uniform sampler2D sceneDepth; // a copy of the main pass's depth, same size and corner
+
+#define SOFT_FADE_DISTANCE 0.3 // world units over which a particle fades into what's behind it
+
+void main()
+{
+  float falloff = 1.0 - dot(Corner, Corner);
+
+  if (falloff <= 0.0) {
+    discard;
+  }
+
+  // back to view distance: ndc z = -P[2][2] + P[3][2] / distance for a perspective projection
+  float ndc = texelFetch(sceneDepth, ivec2(gl_FragCoord.xy), 0).r * 2.0 - 1.0;
+  float sceneDistance = frame.projection[3][2] / (ndc + frame.projection[2][2]);
+  float soft = clamp((sceneDistance - ViewDepth) / SOFT_FADE_DISTANCE, 0.0, 1.0);
+
+  // blended additively, so alpha doesn't matter
+  FragColor = vec4(Color * falloff * falloff * soft, 1.0);
+}
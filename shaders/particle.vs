@@ -0,0 +1,45 @@
+#version 410 core
+// one camera-facing quad per particle, drawn as an instanced 4-vertex strip
+layout(location = 0) in vec4 aPosAge; // per instance
+layout(location = 1) in vec4 aVelLife;
+
+out vec2 Corner; // -1..1 across the quad
+out vec3 Color;
+out float ViewDepth;
+
+#define MAX_PARTICLE_EMITTERS 16
+
+uniform int numEmitters;
+uniform int emitterFirst[MAX_PARTICLE_EMITTERS];
+uniform vec4 emitterLook[MAX_PARTICLE_EMITTERS]; // color, size
+
+void main()
+{
+  float age = aPosAge.w;
+  float life = aVelLife.w;
+
+  if (age < 0.0 || age >= life) {
+    gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // unborn or dead: off screen, so it's clipped
+    return;
+  }
+
+  int e = 0;
+
+  while (e + 1 < numEmitters && gl_InstanceID >= emitterFirst[e + 1]) {
+    e++;
+  }
+
+  // quick to appear, then dimming over the rest of its life
+  float t = age / life;
+  Color = emitterLook[e].rgb * min(t * 10.0, 1.0) * (1.0 - t);
+  Corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+
+  // the view matrix's rows are the camera's axes in world space
+  vec3 right = vec3(frame.view[0][0], frame.view[1][0], frame.view[2][0]);
+  vec3 up = vec3(frame.view[0][1], frame.view[1][1], frame.view[2][1]);
+  vec3 world = aPosAge.xyz + (right * Corner.x + up * Corner.y) * emitterLook[e].w;
+  vec4 viewPos = frame.view * vec4(world, 1.0);
+
+  ViewDepth = -viewPos.z;
+  gl_Position = frame.projection * viewPos;
+}
@@ -0,0 +1,82 @@
+#version 410 core
+// one particle's step, run as a transform feedback pass with the rasterizer off: reads
+// its state from one buffer and leaves the next in the other (see ParticleSystem)
+layout(location = 0) in vec4 aPosAge;
+layout(location = 1) in vec4 aVelLife;
+
+out vec4 posAge;
+out vec4 velLife;
+
+#define MAX_PARTICLE_EMITTERS 16
+
+// each emitter owns the particles from emitterFirst[e] up to the next one's
+uniform int numEmitters;
+uniform int emitterFirst[MAX_PARTICLE_EMITTERS];
+uniform int emitterEntity[MAX_PARTICLE_EMITTERS];
+uniform int emitterLight[MAX_PARTICLE_EMITTERS];
+uniform vec4 emitterMotion[MAX_PARTICLE_EMITTERS]; // speed, gravity, lifetime, spread
+uniform samplerBuffer instances; // the InstanceBuffer, seven texels per entity
+uniform int lightsUsed;
+uniform float time;
+uniform float dt;
+
+// a few rounds of integer hashing; plenty for where a spark goes
+uint hash(uint x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+float random(inout uint state)
+{
+  state = hash(state);
+  return float(state >> 8) * (1.0 / 16777216.0);
+}
+
+vec3 randomDirection(inout uint state)
+{
+  float z = random(state) * 2.0 - 1.0;
+  float a = random(state) * 6.2831853;
+  float r = sqrt(1.0 - z * z);
+  return vec3(r * cos(a), r * sin(a), z);
+}
+
+void main()
+{
+  int e = 0;
+
+  while (e + 1 < numEmitters && gl_VertexID >= emitterFirst[e + 1]) {
+    e++;
+  }
+
+  vec4 motion = emitterMotion[e];
+  float age = aPosAge.w + dt;
+  float life = aVelLife.w;
+
+  if (age < life) {
+    // still going (or not born yet, while age is negative)
+    vec3 vel = aVelLife.xyz - vec3(0.0, motion.y * dt, 0.0);
+    posAge = vec4(aPosAge.xyz + vel * dt, age);
+    velLife = vec4(vel, life);
+    return;
+  }
+
+  if (emitterLight[e] >= lightsUsed) {
+    posAge = vec4(aPosAge.xyz, life); // stays dead until its light comes back on
+    velLife = aVelLife;
+    return;
+  }
+
+  // reborn at the emitter; the seed changes every frame so no two lives look alike
+  uint state = hash(uint(gl_VertexID) ^ hash(floatBitsToUint(time)));
+  vec3 origin = texelFetch(instances, emitterEntity[e] * 7 + 3).xyz;
+  vec3 dir = normalize(randomDirection(state) + vec3(0.0, 1.0, 0.0));
+  float speed = motion.x * (0.5 + random(state));
+
+  posAge = vec4(origin + randomDirection(state) * motion.w * random(state), 0.0);
+  velLife = vec4(dir * speed, motion.z * (0.35 + 0.65 * random(state)));
+}
@@ -0,0 +1,22 @@
+#version 410 core
+// draws each triangle into all six faces of a point light's block in the shadow atlas;
+// one invocation per face, each routed to that face's viewport
+layout(triangles, invocations = 6) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+in vec3 FragPos[];
+out vec3 ShadowFragPos;
+
+uniform mat4 faceMatrices[6];
+
+void main()
+{
+  for (int i = 0; i < 3; i++) {
+    ShadowFragPos = FragPos[i];
+    gl_Position = faceMatrices[gl_InvocationID] * vec4(FragPos[i], 1.0);
+    gl_ViewportIndex = gl_InvocationID;
+    EmitVertex();
+  }
+
+  EndPrimitive();
+}
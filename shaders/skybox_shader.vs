@@ -3,11 +3,9 @@ layout(location = 0) in vec3 aPos;
 
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
-
 void main()
 {
   TexCoords = aPos;
-  gl_Position = projection * view * vec4(aPos, 1.0);
+  // drop the translation so the box stays centered on the camera
+  gl_Position = frame.projection * mat4(mat3(frame.view)) * vec4(aPos, 1.0);
 }
@@ -0,0 +1,28 @@
+#version 410 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;
+uniform vec2 uvScale; // the part of `scene` that was drawn into this frame
+uniform vec2 texelSize; // 1 / size of `scene`
+uniform float sharpness; // 0 is plain bilinear
+
+// bilinear upscale plus an unsharp mask over the four neighbouring source texels. The
+// result is clamped to the neighbourhood's range, so edges get crisper without ringing.
+void main()
+{
+  vec2 uvMax = uvScale - texelSize * 0.5;
+  vec2 uv = min(TexCoords * uvScale, uvMax);
+  vec3 c = texture(scene, uv).rgb;
+  vec3 n = texture(scene, min(uv + vec2(0.0, texelSize.y), uvMax)).rgb;
+  vec3 s = texture(scene, max(uv - vec2(0.0, texelSize.y), texelSize * 0.5)).rgb;
+  vec3 e = texture(scene, min(uv + vec2(texelSize.x, 0.0), uvMax)).rgb;
+  vec3 w = texture(scene, max(uv - vec2(texelSize.x, 0.0), texelSize * 0.5)).rgb;
+
+  vec3 lo = min(c, min(min(n, s), min(e, w)));
+  vec3 hi = max(c, max(max(n, s), max(e, w)));
+  vec3 sharpened = c + (4.0 * c - n - s - e - w) * 0.25 * sharpness;
+
+  FragColor = vec4(clamp(sharpened, lo, hi), 1.0);
+}
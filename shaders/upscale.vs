@@ -0,0 +1,10 @@
+#version 410 core
+out vec2 TexCoords;
+
+// one triangle that covers the screen; no vertex buffer, just gl_VertexID 0-2
+void main()
+{
+  vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  TexCoords = pos;
+  gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
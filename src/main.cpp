@@ -1,20 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <algorithm>
+#include <string.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <shader.h>
+#include <shader_variants.h>
+#include <uniform_buffer.h>
+#include <entity_store.h>
+#include <instance_buffer.h>
+#include <static_batch.h>
+#include <voxel_world.h>
+#include <pool.h>
+#include <frame_handoff.h>
+#include <frame_pacer.h>
+#include <dynamic_resolution.h>
+#include <shadow_atlas.h>
+#include <soft_raster.h>
+#include <frame_recorder.h>
+#include <light_kernel.h>
+#include <gpu_animator.h>
+#include <particle_system.h>
+#include <indirect_draws.h>
+#include <depth_prepass.h>
+#include <pipeline_stats.h>
+#include <overdraw_heat_map.h>
+#define ALLOC_COUNTER_IMPLEMENTATION
+#include <alloc_counter.h>
 #include <stb_image.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #define MAX_NUM_OF_LIGHTS 100
+#define MAX_NUM_OF_MATERIALS 128
+#define MAX_NUM_OF_MESHES 32
+#define MAX_NUM_OF_GAME_OBJECTS 16
+#define FRAME_ARENA_SIZE (1 << 20)
+#define STATIC_CHUNK_SIZE 16.0f // world units per side of a static batch cell
+#define VOXEL_CHUNKS_X 8
+#define VOXEL_CHUNKS_Y 4
+#define VOXEL_CHUNKS_Z 8
+#define SHADOW_WIDTH 8192
+#define SHADOW_HEIGHT 8192
+#define POINT_SHADOW_BUDGET (6 * 256 * 256 * 2) // atlas texels redrawn per frame, at most
+#define POINT_SHADOW_CUTOFF 50.0f // a light's shadows reach as far as its attenuation is above 1/this
+#define PACKETS_IN_FLIGHT 2 // frames queued for the render thread, counting the one it's drawing
+#define WARMUP_FRAMES 3 // first frames finish shader setup, so they're allowed to allocate
 #define INFOLOG_LENGTH 512
 #define WITHOUT_ATTRIBUTES 0
 #define WITH_ATTRIBUTES 1
 #define FOR_REAL 0
 #define FOR_DEPTH 1
+#define PASS_MASK(mode) (1 << (mode)) // entity passMasks bit for FOR_REAL/FOR_DEPTH
+#define ALL_PASSES (PASS_MASK(FOR_REAL) | PASS_MASK(FOR_DEPTH))
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
 typedef struct {
@@ -40,15 +80,21 @@ typedef struct {
   float pitch;
   float yaw;
   float lightsUsedControl;
+  bool showOverdraw; // the overdraw heat map in place of the lit scene
+  bool overdrawKeyDown;
 } Camera;
 
 typedef struct {
   int vao;
   int size;
+  const float *vertices; // the array createMesh was given, for baking static batches at load time
+  float radius; // of the sphere around the origin that holds every vertex, for culling
 } Mesh;
 
 typedef struct {
-  Shader *shader;
+  Shader *shader; // used as-is when there are no variants
+  ShaderVariants *variants; // lit materials pick a permutation per pass instead
+  unsigned int features; // SHADER_* bits this material actually needs
   int specularTexture;
   float shininess;
   int ambientTexture; // currently unused
@@ -58,8 +104,46 @@ typedef struct {
   glm::vec3 ambientColor;
   glm::vec3 specularColor;
   glm::vec3 diffuseColor;
+  UniformBuffer *constants; // shared MaterialBlock buffer this material has a record in
+  int id; // record index in `constants`
+  bool dirty; // set whenever a color/shininess changes so the record is re-uploaded
 } Material;
 
+// std140 layout of FrameBlock in the shaders; one record per pass (FOR_REAL/FOR_DEPTH)
+typedef struct {
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 viewProj;
+  glm::mat4 lightSpaceMatrix;
+  glm::vec3 viewPos;
+  float time;
+  glm::vec4 viewport;
+} FrameConstants;
+
+// FrameConstants as every shader sees it; Shader puts it at the top of each stage, so
+// this and the struct above are the only two copies of the layout
+static const char FRAME_BLOCK_GLSL[] =
+  "// per-pass constants shared by every program, written once per pass\n"
+  "layout(std140) uniform FrameBlock {\n"
+  "  mat4 view;\n"
+  "  mat4 projection;\n"
+  "  mat4 viewProj;\n"
+  "  mat4 lightSpaceMatrix;\n"
+  "  vec3 viewPos;\n"
+  "  float time;\n"
+  "  vec4 viewport; // x, y, width, height\n"
+  "} frame;\n";
+
+// std140 layout of MaterialBlock in the shaders
+typedef struct {
+  glm::vec3 ambient;
+  float shininess;
+  glm::vec3 diffuse;
+  float pad0;
+  glm::vec3 specular;
+  float pad1;
+} MaterialConstants;
+
 typedef struct {
   Mesh *mesh; // vertex array object, created with createMesh
   Material *mat; // material created with createMaterial
@@ -69,13 +153,34 @@ typedef struct {
   float angle;
 } GameObject;
 
+// point lights as parallel arrays; light i is drawn as the cube entity cubes[i]
 typedef struct {
-  GameObject *gameObject;
-  float height;
-  float constant;
-  float linear;
-  float quadratic;
-} PointLight;
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> ambient;
+  std::vector<glm::vec3> diffuse;
+  std::vector<glm::vec3> specular;
+  std::vector<float> heights;
+  std::vector<float> radii; // the rest is animateLights' per-light motion, fixed at addPointLight
+  std::vector<float> orbitRates;
+  std::vector<float> bobRates;
+  std::vector<glm::vec3> colorRates;
+  std::vector<float> constants;
+  std::vector<float> linears;
+  std::vector<float> quadratics;
+  std::vector<EntityHandle> cubes;
+} PointLights;
+
+// everything drawn through the entity store; meshes and materials are referenced by id
+typedef struct {
+  EntityStore entities;
+  InstanceBuffer *instances; // entities.transforms, uploaded once per frame
+  std::vector<StaticChunk> staticChunks; // everything that never moves, baked at load time
+  VoxelWorld *voxels;
+  unsigned int voxelMaterialId;
+  std::vector<Mesh *> meshes; // indexed by mesh id
+  std::vector<Material *> materials; // indexed by Material::id
+  bool cullEntities; // off when the cpu's transforms aren't the ones drawn (--gpu-animation)
+} Scene;
 
 typedef struct {
   glm::vec3 specular;
@@ -88,11 +193,113 @@ typedef struct {
   Camera* cam;
 } GameContext;
 
+// one point on a scripted fly-through: where the camera is at `time` and what it looks at
+typedef struct {
+  float time;
+  glm::vec3 pos;
+  glm::vec3 target;
+} CameraKey;
+
+// a run of neighbouring entities that go out as one instanced draw
+typedef struct {
+  Material *mat;
+  unsigned int first;
+  unsigned int count;
+} DrawRun;
+
+// every run of one pass that shares a mesh and material, as a stretch of indirect commands
+typedef struct {
+  Material *mat;
+  unsigned int meshId;
+  unsigned int firstCommand;
+  unsigned int numCommands;
+} DrawBatch;
+
+// everything that changes from frame to frame, as the main thread saw it once the frame
+// was simulated. The render thread draws from this alone (plus scene data that's fixed
+// after setup), so the main thread can get on with the next frame meanwhile. Every
+// array lives in the packet's own arena.
+typedef struct {
+  FrameArena *arena;
+  FrameConstants passes[2]; // indexed by FOR_REAL/FOR_DEPTH, viewProj included
+  float nearPlane; // of the shadow projection, for the debug quad
+  float farPlane;
+  int lightsUsed; // active lights; their cubes are all drawn
+  glm::vec3 *lightPositions; // lightsUsed of each
+  glm::vec3 *lightAmbient;
+  glm::vec3 *lightDiffuse;
+  glm::vec3 *lightSpecular;
+  unsigned int *shadedLights; // the numShaded lights worth shading this frame, in no particular order
+  int numShaded;
+  glm::vec3 ambientFill; // rough stand-in for the active lights that didn't make the cut
+  InstanceTransform *transforms; // entity transforms [changedFirst, changedEnd)
+  unsigned int changedFirst;
+  unsigned int changedEnd;
+  unsigned int numEntities;
+  DrawRun *runs[2]; // entity draws, per pass, after culling
+  unsigned int numRuns[2];
+  DrawBatch *batches[2]; // the same runs regrouped by mesh and material, per pass
+  unsigned int numBatches[2];
+  DrawArraysIndirectCommand *commands; // one per run, both passes, in batch order
+  unsigned int numCommands;
+  double inputTime; // FramePacer::now() when this frame's input was read
+  bool showOverdraw; // draw the overdraw heat map instead of the lit scene
+  bool quit; // last packet; the render thread stops instead of drawing it
+} FramePacket;
+
+// GL-side state for drawing frame packets. Whichever thread runs renderFrame must have
+// the context current; in threaded mode nothing else touches GL until it's done.
+typedef struct {
+  GLFWwindow *window;
+  Scene *scene;
+  GameObject *skybox;
+  PointLights *pointLights; // only the parts fixed after setup: attenuations and cube handles
+  DirLight *dirLight;
+  ShaderVariants *lightingVariants;
+  Shader *debugDepthShader;
+  Material *depthMaterial;
+  EntityHandle debugQuad;
+  UniformBuffer *passConstants;
+  InstanceBuffer *identityInstance;
+  unsigned int depthMapFBO;
+  unsigned int depthMap;
+  unsigned int skyboxTexture;
+  unsigned int voxelTextures;
+  FrameHandoff<FramePacket, PACKETS_IN_FLIGHT> *packets;
+  FramePacer *pacer;
+  DynamicResolution *resolution; // the main pass is drawn through this
+  Shader *upscaleShader;
+  PointShadowAtlas *pointShadows; // NULL when point lights don't cast shadows
+  Shader *pointShadowShader; // depth into all six faces of one light's atlas block
+  SoftRasterizer *soft; // --software: the cpu draws the frame and GL only puts it on screen
+  std::vector<SoftMaterial> softMaterials; // indexed by material id
+  std::vector<SoftMaterial> softLightCubes; // one per light, recolored every frame
+  std::vector<InstanceTransform> softTransforms; // every entity's, patched from each packet's changed range
+  unsigned int softTexture; // the cpu's image on its way to the window
+  unsigned int softFBO;
+  int softWidth;
+  int softHeight;
+  FrameRecorder *recorder; // --record: every frame is also read back and written out
+  GpuAnimator *animator; // --gpu-animation: lights and entity transforms are animated on the gpu
+  IndirectDraws *indirect; // how the packet's entity draw commands go out
+  ParticleSystem *particles; // NULL with --particles 0
+  DepthPrepass *prepass; // whether the main pass lays down depth before shading
+  PipelineStats *stats; // per-pass vertex/primitive/fragment counts
+  OverdrawHeatMap *heatMap; // the O key's debug view
+} Renderer;
+
+// long-lived scene structs come out of fixed pools instead of one malloc each
+static Pool<Material, MAX_NUM_OF_MATERIALS> materialPool;
+static Pool<Mesh, MAX_NUM_OF_MESHES> meshPool;
+static Pool<GameObject, MAX_NUM_OF_GAME_OBJECTS> gameObjectPool;
+
 Material* createMaterial(Shader *shader, int specularTexture, float shininess, int diffuseTexture, glm::vec3 ambientColor, int emissionValues, int emissionMap)
 {
-  Material* mat = (Material *)malloc(sizeof(Material));
+  Material* mat = materialPool.alloc();
 
   mat->shader = shader;
+  mat->variants = NULL;
+  mat->features = 0;
   mat->specularTexture = specularTexture;
   mat->shininess = 16.0f;
   mat->diffuseTexture = diffuseTexture;
@@ -104,18 +311,103 @@ Material* createMaterial(Shader *shader, int specularTexture, float shininess, i
   mat->diffuseColor = glm::vec3(1.0f);
   // unused for now:
   mat->ambientTexture = -1;
+  mat->constants = NULL;
+  mat->id = -1;
+  mat->dirty = true;
 
   return mat;
 };
 
+// switches a material over to shader permutations, only enabling the features its
+// textures can actually contribute (the blank texture is black, so it adds nothing)
+void useShaderVariants(Material *mat, ShaderVariants *variants, int blankTexture)
+{
+  mat->variants = variants;
+  mat->features |= SHADER_SHADOWS | SHADER_REFLECTION; // keeps bits set at creation, like SHADER_VOXEL
+
+  if (mat->specularTexture != blankTexture) {
+    mat->features |= SHADER_HAS_SPECULAR_MAP;
+  }
+
+  if (mat->emissionValues != blankTexture && mat->emissionMap != blankTexture) {
+    mat->features |= SHADER_HAS_EMISSION;
+  }
+}
+
+// the cheapest program that can draw this material in the current pass
+Shader *selectShader(Material *mat, unsigned int passFeatures)
+{
+  if (mat->variants == NULL) {
+    return mat->shader;
+  }
+
+  if (passFeatures & SHADER_DEPTH_ONLY) {
+    return mat->variants->get(SHADER_DEPTH_ONLY);
+  }
+
+  if (passFeatures & SHADER_OVERDRAW) {
+    return mat->variants->get(SHADER_OVERDRAW);
+  }
+
+  return mat->variants->get(mat->features | passFeatures);
+}
+
+// rounds the active light count up to one of a few array sizes so we don't build a variant per count
+unsigned int lightBucket(int numLights)
+{
+  if (numLights <= 4) {
+    return SHADER_LIGHTS(4);
+  } else if (numLights <= 16) {
+    return SHADER_LIGHTS(16);
+  }
+
+  return SHADER_LIGHTS(MAX_NUM_OF_LIGHTS);
+}
+
+void attachMaterialBuffer(Material *mat, UniformBuffer *constants)
+{
+  mat->constants = constants;
+  mat->id = constants->allocate();
+  mat->dirty = true;
+}
+
+// uploads the material's record if it changed and points MaterialBlock at it. Sampler
+// uniforms are program state, so they're only re-sent when this program last drew
+// a different material -- runs of the same material cost nothing.
+void bindMaterial(Material *mat, Shader *shader)
+{
+  if (mat->constants && mat->id >= 0) {
+    if (mat->dirty) {
+      MaterialConstants record;
+      record.ambient = mat->ambientColor;
+      record.shininess = mat->shininess;
+      record.diffuse = mat->diffuseColor;
+      record.specular = mat->specularColor;
+      record.pad0 = record.pad1 = 0.0f;
+      mat->constants->write(mat->id, &record, sizeof(record));
+      mat->dirty = false;
+    }
+
+    mat->constants->bindSlot(MATERIAL_BLOCK_BINDING, mat->id);
+  }
+
+  if (shader->currentMaterial != mat->id || mat->id < 0) {
+    shader->setInt("material.specular", mat->specularTexture);
+    shader->setInt("material.diffuse", mat->diffuseTexture);
+    shader->setInt("material.emission", mat->emissionValues);
+    shader->setInt("material.emission_map", mat->emissionMap);
+    shader->currentMaterial = mat->id;
+  }
+}
+
 void destroyMaterial(Material *mat)
 {
-  free(mat);
+  materialPool.release(mat);
 }
 
 GameObject* createGameObject(Mesh *mesh, Material *mat, glm::vec3 pos)
 {
-  GameObject *gameObject = (GameObject *)malloc(sizeof(GameObject));
+  GameObject *gameObject = gameObjectPool.alloc();
   gameObject->mesh = mesh;
   gameObject->mat = mat;
   gameObject->pos = pos;
@@ -127,82 +419,270 @@ GameObject* createGameObject(Mesh *mesh, Material *mat, glm::vec3 pos)
 
 void destroyGameObject(GameObject *gameObject)
 {
-  free(gameObject);
+  gameObjectPool.release(gameObject);
 }
 
-void renderGameObject(GameObject *gameObject, glm::mat4 view, glm::mat4 projection)
+unsigned int addMesh(Scene *scene, Mesh *mesh)
 {
-  Material *mat = gameObject->mat;
-  Shader *shader = mat->shader;
-  shader->use();
+  scene->meshes.push_back(mesh);
+  return scene->meshes.size() - 1;
+}
+
+// materials need their MaterialBlock record first; the record index doubles as the material id
+unsigned int addMaterial(Scene *scene, Material *mat)
+{
+  if (scene->materials.size() <= (unsigned int)mat->id) {
+    scene->materials.resize(mat->id + 1, NULL);
+  }
+
+  scene->materials[mat->id] = mat;
+  return mat->id;
+}
+
+// fills in the pass's FrameBlock record and makes it the one every program reads
+void setPassConstants(UniformBuffer *passConstants, int mode, const FrameConstants *constants)
+{
+  passConstants->write(mode, constants, sizeof(FrameConstants));
+  passConstants->bindSlot(FRAME_BLOCK_BINDING, mode);
+}
+
+// one instanced draw of entities [first, first + count), which must all share a mesh
+void drawEntities(Scene *scene, unsigned int first, unsigned int count)
+{
+  Mesh *mesh = scene->meshes[scene->entities.meshIds[first]];
+  glBindVertexArray(mesh->vao);
+  scene->instances->bindAttributes(first);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->size, count);
+}
+
+// false when the entity's bounding sphere is entirely outside the view
+bool entityVisible(Scene *scene, unsigned int i, const glm::mat4 &viewProj)
+{
+  const glm::mat4 &model = scene->entities.transforms[i].model;
+  float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+  glm::vec3 reach(scene->meshes[scene->entities.meshIds[i]]->radius * scale);
+  glm::vec3 centre(model[3]);
+  return boundsVisible(viewProj, centre - reach, centre + reach);
+}
+
+// collects this pass's entities into runs, in store order: neighbouring entities with the
+// same mesh and material share a run. Entities outside `cullViewProj` are left out when
+// it's given. The list lives in the frame packet's arena, so it's gone (and its memory
+// reused) once the packet is rebuilt.
+DrawRun *buildDrawList(Scene *scene, unsigned int passMask, const glm::mat4 *cullViewProj, FrameArena *arena, unsigned int *numRuns)
+{
+  EntityStore *entities = &scene->entities;
+  DrawRun *runs = arena->allocArray<DrawRun>(entities->size());
+  unsigned int i = 0;
+
+  *numRuns = 0;
+
+  if (runs == NULL) {
+    return NULL;
+  }
+
+  while (i < entities->size()) {
+    if (!(entities->passMasks[i] & passMask) || (cullViewProj && !entityVisible(scene, i, *cullViewProj))) {
+      i++;
+      continue;
+    }
+
+    unsigned int first = i++;
+    bool culled = false; // the run ended at an entity that's already known to be out of view
+
+    while (i < entities->size() && entities->passMasks[i] & passMask &&
+           entities->meshIds[i] == entities->meshIds[first] && entities->materialIds[i] == entities->materialIds[first]) {
+      if (cullViewProj && !entityVisible(scene, i, *cullViewProj)) {
+        culled = true;
+        break;
+      }
+
+      i++;
+    }
+
+    DrawRun *run = &runs[(*numRuns)++];
+    run->mat = scene->materials[entities->materialIds[first]];
+    run->first = first;
+    run->count = i - first;
+    i += culled ? 1 : 0;
+  }
+
+  return runs;
+}
+
+// regroups a pass's runs by mesh and material, however far apart culling left them, and
+// writes each run's indirect command into packet->commands so every group's commands sit
+// together. Batches come out in the order their first run did.
+DrawBatch *buildDrawBatches(Scene *scene, const DrawRun *runs, unsigned int numRuns, FramePacket *packet, unsigned int *numBatches)
+{
+  EntityStore *entities = &scene->entities;
+  DrawBatch *batches = packet->arena->allocArray<DrawBatch>(numRuns);
+  unsigned int *batchOf = packet->arena->allocArray<unsigned int>(numRuns);
+
+  *numBatches = 0;
+
+  if (batches == NULL || batchOf == NULL || packet->commands == NULL) {
+    return NULL;
+  }
+
+  for (unsigned int r = 0; r < numRuns; r++) {
+    unsigned int meshId = entities->meshIds[runs[r].first];
+    unsigned int b = 0;
+
+    while (b < *numBatches && (batches[b].mat != runs[r].mat || batches[b].meshId != meshId)) {
+      b++;
+    }
+
+    if (b == *numBatches) {
+      batches[b].mat = runs[r].mat;
+      batches[b].meshId = meshId;
+      batches[b].numCommands = 0;
+      (*numBatches)++;
+    }
+
+    batchOf[r] = b;
+    batches[b].numCommands++;
+  }
 
-  unsigned int modelLoc = glGetUniformLocation(shader->ID, "model");
-  unsigned int viewLoc = glGetUniformLocation(shader->ID, "view");
-  unsigned int projLoc = glGetUniformLocation(shader->ID, "projection");
+  for (unsigned int b = 0; b < *numBatches; b++) {
+    batches[b].firstCommand = packet->numCommands;
+    packet->numCommands += batches[b].numCommands;
+    batches[b].numCommands = 0;
+  }
+
+  for (unsigned int r = 0; r < numRuns; r++) {
+    DrawBatch *batch = &batches[batchOf[r]];
+    DrawArraysIndirectCommand *command = &packet->commands[batch->firstCommand + batch->numCommands++];
+    command->count = scene->meshes[batch->meshId]->size;
+    command->instanceCount = runs[r].count;
+    command->first = 0;
+    command->baseInstance = runs[r].first;
+  }
+
+  return batches;
+}
+
+// draws every entity in this pass, one multi-draw (or a short loop of instanced draws on
+// 4.1) per mesh and material; program switches only happen when neighbouring batches
+// need a different variant
+void renderEntities(Scene *scene, unsigned int passFeatures, FramePacket *packet, int mode, IndirectDraws *indirect)
+{
+  const DrawBatch *batches = packet->batches[mode];
+  Shader *shader = NULL;
+
+  for (unsigned int i = 0; i < packet->numBatches[mode]; i++) {
+    Shader *next = selectShader(batches[i].mat, passFeatures);
+
+    if (next != shader) {
+      shader = next;
+      shader->use();
+    }
+
+    bindMaterial(batches[i].mat, shader);
+    glBindVertexArray(scene->meshes[batches[i].meshId]->vao);
+    indirect->draw(packet->commands, batches[i].firstCommand, batches[i].numCommands, scene->instances);
+  }
+}
+
+// one draw per static chunk that's in this pass and inside the pass's view
+void renderStaticChunks(Scene *scene, unsigned int passFeatures, unsigned int passMask, const glm::mat4 &viewProj)
+{
+  Shader *shader = NULL;
+
+  for (unsigned int i = 0; i < scene->staticChunks.size(); i++) {
+    StaticChunk *chunk = &scene->staticChunks[i];
 
-  shader->setInt("material.specular", mat->specularTexture);
-  shader->setFloat("material.shininess", mat->shininess);
-  shader->setInt("material.diffuse", mat->diffuseTexture);
-  shader->setVec3f("material.ambient", mat->ambientColor.r, mat->ambientColor.g, mat->ambientColor.b);
-  shader->setInt("material.emission", mat->emissionValues);
-  shader->setInt("material.emission_map", mat->emissionMap);
+    if (!(chunk->passMask & passMask) || !boundsVisible(viewProj, chunk->boundsMin, chunk->boundsMax)) {
+      continue;
+    }
+
+    Material *mat = scene->materials[chunk->materialId];
+    Shader *next = selectShader(mat, passFeatures);
+
+    if (next != shader) {
+      shader = next;
+      shader->use();
+    }
+
+    bindMaterial(mat, shader);
+    glBindVertexArray(chunk->vao);
+    glDrawElements(GL_TRIANGLES, chunk->indexCount, GL_UNSIGNED_INT, 0);
+  }
+}
+
+// one draw per meshed voxel chunk in view; they all share the voxel material
+void renderVoxelChunks(Scene *scene, unsigned int passFeatures, const glm::mat4 &viewProj)
+{
+  VoxelWorld *world = scene->voxels;
+  Material *mat = scene->materials[scene->voxelMaterialId];
+  Shader *shader = selectShader(mat, passFeatures);
+  bool bound = false;
+
+  for (unsigned int i = 0; i < world->meshes.size(); i++) {
+    VoxelChunkMesh *mesh = &world->meshes[i];
 
-  glm::mat4 model = glm::translate(glm::mat4(1.0f), gameObject->pos);
-  model = glm::rotate(model, gameObject->angle, gameObject->rot);
-  model = glm::scale(model, gameObject->scale);
+    if (mesh->indexCount == 0 || !boundsVisible(viewProj, world->chunkMin(i), world->chunkMax(i))) {
+      continue;
+    }
 
-  glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-  glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-  glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    if (!bound) {
+      bound = true;
+      shader->use();
+      bindMaterial(mat, shader);
+    }
 
-  glBindVertexArray(gameObject->mesh->vao);
-  glDrawArrays(GL_TRIANGLES, 0, gameObject->mesh->size);
+    glBindVertexArray(mesh->vao);
+    glDrawElements(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, 0);
+  }
 }
 
-void renderSkybox(GameObject *skybox, glm::mat4 view, glm::mat4 projection)
+void renderSkybox(GameObject *skybox)
 {
   Shader *shader = skybox->mat->shader;
   shader->use();
 
+  // the shader strips the translation out of the pass's view matrix itself
   glDepthMask(GL_FALSE);
-  glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
-  unsigned int skyboxViewLoc = glGetUniformLocation(shader->ID, "view");
-  unsigned int skyboxProjLoc = glGetUniformLocation(shader->ID, "projection");
-  glUniformMatrix4fv(skyboxViewLoc, 1, GL_FALSE, glm::value_ptr(skyboxView));
-  glUniformMatrix4fv(skyboxProjLoc, 1, GL_FALSE, glm::value_ptr(projection));
   glBindVertexArray(skybox->mesh->vao);
   glDrawArrays(GL_TRIANGLES, 0, skybox->mesh->size);
   glDepthMask(GL_TRUE);
 }
 
-void renderWalls(GameObject *wall, glm::mat4 view, glm::mat4 projection)
+// bakes one immovable object into the static batches
+void addStaticObject(StaticBatchBuilder *builder, Mesh *mesh, unsigned int materialId, glm::vec3 pos, glm::vec3 scale)
+{
+  glm::vec3 axis(1.0f);
+  float angle = 0.0f;
+  InstanceTransform transform;
+
+  computeTransformsScalar(&pos, &axis, &angle, &scale, &transform, 1);
+  builder->add(mesh->vertices, mesh->size, transform, materialId, ALL_PASSES);
+}
+
+// what the static batches are drawn with, their vertices being in world space already
+InstanceTransform identityTransform()
+{
+  InstanceTransform identity;
+  identity.model = glm::mat4(1.0f);
+  identity.normalMatrix[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+  identity.normalMatrix[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+  identity.normalMatrix[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+  return identity;
+}
+
+// the castle walls never move, so they're baked into the static batches at startup
+void createWalls(StaticBatchBuilder *builder, Mesh *mesh, unsigned int materialId)
 {
   for (unsigned int i = 0; i < 50; i++) {
     for (unsigned int j = 0; j < 50; j++) {
-      glm::mat4 model = glm::mat4(1.0f);
-      // setting the position of the wall cubes on the CPU
-      model = glm::translate(model, glm::vec3(-25.0f, 0.0f, -25.0f));
-      model = glm::translate(model, glm::vec3((float)i, 0.0f, (float)j));
-
-      // pull translation from model matrix
-      wall->pos = glm::vec3(model[3]);
+      glm::vec3 pos = glm::vec3(-25.0f, 0.0f, -25.0f) + glm::vec3((float)i, 0.0f, (float)j);
 
       if (i == 0 || j == 0 || i == 49 - 1 || j == 49 - 1) {
-        renderGameObject(wall, view, projection);
-        // setting the position of the wall cubes on the GPU
-        // glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        // rendering
-        // glDrawArrays(GL_TRIANGLES, 0, 36);
+        addStaticObject(builder, mesh, materialId, pos, glm::vec3(1.0f));
 
         if (((i == 0 || i == 49 - 1) && j % 2 == 0) || ((j == 0 || j == 49 - 1) && i % 2 == 0)) {
-          // generating some extra cubes for a castle crenellation effect; CPU side
-          model = glm::translate(model, glm::vec3(0.0f, 1.0f, 0.0f));
-          wall->pos = glm::vec3(model[3]);
-          renderGameObject(wall, view, projection);
-          // gpu side
-          // glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-          // rendering
-          // glDrawArrays(GL_TRIANGLES, 0, 36);
+          // generating some extra cubes for a castle crenellation effect
+          addStaticObject(builder, mesh, materialId, pos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f));
         }
       }
     }
@@ -233,6 +713,8 @@ void setupCam(Camera* cam)
   cam->pitch = 0.0f;
   cam->yaw = -90.0f;
   cam->lightsUsedControl = 1.0f;
+  cam->showOverdraw = false;
+  cam->overdrawKeyDown = false;
 }
 
 void processCamera(Camera* cam, float deltaTime, float currentFrame)
@@ -306,6 +788,80 @@ void processCamera(Camera* cam, float deltaTime, float currentFrame)
   cam->front = glm::normalize(direction);
 }
 
+// reads a fly-through for --camera-path: a "time x y z targetX targetY targetZ" line per
+// key, in time order; anything after a # is ignored
+bool loadCameraPath(const char *path, std::vector<CameraKey> *keys)
+{
+  FILE *file = fopen(path, "r");
+
+  if (!file) {
+    printf("can't open camera path %s\n", path);
+    return false;
+  }
+
+  char line[256];
+
+  while (fgets(line, sizeof(line), file)) {
+    char *comment = strchr(line, '#');
+
+    if (comment) {
+      *comment = '\0';
+    }
+
+    CameraKey key;
+
+    if (sscanf(line, "%f %f %f %f %f %f %f", &key.time, &key.pos.x, &key.pos.y, &key.pos.z,
+               &key.target.x, &key.target.y, &key.target.z) == 7) {
+      keys->push_back(key);
+    }
+  }
+
+  fclose(file);
+  printf("camera path %s: %u keys over %.2f s\n", path, (unsigned int)keys->size(), keys->empty() ? 0.0f : keys->back().time);
+  return !keys->empty();
+}
+
+glm::vec3 catmullRom(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t)
+{
+  return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t * t +
+                 (3.0f * p1 - p0 - 3.0f * p2 + p3) * t * t * t);
+}
+
+// puts the camera wherever the path has it at `time`: a smooth curve through the keys
+// (holding the last one once they run out), or with no keys a slow lap inside the walls
+void followCameraPath(Camera *cam, const std::vector<CameraKey> *keys, float time)
+{
+  glm::vec3 pos;
+  glm::vec3 target;
+
+  if (keys->empty()) {
+    float angle = time * 0.25f;
+    pos = glm::vec3(sin(angle) * 14.0f, 2.5f + sin(time * 0.5f), cos(angle) * 14.0f);
+    target = glm::vec3(0.0f, 1.0f, -3.0f);
+  } else {
+    unsigned int last = keys->size() - 1;
+    unsigned int i = 0;
+
+    while (i < last && (*keys)[i + 1].time <= time) {
+      i++;
+    }
+
+    const CameraKey *k0 = &(*keys)[i > 0 ? i - 1 : 0];
+    const CameraKey *k1 = &(*keys)[i];
+    const CameraKey *k2 = &(*keys)[i < last ? i + 1 : last];
+    const CameraKey *k3 = &(*keys)[i + 1 < last ? i + 2 : last];
+    float span = k2->time - k1->time;
+    float t = span > 0.0f ? glm::clamp((time - k1->time) / span, 0.0f, 1.0f) : 0.0f;
+    pos = catmullRom(k0->pos, k1->pos, k2->pos, k3->pos, t);
+    target = catmullRom(k0->target, k1->target, k2->target, k3->target, t);
+  }
+
+  cam->pos = pos;
+  cam->front = glm::normalize(target - pos);
+  cam->pitch = glm::degrees(asin(cam->front.y));
+  cam->yaw = glm::degrees(atan2(cam->front.z, cam->front.x));
+}
+
 void changeCameraAngles(Camera *cam, float xoffset, float yoffset)
 {
   cam->yaw   += xoffset;
@@ -321,72 +877,82 @@ void changeCameraAngles(Camera *cam, float xoffset, float yoffset)
   }
 }
 
-void sendPointLightColors(Shader *shader, PointLight **lights, int numOfLights)
+// the shaders' pointLights[j] is the packet's shadedLights[j]
+void sendPointLightColors(Shader *shader, FramePacket *packet)
 {
   char fieldName[32] = "pointLights";
   char formattedSpecifier[32];
 
-  for (int i = 0; i < numOfLights; i++) {
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "ambient");
-    shader->setVec3f(formattedSpecifier, lights[i]->gameObject->mat->ambientColor.r, lights[i]->gameObject->mat->ambientColor.g, lights[i]->gameObject->mat->ambientColor.b);
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "diffuse");
-    shader->setVec3f(formattedSpecifier, lights[i]->gameObject->mat->diffuseColor.r, lights[i]->gameObject->mat->diffuseColor.g, lights[i]->gameObject->mat->diffuseColor.b);
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "specular");
-    shader->setVec3f(formattedSpecifier, lights[i]->gameObject->mat->specularColor.r, lights[i]->gameObject->mat->specularColor.g, lights[i]->gameObject->mat->specularColor.b);
+  for (int j = 0; j < packet->numShaded; j++) {
+    int i = packet->shadedLights[j];
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "ambient");
+    shader->setVec3f(formattedSpecifier, packet->lightAmbient[i].r, packet->lightAmbient[i].g, packet->lightAmbient[i].b);
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "diffuse");
+    shader->setVec3f(formattedSpecifier, packet->lightDiffuse[i].r, packet->lightDiffuse[i].g, packet->lightDiffuse[i].b);
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "specular");
+    shader->setVec3f(formattedSpecifier, packet->lightSpecular[i].r, packet->lightSpecular[i].g, packet->lightSpecular[i].b);
   }
 }
 
-void sendPointLightPositions(Shader *shader, PointLight **lights, int numOfLights)
+void sendPointLightPositions(Shader *shader, FramePacket *packet)
 {
   char fieldName[32] = "pointLights";
   char formattedSpecifier[32];
 
-  for (int i = 0; i < numOfLights; i++) {
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "pos");
-    shader->setVec3f(formattedSpecifier, lights[i]->gameObject->pos.x, lights[i]->gameObject->pos.y, lights[i]->gameObject->pos.z);
+  for (int j = 0; j < packet->numShaded; j++) {
+    int i = packet->shadedLights[j];
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "pos");
+    shader->setVec3f(formattedSpecifier, packet->lightPositions[i].x, packet->lightPositions[i].y, packet->lightPositions[i].z);
   }
 }
 
-void sendPointLightAttenuations(Shader *shader, PointLight **lights, int numOfLights)
+void sendPointLightAttenuations(Shader *shader, PointLights *lights, FramePacket *packet)
 {
   char fieldName[32] = "pointLights";
   char formattedSpecifier[32];
 
-  for (int i = 0; i < numOfLights; i++) {
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "linear");
-    shader->setFloat(formattedSpecifier, lights[i]->linear);
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "constant");
-    shader->setFloat(formattedSpecifier, lights[i]->constant);
-    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, i, "quadratic");
-    shader->setFloat(formattedSpecifier, lights[i]->quadratic);
+  for (int j = 0; j < packet->numShaded; j++) {
+    int i = packet->shadedLights[j];
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "linear");
+    shader->setFloat(formattedSpecifier, lights->linears[i]);
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "constant");
+    shader->setFloat(formattedSpecifier, lights->constants[i]);
+    snprintf(formattedSpecifier, 32, "%s[%d].%s", fieldName, j, "quadratic");
+    shader->setFloat(formattedSpecifier, lights->quadratics[i]);
   }
 }
 
-PointLight *createPointLight(Mesh *mesh, Material *mat, glm::vec3 pos)
-{
-  PointLight *light = (PointLight *)malloc(sizeof(PointLight));
-  light->gameObject = createGameObject(mesh, mat, pos);
-  light->height = light->gameObject->pos.y;
-  light->gameObject->mat->specularColor = glm::vec3(1.0f);
-  light->gameObject->mat->diffuseColor = light->gameObject->mat->specularColor * 0.65f;
-  light->gameObject->mat->ambientColor = light->gameObject->mat->specularColor * 0.3f;
-  light->constant = 1.0f;
-  light->linear = 0.09f;
-  light->quadratic = 0.016f;
-  return light;
-}
-
-void destroyPointLight(PointLight *pointLight)
+void updatePointLightColor(PointLights *lights, int i, glm::vec3 color)
 {
-  destroyGameObject(pointLight->gameObject);
-  free(pointLight);
+  lights->specular[i] = color;
+  lights->diffuse[i] = color * 0.65f;
+  lights->ambient[i] = color * 0.3f;
 }
 
-void updatePointLightColor(PointLight *light, glm::vec3 color)
+// adds a light and the cube entity that shows where it is; cubes are drawn by
+// renderPointLightCubes rather than the regular entity passes
+void addPointLight(PointLights *lights, EntityStore *entities, unsigned int meshId, unsigned int materialId, glm::vec3 pos)
 {
-  light->gameObject->mat->specularColor = color;
-  light->gameObject->mat->diffuseColor = light->gameObject->mat->specularColor * 0.65f;
-  light->gameObject->mat->ambientColor = light->gameObject->mat->specularColor * 0.3f;
+  lights->positions.push_back(pos);
+  lights->ambient.push_back(glm::vec3(0.0f));
+  lights->diffuse.push_back(glm::vec3(0.0f));
+  lights->specular.push_back(glm::vec3(0.0f));
+  lights->heights.push_back(pos.y);
+  lights->constants.push_back(1.0f);
+  lights->linears.push_back(0.09f);
+  lights->quadratics.push_back(0.016f);
+  lights->cubes.push_back(entities->create(meshId, materialId, pos, 0));
+
+  int i = lights->positions.size() - 1;
+  lights->radii.push_back(sqrt(pos.x * pos.x + pos.z * pos.z));
+  lights->orbitRates.push_back((i % 11 + 1) / (2.0f + (i % 3) * 1.5f));
+  lights->bobRates.push_back((i % 11 + 1) / 5.0f);
+  lights->colorRates.push_back(glm::vec3((i % 7 + 1) * 0.15f, (i % 11 + 1) * 0.17f, (i % 9 + 1) * 0.13f));
+  updatePointLightColor(lights, i, glm::vec3(1.0f));
+
+  unsigned int cube = entities->indexOf(lights->cubes[i]);
+  entities->scales[cube] = glm::vec3(0.1f * (((i + 1) * 2) % 7));
+  entities->markDirty(cube);
 }
 
 void updateDirLightColor(DirLight *light, glm::vec3 color)
@@ -396,33 +962,108 @@ void updateDirLightColor(DirLight *light, glm::vec3 color)
   light->ambient = light->specular * 0.3f;
 }
 
-void updatePointLights(PointLight **pointLights, int lightsUsed)
+void updatePointLights(PointLights *lights, EntityStore *entities, int lightsUsed, float time)
 {
   // light placement -- this is updating their positions in the CPU and GPU, but not rendering the light cubes themselves
+  LightMotion motion = { &lights->radii[0], &lights->heights[0], &lights->orbitRates[0], &lights->bobRates[0], &lights->colorRates[0] };
+  animateLights(&motion, time, &lights->positions[0], &lights->ambient[0], &lights->diffuse[0], &lights->specular[0], lightsUsed);
+
   for (int i = 0; i < lightsUsed; i++) {
-    GameObject *localGameObj = pointLights[i]->gameObject;
-    localGameObj->scale = glm::vec3(0.1f * (((i + 1) * 2) % 7));
-    float distance = sqrt(localGameObj->pos.x * localGameObj->pos.x + localGameObj->pos.z * localGameObj->pos.z);
-    localGameObj->pos.x = distance * sin(glfwGetTime() * (i % 11 + 1) / (2.0f + (i % 3) * 1.5));
-    localGameObj->pos.y = pointLights[i]->height + sin(glfwGetTime() * (i % 11 + 1) / 5.0f) * 1.3f;
-    localGameObj->pos.z = distance * cos(glfwGetTime() * (i % 11 + 1) / (2.0f + (i % 3) * 1.5));
-    glm::vec3 lightColor;
-    lightColor.x = abs(sin(glfwGetTime() * (i % 7 + 1) * 0.15f));
-    lightColor.y = abs(sin(glfwGetTime() * (i % 11 + 1) * 0.17f));
-    lightColor.z = abs(sin(glfwGetTime() * (i % 9 + 1) * 0.13f));
-    updatePointLightColor(pointLights[i], lightColor);
+    unsigned int cube = entities->indexOf(lights->cubes[i]);
+    entities->positions[cube] = lights->positions[i];
+    entities->markDirty(cube);
+  }
+}
+
+// --gpu-animation: hands the animator everything it needs to animate the lights and the
+// entities from then on. Called once the scene is set up; light cubes follow their light.
+void setupGpuAnimation(GpuAnimator *animator, Scene *scene, PointLights *lights)
+{
+  EntityStore *entities = &scene->entities;
+  std::vector<GpuLightParams> lightParams(lights->positions.size());
+  std::vector<GpuEntityParams> entityParams(entities->size());
+
+  for (unsigned int i = 0; i < lightParams.size(); i++) {
+    lightParams[i].motion = glm::vec4(lights->radii[i], lights->heights[i], lights->orbitRates[i], lights->bobRates[i]);
+    lightParams[i].colorRate = lights->colorRates[i];
+    lightParams[i].attenuation = glm::vec4(lights->constants[i], lights->linears[i], lights->quadratics[i], 0.0f);
+  }
+
+  for (unsigned int i = 0; i < entityParams.size(); i++) {
+    unsigned int parent = entities->indexOf(entities->parents[i]);
+    entityParams[i].posAngle = glm::vec4(entities->positions[i], entities->baseAngles[i]);
+    entityParams[i].axisSpin = glm::vec4(entities->rotationAxes[i], entities->spinRates[i]);
+    entityParams[i].scaleParent = glm::vec4(entities->scales[i], parent == INVALID_ENTITY_INDEX ? GPU_ANIMATOR_NO_PARENT : (float)parent);
+    entityParams[i].light = glm::vec4(GPU_ANIMATOR_NO_LIGHT, 0.0f, 0.0f, 0.0f);
+  }
+
+  for (unsigned int i = 0; i < lights->cubes.size(); i++) {
+    entityParams[entities->indexOf(lights->cubes[i])].light.x = (float)i;
   }
+
+  animator->setLights(lightParams.data(), lightParams.size());
+  animator->setEntities(entityParams.data(), entityParams.size());
 }
 
-void renderPointLightCubes(Shader *lightCubeShader, PointLight **pointLights, int lightsUsed, glm::mat4 view, glm::mat4 projection)
+void renderPointLightCubes(Scene *scene, PointLights *lights, FramePacket *packet, GpuAnimator *animator)
 {
+  EntityStore *entities = &scene->entities;
+
   // iterating over the lights to render their models
-  for (int i = 0; i < lightsUsed; i++) {
-    // tell the lightCubeShader what's what
-    lightCubeShader->use();
-    lightCubeShader->setVec3f("light.specular", pointLights[i]->gameObject->mat->specularColor.r, pointLights[i]->gameObject->mat->specularColor.g, pointLights[i]->gameObject->mat->specularColor.b);
-    renderGameObject(pointLights[i]->gameObject, view, projection);
+  for (int i = 0; i < packet->lightsUsed; i++) {
+    unsigned int cube = entities->indexOf(lights->cubes[i]);
+    Shader *shader = scene->materials[entities->materialIds[cube]]->shader;
+
+    shader->use();
+
+    if (animator) {
+      shader->setInt("animatedLights", animator->lightTexture);
+      shader->setInt("lightIndex", i);
+    } else {
+      shader->setVec3f("lightColor", packet->lightSpecular[i].r, packet->lightSpecular[i].g, packet->lightSpecular[i].b);
+    }
+
+    drawEntities(scene, cube, 1);
+  }
+}
+
+// how far light i's shadows need to reach: where its attenuation drops to 1/POINT_SHADOW_CUTOFF
+float pointLightRange(PointLights *lights, int i)
+{
+  float a = lights->quadratics[i];
+  float b = lights->linears[i];
+  float c = lights->constants[i] - POINT_SHADOW_CUTOFF;
+  return (-b + sqrtf(b * b - 4.0f * a * c)) / (2.0f * a);
+}
+
+float pointLightAttenuation(PointLights *lights, int i, float distance)
+{
+  return 1.0f / (lights->constants[i] + lights->linears[i] * distance + lights->quadratics[i] * distance * distance);
+}
+
+// how much room a light gets in the shadow atlas, from a rough measure of how much its
+// shadows can matter on screen. Only crosses a threshold once it's 20% past it, so
+// lights hovering at one don't keep swapping blocks (which means redrawing them).
+int pointShadowTier(float score, int current)
+{
+  static const float thresholds[SHADOW_ATLAS_TIERS - 1] = { 8.0f, 3.0f };
+  int tier = SHADOW_ATLAS_TIERS - 1;
+
+  for (int t = SHADOW_ATLAS_TIERS - 2; t >= 0; t--) {
+    if (score > thresholds[t]) {
+      tier = t;
+    }
+  }
+
+  if (current != SHADOW_ATLAS_NO_TIER && tier != current) {
+    float boundary = thresholds[tier < current ? tier : current];
+
+    if (score < boundary * 1.2f && score > boundary / 1.2f) {
+      return current;
+    }
   }
+
+  return tier;
 }
 
 void setupDirLightDefaults(DirLight *light)
@@ -435,8 +1076,9 @@ void setupDirLightDefaults(DirLight *light)
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
+  // no glViewport here: this runs on the main thread, which may not own the context.
+  // The viewport is set every frame by whoever draws it.
   printf("famebuffer_size changed: %d, %d\n", width, height);
-  glViewport(0, 0, width, height);
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos)
@@ -507,9 +1149,19 @@ void processInput(GLFWwindow *window, Camera* cam)
       cam->lightsUsedControl = 0;
     }
   }
+
+  // O flips the overdraw heat map, once per press rather than every frame it's held
+  bool overdrawKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+
+  if (overdrawKey && !cam->overdrawKeyDown) {
+    cam->showOverdraw = !cam->showOverdraw;
+  }
+
+  cam->overdrawKeyDown = overdrawKey;
 }
 
-int loadTexture(int tex_number, const char *path)
+// `soft` gets a copy of the pixels when the software rasterizer is drawing; otherwise NULL
+int loadTexture(int tex_number, const char *path, SoftRasterizer *soft)
 {
   int width, height, nrChannels;
   unsigned int texture;
@@ -536,6 +1188,10 @@ int loadTexture(int tex_number, const char *path)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    if (soft) {
+      soft->addTexture(texture, width, height, nrChannels, data);
+    }
   } else {
     std::cout << "Failed to load texture" << std::endl;
   }
@@ -544,6 +1200,76 @@ int loadTexture(int tex_number, const char *path)
   return texture;
 }
 
+// every path becomes one layer of a 2D texture array; they all need the same size
+int loadTextureArray(int tex_number, const char **paths, int numLayers)
+{
+  int width, height, nrChannels;
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  std::cout << "loadTextureArray texture id set to: " << texture << " for " << numLayers << " layers" << std::endl;
+  glActiveTexture(GL_TEXTURE0 + tex_number);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+  for (int i = 0; i < numLayers; i++) {
+    unsigned char *data = stbi_load(paths[i], &width, &height, &nrChannels, 4);
+
+    if (data) {
+      if (i == 0) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width, height, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+      }
+
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    } else {
+      std::cout << "Failed to load texture array layer " << paths[i] << std::endl;
+    }
+
+    stbi_image_free(data);
+  }
+
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  return texture;
+}
+
+// rolling hills outside the castle; inside, the terrain stays just under the ground plane
+void fillTerrain(VoxelWorld *world)
+{
+  glm::ivec3 size = world->size();
+  unsigned int solid = 0;
+
+  for (int z = 0; z < size.z; z++) {
+    for (int x = 0; x < size.x; x++) {
+      glm::vec3 p = world->origin + glm::vec3(x + 0.5f, 0.0f, z + 0.5f);
+      float r = sqrtf(p.x * p.x + p.z * p.z);
+      float hills = r > 50.0f ? (r - 50.0f) * 0.35f * (0.6f + 0.4f * sinf(p.x * 0.07f) * cosf(p.z * 0.05f)) : 0.0f;
+      // with the world origin at y = -64.5, 63 rows tops out at -1.5, one under the plane
+      int height = 63 + (int)hills;
+
+      if (height > size.y) {
+        height = size.y;
+      }
+
+      for (int y = 0; y < height; y++) {
+        world->set(x, y, z, y == height - 1 ? VOXEL_GRASS : VOXEL_MOSS);
+      }
+
+      solid += height;
+    }
+  }
+
+  unsigned int bytes = 0;
+
+  for (unsigned int i = 0; i < world->chunks.size(); i++) {
+    bytes += world->chunks[i].bytes();
+  }
+
+  printf("voxel terrain: %u solid voxels in %u chunks, %u KB of voxel data\n", solid, (unsigned int)world->chunks.size(), bytes / 1024);
+}
+
 Mesh *createMesh(float *vertices, unsigned int numVertices, unsigned int array_size, int with_attributes)
 {
   unsigned int VAO;
@@ -581,18 +1307,26 @@ Mesh *createMesh(float *vertices, unsigned int numVertices, unsigned int array_s
     glEnableVertexAttribArray(0);
   }
 
-  Mesh *mesh = (Mesh *)malloc(sizeof(Mesh));
+  Mesh *mesh = meshPool.alloc();
   mesh->vao = VAO;
   mesh->size = numVertices;
+  mesh->vertices = vertices;
+  mesh->radius = 0.0f;
+
+  for (unsigned int i = 0; i < numVertices; i++) {
+    const float *v = vertices + i * (with_attributes == WITH_ATTRIBUTES ? 8 : 3);
+    mesh->radius = glm::max(mesh->radius, glm::length(glm::vec3(v[0], v[1], v[2])));
+  }
+
   return mesh;
 }
 
 void destroyMesh(Mesh *mesh)
 {
-  free(mesh);
+  meshPool.release(mesh);
 }
 
-unsigned int loadCubemap(int tex_number, std::vector<std::string> faces)
+unsigned int loadCubemap(int tex_number, std::vector<std::string> faces, SoftRasterizer *soft)
 {
   unsigned int textureID;
   glGenTextures(1, &textureID);
@@ -622,6 +1356,10 @@ unsigned int loadCubemap(int tex_number, std::vector<std::string> faces)
                     );
       }
 
+      if (soft && (nrChannels == 3 || nrChannels == 4)) {
+        soft->addCubemapFace(textureID, i, width, height, nrChannels, data);
+      }
+
       stbi_image_free(data);
     } else {
       std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
@@ -638,29 +1376,665 @@ unsigned int loadCubemap(int tex_number, std::vector<std::string> faces)
   return textureID;
 }
 
-void renderScene(GameObject *skybox, GameObject *wall, GameObject *plane, GameObject **flyingCubes, int numFlyingCubes, Shader *lightCubeShader, PointLight **pointLights, int lightsUsed, glm::mat4 view, glm::mat4 projection, int mode)
+// the static chunks, terrain and entities of one pass: everything that writes depth
+void renderOpaque(Scene *scene, unsigned int passFeatures, FramePacket *packet, int mode, IndirectDraws *indirect)
 {
-  if (mode == FOR_REAL) { // as opposed to FOR_DEPTH
-    renderSkybox(skybox, view, projection);
-  }
+  renderStaticChunks(scene, passFeatures, PASS_MASK(mode), packet->passes[mode].viewProj);
+  renderVoxelChunks(scene, passFeatures, packet->passes[mode].viewProj);
+  renderEntities(scene, passFeatures, packet, mode, indirect);
+}
+
+// the main pass's opaque geometry depth-only, with color writes off; the lit pass after
+// it tests GL_EQUAL against what this leaves
+void renderDepthPrepass(Renderer *renderer, FramePacket *packet)
+{
+  DynamicResolution *resolution = renderer->resolution;
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  renderer->prepass->beginCount(resolution->scaledWidth() * resolution->scaledHeight());
+  renderOpaque(renderer->scene, SHADER_DEPTH_ONLY, packet, FOR_REAL, renderer->indirect);
+  renderer->prepass->endCount();
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
 
-  renderWalls(wall, view, projection);
-  renderGameObject(plane, view, projection);
+// the main pass's opaque geometry with `passFeatures`: after the pre-pass if there was
+// one, and counted for DepthPrepass if there wasn't
+void renderMainOpaque(Renderer *renderer, FramePacket *packet, unsigned int passFeatures)
+{
+  bool prepassed = renderer->prepass->enabled;
 
-  for (int i = 0; i < numFlyingCubes; i++) {
-    renderGameObject(flyingCubes[i], view, projection);
+  if (prepassed) {
+    // the depth buffer already holds the nearest surface, so only its fragments get shaded
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  } else {
+    renderer->prepass->beginCount(renderer->resolution->scaledWidth() * renderer->resolution->scaledHeight());
   }
 
-  if (mode == FOR_REAL) {
-    renderPointLightCubes(lightCubeShader, pointLights, lightsUsed, view, projection);
+  renderOpaque(renderer->scene, passFeatures, packet, FOR_REAL, renderer->indirect);
+
+  if (prepassed) {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+  } else {
+    renderer->prepass->endCount();
   }
 }
 
-int main(int argc, char** argv)
+void renderScene(Renderer *renderer, FramePacket *packet, int mode)
 {
-  const int WINDOW_WIDTH = 1280;
-  const int WINDOW_HEIGHT = 720;
-  GLFWwindow* window;
+  Scene *scene = renderer->scene;
+
+  if (mode == FOR_DEPTH) { // as opposed to FOR_REAL
+    renderOpaque(scene, SHADER_DEPTH_ONLY, packet, FOR_DEPTH, renderer->indirect);
+    return;
+  }
+
+  renderSkybox(renderer->skybox);
+  renderMainOpaque(renderer, packet, lightBucket(packet->numShaded));
+  renderPointLightCubes(scene, renderer->pointLights, packet, renderer->animator);
+}
+
+// everything that casts shadows within `range` of `pos`, with whatever program is bound
+void renderPointShadowCasters(Scene *scene, FramePacket *packet, glm::vec3 pos, float range, IndirectDraws *indirect)
+{
+  glm::vec3 reachMin = pos - glm::vec3(range);
+  glm::vec3 reachMax = pos + glm::vec3(range);
+  VoxelWorld *world = scene->voxels;
+
+  for (unsigned int i = 0; i < scene->staticChunks.size(); i++) {
+    StaticChunk *chunk = &scene->staticChunks[i];
+
+    if (chunk->passMask & PASS_MASK(FOR_DEPTH) && boundsOverlap(chunk->boundsMin, chunk->boundsMax, reachMin, reachMax)) {
+      glBindVertexArray(chunk->vao);
+      glDrawElements(GL_TRIANGLES, chunk->indexCount, GL_UNSIGNED_INT, 0);
+    }
+  }
+
+  for (unsigned int i = 0; i < world->meshes.size(); i++) {
+    VoxelChunkMesh *mesh = &world->meshes[i];
+
+    if (mesh->indexCount > 0 && boundsOverlap(world->chunkMin(i), world->chunkMax(i), reachMin, reachMax)) {
+      glBindVertexArray(mesh->vao);
+      glDrawElements(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_INT, 0);
+    }
+  }
+
+  for (unsigned int i = 0; i < packet->numBatches[FOR_DEPTH]; i++) {
+    const DrawBatch *batch = &packet->batches[FOR_DEPTH][i];
+    glBindVertexArray(scene->meshes[batch->meshId]->vao);
+    indirect->draw(packet->commands, batch->firstCommand, batch->numCommands, scene->instances);
+  }
+}
+
+// sizes every shaded light's atlas block, works out which ones are out of date, and
+// redraws as many of those as this frame's budget allows. Blocks belong to lights, not
+// shader slots, so a light keeps its shadows while it stays in the shaded set.
+void renderPointShadows(Renderer *renderer, FramePacket *packet)
+{
+  PointShadowAtlas *atlas = renderer->pointShadows;
+  Scene *scene = renderer->scene;
+  PointLights *lights = renderer->pointLights;
+  FrameConstants *real = &packet->passes[FOR_REAL];
+  float priority[MAX_NUM_OF_LIGHTS];
+  unsigned int picked[MAX_NUM_OF_LIGHTS];
+  bool shaded[MAX_NUM_OF_LIGHTS] = { false };
+
+  for (int j = 0; j < packet->numShaded; j++) {
+    shaded[packet->shadedLights[j]] = true;
+  }
+
+  for (unsigned int i = 0; i < atlas->lights.size(); i++) {
+    priority[i] = 0.0f;
+
+    if (!shaded[i]) {
+      atlas->assign(i, SHADOW_ATLAS_NO_TIER);
+    }
+  }
+
+  for (int j = 0; j < packet->numShaded; j++) {
+    int i = packet->shadedLights[j];
+    glm::vec3 pos = packet->lightPositions[i];
+    glm::vec3 color = packet->lightSpecular[i];
+    float range = pointLightRange(lights, i);
+    float distance = glm::length(pos - real->viewPos);
+    float score = glm::max(color.r, glm::max(color.g, color.b)) * range / glm::max(distance, 1.0f);
+    PointShadowState *state = &atlas->lights[i];
+
+    atlas->assign(i, pointShadowTier(score, state->tier));
+
+    if (state->rendered && glm::length(pos - state->renderedPos) > 0.01f) {
+      atlas->invalidate(i);
+    }
+
+    // lights that can't reach anything on screen can wait
+    priority[i] = boundsVisible(real->viewProj, pos - glm::vec3(range), pos + glm::vec3(range)) ? score : 0.0f;
+  }
+
+  // casters that moved this frame. Only their new spot is checked: something that leaves a
+  // light's range in a single frame keeps its old shadow until the light is redrawn.
+  for (unsigned int k = packet->changedFirst; k < packet->changedEnd; k++) {
+    if (!(scene->entities.passMasks[k] & PASS_MASK(FOR_DEPTH))) {
+      continue;
+    }
+
+    glm::mat4 *model = &packet->transforms[k - packet->changedFirst].model;
+    glm::vec3 pos = glm::vec3((*model)[3]);
+    float extent = 0.87f * glm::max(glm::length(glm::vec3((*model)[0])),
+                                    glm::max(glm::length(glm::vec3((*model)[1])), glm::length(glm::vec3((*model)[2]))));
+
+    for (int j = 0; j < packet->numShaded; j++) {
+      PointShadowState *state = &atlas->lights[packet->shadedLights[j]];
+
+      if (state->rendered && glm::length(pos - state->renderedPos) < state->renderedFar + extent) {
+        atlas->invalidate(packet->shadedLights[j]);
+      }
+    }
+  }
+
+  unsigned int numPicked = atlas->plan(priority, atlas->lights.size(), POINT_SHADOW_BUDGET, picked);
+
+  for (unsigned int i = 0; i < numPicked; i++) {
+    unsigned int light = picked[i];
+    float range = pointLightRange(lights, light);
+    atlas->beginLight(light, packet->lightPositions[light], range, renderer->pointShadowShader);
+    renderPointShadowCasters(scene, packet, packet->lightPositions[light], range, renderer->indirect);
+  }
+
+  atlas->end();
+}
+
+void initFramePacket(FramePacket *packet)
+{
+  packet->arena = new FrameArena(FRAME_ARENA_SIZE);
+  packet->quit = false;
+}
+
+void destroyFramePacket(FramePacket *packet)
+{
+  delete packet->arena;
+}
+
+// copies one array of `count` vec3s into the packet's arena
+glm::vec3 *packVec3s(FrameArena *arena, const glm::vec3 *src, unsigned int count)
+{
+  glm::vec3 *dst = arena->allocArray<glm::vec3>(count);
+
+  if (dst != NULL && count > 0) {
+    memcpy(dst, src, count * sizeof(glm::vec3));
+  }
+
+  return dst;
+}
+
+// picks the lights worth shading this frame: every active light is scored by how much it
+// can add to what's on screen -- its brightness, attenuated by its distance from the
+// camera, and nothing at all if its range misses the view -- and the best `budget` are
+// kept. nth_element makes that linear in the number of lights. The rest are folded
+// into one ambient term, combined the way the shader combines point lights (max).
+void selectLights(FramePacket *packet, PointLights *lights, int budget)
+{
+  FrameConstants *real = &packet->passes[FOR_REAL];
+  float *scores = packet->arena->allocArray<float>(packet->lightsUsed);
+  unsigned int *order = packet->arena->allocArray<unsigned int>(packet->lightsUsed);
+
+  packet->shadedLights = order;
+  packet->numShaded = 0;
+  packet->ambientFill = glm::vec3(0.0f);
+
+  if (scores == NULL || order == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < packet->lightsUsed; i++) {
+    glm::vec3 pos = packet->lightPositions[i];
+    glm::vec3 color = packet->lightDiffuse[i];
+    float range = pointLightRange(lights, i);
+    float distance = glm::length(pos - real->viewPos);
+
+    order[i] = i;
+    scores[i] = 0.0f;
+
+    if (boundsVisible(real->viewProj, pos - glm::vec3(range), pos + glm::vec3(range))) {
+      scores[i] = glm::max(color.r, glm::max(color.g, color.b)) * pointLightAttenuation(lights, i, distance);
+    }
+  }
+
+  int numShaded = packet->lightsUsed < budget ? packet->lightsUsed : budget;
+
+  if (numShaded < packet->lightsUsed) {
+    std::nth_element(order, order + numShaded, order + packet->lightsUsed,
+                     [scores](unsigned int a, unsigned int b) { return scores[a] > scores[b]; });
+  }
+
+  // what's left over only gets what it would add right where the camera is
+  for (int k = numShaded; k < packet->lightsUsed; k++) {
+    unsigned int i = order[k];
+
+    if (scores[i] > 0.0f) {
+      float attenuation = pointLightAttenuation(lights, i, glm::length(packet->lightPositions[i] - real->viewPos));
+      packet->ambientFill = glm::max(packet->ambientFill, (packet->lightAmbient[i] + packet->lightDiffuse[i] * 0.5f) * attenuation);
+    }
+  }
+
+  packet->numShaded = numShaded;
+}
+
+// snapshots the simulated frame: both passes' cameras, the lights, whichever transforms
+// changed, and each pass's draw list. Runs on the main thread. The main pass's viewport is
+// the window's whole framebuffer; the renderer scales it down from there as it needs to.
+void buildFramePacket(FramePacket *packet, Scene *scene, PointLights *lights, int lightsUsed, int lightBudget, Camera *cam, float time, int viewportWidth, int viewportHeight)
+{
+  FrameArena *arena = packet->arena;
+  EntityStore *entities = &scene->entities;
+  FrameConstants *depth = &packet->passes[FOR_DEPTH];
+  FrameConstants *real = &packet->passes[FOR_REAL];
+
+  arena->reset();
+
+  // the packet's worst case grows with the scene: every entity's transform, plus a run,
+  // batch and command per entity in each pass. Growing happens here, before anything's
+  // allocated, so it only costs a malloc on the frames where the entity count goes up.
+  unsigned int perEntity = sizeof(InstanceTransform) +
+                           2 * (sizeof(DrawRun) + sizeof(DrawBatch) + sizeof(unsigned int) + sizeof(DrawArraysIndirectCommand));
+  arena->reserve(FRAME_ARENA_SIZE + entities->size() * perEntity);
+  packet->quit = false;
+  packet->showOverdraw = cam->showOverdraw;
+
+  // proj and view set up for depth buffer
+  packet->nearPlane = 10.0f;
+  packet->farPlane = 64.0f;
+  depth->projection = glm::ortho(-32.0f, 32.0f, -32.0f, 32.0f, packet->nearPlane, packet->farPlane);
+  depth->view = glm::lookAt(glm::vec3(-15.0f, 19.0f, -30.0f),
+                            glm::vec3(0.0f, 0.0f,  0.0f),
+                            glm::vec3(0.0f, 1.0f,  0.0f));
+  depth->lightSpaceMatrix = depth->projection * depth->view;
+  depth->viewProj = depth->lightSpaceMatrix;
+  depth->viewPos = cam->pos; // this is the "player cam pos" :/
+  depth->time = time;
+  depth->viewport = glm::vec4(0.0f, 0.0f, SHADOW_WIDTH, SHADOW_HEIGHT);
+
+  *real = *depth;
+  real->projection = glm::perspective(glm::radians(45.0f), (float)viewportWidth / viewportHeight, 0.1f, 100.0f);
+  real->view = glm::lookAt(cam->pos, cam->pos + cam->front, cam->up);
+  real->viewProj = real->projection * real->view;
+  real->viewport = glm::vec4(0.0f, 0.0f, viewportWidth, viewportHeight);
+
+  packet->lightsUsed = lightsUsed;
+  packet->lightPositions = packVec3s(arena, lights->positions.data(), lightsUsed);
+  packet->lightAmbient = packVec3s(arena, lights->ambient.data(), lightsUsed);
+  packet->lightDiffuse = packVec3s(arena, lights->diffuse.data(), lightsUsed);
+  packet->lightSpecular = packVec3s(arena, lights->specular.data(), lightsUsed);
+
+  if (packet->lightPositions == NULL || packet->lightAmbient == NULL || packet->lightDiffuse == NULL || packet->lightSpecular == NULL) {
+    packet->lightsUsed = 0;
+  }
+
+  selectLights(packet, lights, lightBudget);
+
+  packet->numEntities = entities->size();
+  packet->changedFirst = entities->changedFirst;
+  packet->changedEnd = entities->changedEnd;
+  packet->transforms = arena->allocArray<InstanceTransform>(packet->changedEnd - packet->changedFirst);
+
+  if (packet->transforms == NULL) {
+    // updateTransforms() already cleared these; marked again, they go out next frame
+    for (unsigned int i = packet->changedFirst; i < packet->changedEnd; i++) {
+      entities->markDirty(i);
+    }
+
+    packet->changedEnd = packet->changedFirst;
+  } else if (packet->changedEnd > packet->changedFirst) {
+    memcpy(packet->transforms, entities->transforms.data() + packet->changedFirst,
+           (packet->changedEnd - packet->changedFirst) * sizeof(InstanceTransform));
+  }
+
+  // only the main pass is culled: the depth pass's runs are also every point light's casters
+  packet->runs[FOR_REAL] = buildDrawList(scene, PASS_MASK(FOR_REAL), scene->cullEntities ? &real->viewProj : NULL, arena, &packet->numRuns[FOR_REAL]);
+  packet->runs[FOR_DEPTH] = buildDrawList(scene, PASS_MASK(FOR_DEPTH), NULL, arena, &packet->numRuns[FOR_DEPTH]);
+  packet->commands = arena->allocArray<DrawArraysIndirectCommand>(packet->numRuns[FOR_REAL] + packet->numRuns[FOR_DEPTH]);
+  packet->numCommands = 0;
+
+  for (int mode = FOR_REAL; mode <= FOR_DEPTH; mode++) {
+    packet->batches[mode] = buildDrawBatches(scene, packet->runs[mode], packet->numRuns[mode], packet, &packet->numBatches[mode]);
+  }
+}
+
+// the O key's view, in place of the main pass: the same opaque geometry, pre-pass and all,
+// counted per pixel and painted into the main pass's target as a heat map
+void renderOverdrawHeatMap(Renderer *renderer, FramePacket *packet)
+{
+  DynamicResolution *resolution = renderer->resolution;
+  renderer->heatMap->begin(resolution->scaledWidth(), resolution->scaledHeight());
+
+  if (renderer->prepass->enabled) {
+    renderDepthPrepass(renderer, packet);
+  }
+
+  renderMainOpaque(renderer, packet, SHADER_OVERDRAW);
+  renderer->heatMap->end();
+
+  resolution->bindTarget();
+  renderer->heatMap->draw();
+}
+
+// submits one frame packet: uploads, both passes and the swap
+void renderFrame(Renderer *renderer, FramePacket *packet)
+{
+  Scene *scene = renderer->scene;
+  DynamicResolution *resolution = renderer->resolution;
+  unsigned int bucket = lightBucket(packet->numShaded);
+  FrameConstants real = packet->passes[FOR_REAL];
+
+  // everything from here to the upscale counts against the gpu budget
+  resolution->begin((int)real.viewport.z, (int)real.viewport.w);
+  real.viewport = glm::vec4(0.0f, 0.0f, resolution->scaledWidth(), resolution->scaledHeight());
+  renderer->prepass->begin(packet->numShaded);
+
+  if (scene->voxels->update(renderer->identityInstance) > 0 && renderer->pointShadows) {
+    renderer->pointShadows->invalidateAll(); // terrain changed under them
+  }
+
+  scene->instances->update(packet->transforms, packet->changedFirst, packet->changedEnd - packet->changedFirst, packet->numEntities);
+
+  renderer->indirect->upload(packet->commands, packet->numCommands);
+
+  // --gpu-animation: the lights and every entity's transform are rebuilt on the gpu instead
+  if (renderer->animator) {
+    renderer->animator->animate(packet->passes[FOR_REAL].time, scene->instances);
+  }
+
+  // after the animation, so the emitters start from where their entities are this frame
+  if (renderer->particles) {
+    renderer->particles->simulate(packet->passes[FOR_REAL].time, packet->lightsUsed, scene->instances);
+  }
+
+  // point shadows first, so the tiles sent below are the ones drawn this frame
+  glm::vec4 shadowTiles[MAX_NUM_OF_LIGHTS];
+  renderer->stats->begin(PIPELINE_STATS_SHADOWS);
+
+  if (renderer->pointShadows) {
+    renderPointShadows(renderer, packet);
+
+    for (int j = 0; j < packet->numShaded; j++) {
+      shadowTiles[j] = renderer->pointShadows->tiles[packet->shadedLights[j]];
+    }
+  }
+
+  // lights begin -- every lit variant for the current light bucket gets this frame's uniforms
+  for (unsigned int i = 0; i < renderer->lightingVariants->count(); i++) {
+    ShaderVariant *variant = renderer->lightingVariants->at(i);
+
+    if (variant->features & (SHADER_DEPTH_ONLY | SHADER_OVERDRAW) || SHADER_LIGHTS_OF(variant->features) != SHADER_LIGHTS_OF(bucket)) {
+      continue;
+    }
+
+    Shader *lightingShader = variant->shader;
+    lightingShader->use(); // don't forget to activate the shader before setting uniforms!
+
+    if (!variant->configured) {
+      DirLight *dirLight = renderer->dirLight;
+      variant->configured = true;
+      lightingShader->setInt("skybox", renderer->skyboxTexture);
+      lightingShader->setInt("shadowMap", renderer->depthMap);
+      lightingShader->setInt("voxelTextures", renderer->voxelTextures);
+
+      if (renderer->pointShadows) {
+        lightingShader->setInt("pointShadowAtlas", renderer->pointShadows->texture);
+      }
+
+      if (renderer->animator) {
+        lightingShader->setInt("animatedLights", renderer->animator->lightTexture);
+      }
+
+      lightingShader->setVec3f("dirLight.dir", dirLight->dir.x, dirLight->dir.y, dirLight->dir.z);
+      lightingShader->setVec3f("dirLight.diffuse", dirLight->diffuse.r, dirLight->diffuse.g, dirLight->diffuse.b);
+      lightingShader->setVec3f("dirLight.ambient", dirLight->ambient.r, dirLight->ambient.g, dirLight->ambient.b);
+    }
+
+    lightingShader->setInt("lightsUsed", packet->numShaded);
+    lightingShader->setVec3f("ambientFill", packet->ambientFill.r, packet->ambientFill.g, packet->ambientFill.b);
+
+    if (!renderer->animator) {
+      sendPointLightColors(lightingShader, packet);
+      sendPointLightPositions(lightingShader, packet);
+      sendPointLightAttenuations(lightingShader, renderer->pointLights, packet);
+    }
+
+    if (renderer->pointShadows && packet->numShaded > 0) {
+      lightingShader->setVec4fv("pointShadowTiles", packet->numShaded, &shadowTiles[0][0]);
+    }
+  }
+
+  // for shadow mapping:
+  glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glBindFramebuffer(GL_FRAMEBUFFER, renderer->depthMapFBO);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  glCullFace(GL_FRONT);
+  setPassConstants(renderer->passConstants, FOR_DEPTH, &packet->passes[FOR_DEPTH]);
+  // render to depth buffer
+  renderScene(renderer, packet, FOR_DEPTH);
+  glCullFace(GL_BACK);
+  renderer->stats->end();
+
+  // the main pass goes to the offscreen target, at whatever size the budget allows
+  resolution->bindTarget();
+  glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the buffers
+  setPassConstants(renderer->passConstants, FOR_REAL, &real);
+  renderer->stats->begin(PIPELINE_STATS_MAIN);
+
+  if (packet->showOverdraw) {
+    renderOverdrawHeatMap(renderer, packet);
+  } else {
+    if (renderer->prepass->enabled) {
+      renderDepthPrepass(renderer, packet);
+    }
+
+    Shader *debugDepthShader = renderer->debugDepthShader;
+    debugDepthShader->use();
+    debugDepthShader->setFloat("near_plane", packet->nearPlane);
+    debugDepthShader->setFloat("far_plane", packet->farPlane);
+    glActiveTexture(GL_TEXTURE0 + renderer->depthMap);
+    glBindTexture(GL_TEXTURE_2D, renderer->depthMap);
+    bindMaterial(renderer->depthMaterial, debugDepthShader);
+    drawEntities(scene, scene->entities.indexOf(renderer->debugQuad), 1);
+    renderScene(renderer, packet, FOR_REAL);
+
+    // last in the pass: they're blended over everything and fade against its depth
+    if (renderer->particles) {
+      renderer->particles->draw(resolution->framebuffer(), resolution->scaledWidth(), resolution->scaledHeight());
+    }
+  }
+
+  renderer->stats->end();
+  resolution->end(renderer->upscaleShader);
+  renderer->stats->endFrame();
+
+  // queued behind the frame like any other command; it's picked up a few frames from now
+  if (renderer->recorder) {
+    renderer->recorder->capture(resolution->framebuffer());
+  }
+
+  /* Swap front and back buffers */
+  glfwSwapBuffers(renderer->window);
+  renderer->pacer->frameSwapped(packet->inputTime);
+}
+
+// the lighting shader's features for a material, as the software rasterizer takes them;
+// materials without variants (the light cubes) are drawn in a flat color
+SoftMaterial softMaterialFor(Material *mat)
+{
+  SoftMaterial soft;
+  soft.diffuseTexture = mat->diffuseTexture;
+  soft.specularTexture = mat->specularTexture;
+  soft.emissionValues = mat->emissionValues;
+  soft.emissionMap = mat->emissionMap;
+  soft.shininess = mat->shininess;
+  soft.specularMap = (mat->features & SHADER_HAS_SPECULAR_MAP) != 0;
+  soft.emission = (mat->features & SHADER_HAS_EMISSION) != 0;
+  soft.shadows = (mat->features & SHADER_SHADOWS) != 0;
+  soft.reflection = (mat->features & SHADER_REFLECTION) != 0;
+  soft.unlit = mat->variants == NULL;
+  soft.color = glm::vec3(1.0f);
+  return soft;
+}
+
+// hands one pass's geometry to the software rasterizer, culled the way renderScene culls it
+void softDrawScene(Renderer *renderer, FramePacket *packet, int mode)
+{
+  Scene *scene = renderer->scene;
+  EntityStore *entities = &scene->entities;
+  SoftRasterizer *soft = renderer->soft;
+  const InstanceTransform *transforms = renderer->softTransforms.data();
+  InstanceTransform identity = identityTransform();
+
+  for (unsigned int i = 0; i < scene->staticChunks.size(); i++) {
+    StaticChunk *chunk = &scene->staticChunks[i];
+
+    if (!(chunk->passMask & PASS_MASK(mode)) || !boundsVisible(packet->passes[mode].viewProj, chunk->boundsMin, chunk->boundsMax)) {
+      continue;
+    }
+
+    soft->draw(chunk->vertices.data(), chunk->indices.data(), chunk->indices.size(), identity, &renderer->softMaterials[chunk->materialId]);
+  }
+
+  for (unsigned int r = 0; r < packet->numRuns[mode]; r++) {
+    const DrawRun *run = &packet->runs[mode][r];
+
+    for (unsigned int i = run->first; i < run->first + run->count; i++) {
+      Mesh *mesh = scene->meshes[entities->meshIds[i]];
+      soft->draw(mesh->vertices, NULL, mesh->size, transforms[i], &renderer->softMaterials[entities->materialIds[i]]);
+    }
+  }
+
+  if (mode == FOR_REAL) {
+    for (int i = 0; i < packet->lightsUsed; i++) {
+      unsigned int cube = entities->indexOf(renderer->pointLights->cubes[i]);
+      Mesh *mesh = scene->meshes[entities->meshIds[cube]];
+      SoftMaterial *mat = &renderer->softLightCubes[i];
+      mat->color = packet->lightSpecular[i];
+      soft->draw(mesh->vertices, NULL, mesh->size, transforms[cube], mat);
+    }
+  }
+}
+
+// copies the software rasterizer's image into the window's framebuffer
+void presentSoftFrame(Renderer *renderer)
+{
+  SoftRasterizer *soft = renderer->soft;
+
+  glActiveTexture(GL_TEXTURE0 + renderer->softTexture);
+  glBindTexture(GL_TEXTURE_2D, renderer->softTexture);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, renderer->softFBO);
+
+  if (soft->width != renderer->softWidth || soft->height != renderer->softHeight) {
+    renderer->softWidth = soft->width;
+    renderer->softHeight = soft->height;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, soft->width, soft->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, soft->image.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->softTexture, 0);
+  } else {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, soft->width, soft->height, GL_RGBA, GL_UNSIGNED_BYTE, soft->image.data());
+  }
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+  glBlitFramebuffer(0, 0, soft->width, soft->height, 0, 0, soft->width, soft->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// renderFrame for --software: both passes are drawn on the cpu from the same packet,
+// and GL only copies the result to the window and swaps
+void softRenderFrame(Renderer *renderer, FramePacket *packet)
+{
+  SoftRasterizer *soft = renderer->soft;
+  PointLights *lights = renderer->pointLights;
+  DirLight *dirLight = renderer->dirLight;
+  FrameConstants *real = &packet->passes[FOR_REAL];
+  std::vector<InstanceTransform> *transforms = &renderer->softTransforms;
+
+  // the packet only carries what changed; everything else is still here from before
+  if (transforms->size() < packet->numEntities) {
+    transforms->resize(packet->numEntities);
+  }
+
+  if (packet->changedEnd > packet->changedFirst) {
+    memcpy(transforms->data() + packet->changedFirst, packet->transforms,
+           (packet->changedEnd - packet->changedFirst) * sizeof(InstanceTransform));
+  }
+
+  soft->beginShadowPass(packet->passes[FOR_DEPTH].viewProj);
+  softDrawScene(renderer, packet, FOR_DEPTH);
+  soft->endPass();
+
+  soft->viewPos = real->viewPos;
+  soft->lightSpaceMatrix = real->lightSpaceMatrix;
+  soft->dirLightDir = dirLight->dir;
+  soft->dirLightAmbient = dirLight->ambient;
+  soft->dirLightDiffuse = dirLight->diffuse;
+  soft->dirLightSpecular = glm::vec3(0.0f); // the GL path never sends dirLight.specular either
+  soft->numPointLights = packet->numShaded < SOFT_MAX_LIGHTS ? packet->numShaded : SOFT_MAX_LIGHTS;
+  soft->ambientFill = packet->ambientFill;
+  soft->skyboxTexture = renderer->skyboxTexture;
+
+  for (int j = 0; j < soft->numPointLights; j++) {
+    int i = packet->shadedLights[j];
+    SoftPointLight *light = &soft->pointLights[j];
+    light->pos = packet->lightPositions[i];
+    light->ambient = packet->lightAmbient[i];
+    light->diffuse = packet->lightDiffuse[i];
+    light->specular = packet->lightSpecular[i];
+    light->constant = lights->constants[i];
+    light->linear = lights->linears[i];
+    light->quadratic = lights->quadratics[i];
+  }
+
+  soft->beginMainPass((int)real->viewport.z, (int)real->viewport.w, real->viewProj);
+  softDrawScene(renderer, packet, FOR_REAL);
+  soft->endPass();
+
+  if (renderer->recorder) {
+    renderer->recorder->submit((const unsigned char *)soft->image.data());
+  }
+
+  presentSoftFrame(renderer);
+  glfwSwapBuffers(renderer->window);
+  renderer->pacer->frameSwapped(packet->inputTime);
+}
+
+// the render thread owns the context for as long as it runs and draws packets in the
+// order they were built, until it's handed the quit packet
+void renderThreadMain(Renderer *renderer)
+{
+  glfwMakeContextCurrent(renderer->window);
+
+  for (;;) {
+    FramePacket *packet = renderer->packets->beginRead();
+    bool quit = packet->quit;
+
+    if (quit) {
+      // nothing to draw
+    } else if (renderer->soft) {
+      softRenderFrame(renderer, packet);
+    } else {
+      renderFrame(renderer, packet);
+    }
+
+    renderer->packets->endRead();
+
+    if (quit) {
+      break;
+    }
+  }
+
+  glfwMakeContextCurrent(NULL);
+}
+
+int main(int argc, char** argv)
+{
+  const int WINDOW_WIDTH = 1280;
+  const int WINDOW_HEIGHT = 720;
+  GLFWwindow* window;
   GameContext game;
   Camera cam;
   int awesomeface_index = 4;
@@ -681,7 +2055,8 @@ int main(int argc, char** argv)
     glm::vec3(3.5f,  6.0f, -3.0f),
     glm::vec3(0.5f,  8.0f, -3.0f)
   };
-  PointLight **pointLights = (PointLight **)malloc(sizeof(PointLight *) * MAX_NUM_OF_LIGHTS);
+  Scene scene;
+  PointLights pointLights;
   int numFlyingCubes = 10;
   glm::vec3 cubePositions[] = {
     glm::vec3(0.0f,  0.0f,  0.0f),
@@ -695,8 +2070,126 @@ int main(int argc, char** argv)
     glm::vec3(1.5f,  0.2f, -1.5f),
     glm::vec3(-1.3f,  1.0f, -1.5f),
   };
-  GameObject **flyingCubes = (GameObject **)malloc(sizeof(GameObject *) * numFlyingCubes);
   DirLight dirLight;
+  bool renderThread = true; // --single-threaded simulates and draws each frame back to back
+  int swapInterval = 1; // --swap-interval N: 0 for no vsync, 1 for every vblank, ...
+  int targetFps = 0; // --fps N: limit the frame rate; 0 leaves it to vsync
+  int maxQueuedFrames = 2; // --max-queued-frames N: how far the gpu may fall behind; 0 for the driver's default
+  int lightBudget = 16; // --light-budget K: shade at most this many point lights per frame
+  float gpuBudgetMs = 14.0f; // --gpu-budget MS: drop the main pass's resolution to stay under this; 0 never does
+  bool pointShadows = true; // --no-point-shadows: only the directional light casts shadows
+  bool software = false; // --software: rasterize on the cpu, for machines without a real gpu
+  int startLights = 1; // --lights N: how many point lights are active to begin with
+  const char *recordDest = NULL; // --record DEST: render offline and write every frame out (see FrameRecorder)
+  RecordFormat recordFormat = RECORD_PNG; // --record-format png|raw|y4m; y4m by default when DEST is -
+  bool recordFormatSet = false;
+  int recordFrames = 600; // --record-frames N
+  int recordFps = 60; // --record-fps N: the fixed timestep, and the rate written into y4m
+  int recordWidth = WINDOW_WIDTH; // --record-size WxH
+  int recordHeight = WINDOW_HEIGHT;
+  const char *cameraPathFile = NULL; // --camera-path FILE: the fly-through to record; an orbit otherwise
+  bool gpuAnimation = false; // --gpu-animation: animate lights and entities in transform feedback passes
+  int numParticles = 65536; // --particles N: sparks and dust around the light cubes; 0 for none
+  int depthPrepass = DEPTH_PREPASS_AUTO; // --depth-prepass on|off|auto: lay down depth before the lit pass
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--single-threaded") == 0) {
+      renderThread = false;
+    } else if (strcmp(argv[i], "--swap-interval") == 0 && i + 1 < argc) {
+      swapInterval = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      targetFps = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-queued-frames") == 0 && i + 1 < argc) {
+      maxQueuedFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc) {
+      gpuBudgetMs = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--light-budget") == 0 && i + 1 < argc) {
+      lightBudget = atoi(argv[++i]);
+      lightBudget = lightBudget < 0 ? 0 : lightBudget > MAX_NUM_OF_LIGHTS ? MAX_NUM_OF_LIGHTS : lightBudget;
+    } else if (strcmp(argv[i], "--no-point-shadows") == 0) {
+      pointShadows = false;
+    } else if (strcmp(argv[i], "--software") == 0) {
+      software = true;
+    } else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc) {
+      startLights = atoi(argv[++i]);
+      startLights = startLights < 0 ? 0 : startLights > MAX_NUM_OF_LIGHTS ? MAX_NUM_OF_LIGHTS : startLights;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordDest = argv[++i];
+    } else if (strcmp(argv[i], "--record-format") == 0 && i + 1 < argc) {
+      i++;
+      recordFormatSet = true;
+      recordFormat = strcmp(argv[i], "raw") == 0 ? RECORD_RAW : strcmp(argv[i], "y4m") == 0 ? RECORD_Y4M : RECORD_PNG;
+    } else if (strcmp(argv[i], "--record-frames") == 0 && i + 1 < argc) {
+      recordFrames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--record-fps") == 0 && i + 1 < argc) {
+      recordFps = atoi(argv[++i]);
+      recordFps = recordFps > 0 ? recordFps : 60;
+    } else if (strcmp(argv[i], "--record-size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &recordWidth, &recordHeight) != 2 || recordWidth <= 0 || recordHeight <= 0) {
+        recordWidth = WINDOW_WIDTH;
+        recordHeight = WINDOW_HEIGHT;
+      }
+    } else if (strcmp(argv[i], "--camera-path") == 0 && i + 1 < argc) {
+      cameraPathFile = argv[++i];
+    } else if (strcmp(argv[i], "--gpu-animation") == 0) {
+      gpuAnimation = true;
+    } else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+      numParticles = atoi(argv[++i]);
+      numParticles = numParticles < 0 ? 0 : numParticles;
+    } else if (strcmp(argv[i], "--depth-prepass") == 0 && i + 1 < argc) {
+      i++;
+      depthPrepass = strcmp(argv[i], "on") == 0 ? DEPTH_PREPASS_ON : strcmp(argv[i], "off") == 0 ? DEPTH_PREPASS_OFF : DEPTH_PREPASS_AUTO;
+    }
+  }
+
+  cam.lightsUsedControl = (float)startLights;
+
+  // recording runs as fast as it can draw, at full resolution, on a fixed timestep: the
+  // clock, the limiter and vsync are all out of the picture, and so is the window
+  std::vector<CameraKey> cameraPath;
+
+  if (recordDest) {
+    if (!recordFormatSet && strcmp(recordDest, "-") == 0) {
+      recordFormat = RECORD_Y4M;
+    }
+
+    if (recordFormat == RECORD_PNG && strcmp(recordDest, "-") == 0) {
+      printf("png frames can't go to stdout; use --record-format raw or y4m\n");
+      return -1;
+    }
+
+    if (cameraPathFile && !loadCameraPath(cameraPathFile, &cameraPath)) {
+      return -1;
+    }
+
+    swapInterval = 0;
+    targetFps = 0;
+    gpuBudgetMs = 0.0f;
+  }
+
+  // the software rasterizer takes copies of the textures as they load; it shades point
+  // lights without shadows and leaves out the voxel terrain
+  SoftRasterizer *softRaster = NULL;
+
+  if (software) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    softRaster = new SoftRasterizer(cores > 1 ? cores - 1 : 1);
+    pointShadows = false;
+
+    if (gpuAnimation) {
+      printf("--gpu-animation needs a gpu; animating on the cpu\n");
+      gpuAnimation = false;
+    }
+
+    numParticles = 0; // they only ever exist in gl buffers
+  }
+
+  // with the lights only ever on the gpu, the cpu can't tell which ones matter or where to
+  // draw their shadows from: every active light is shaded, and none cast shadows
+  if (gpuAnimation) {
+    pointShadows = false;
+    lightBudget = MAX_NUM_OF_LIGHTS;
+  }
 
   setupDirLightDefaults(&dirLight);
 
@@ -713,6 +2206,10 @@ int main(int argc, char** argv)
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
+  if (recordDest) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  }
+
   window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Hello Triangle", NULL, NULL);
 
   if (window == NULL) {
@@ -729,6 +2226,7 @@ int main(int argc, char** argv)
     return -1;
   }
 
+  glfwSwapInterval(swapInterval);
   glfwSetWindowUserPointer(window, (void *)&game);
 
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
@@ -736,6 +2234,25 @@ int main(int argc, char** argv)
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
   glEnable(GL_DEPTH_TEST);
 
+  sharedShaderDeclarations() = FRAME_BLOCK_GLSL; // before any program is built
+
+  // shaders are submitted first so the driver compiles them while we decode textures
+  ShaderBatch shaderBatch((GLADloadproc)glfwGetProcAddress);
+  ShaderVariants lightingVariants("shaders/lighting_shader.vs", "shaders/lighting_shader.fs", &shaderBatch);
+  Shader lightCubeShader("shaders/light_cube_shader.vs", "shaders/light_cube_shader.fs", ShaderVariants::defines(gpuAnimation ? SHADER_GPU_LIGHTS : 0));
+  Shader skyboxShader("shaders/skybox_shader.vs", "shaders/skybox_shader.fs");
+  Shader debugDepthShader("shaders/lighting_shader.vs", "shaders/debug_quad.fs", ShaderVariants::defines(SHADER_DEPTH_ONLY));
+  shaderBatch.add(&lightCubeShader);
+  shaderBatch.add(&skyboxShader);
+  Shader upscaleShader("shaders/upscale.vs", "shaders/upscale.fs");
+  Shader overdrawHeatShader("shaders/upscale.vs", "shaders/overdraw_heat.fs");
+  shaderBatch.add(&debugDepthShader);
+  Shader pointShadowShader("shaders/lighting_shader.vs", "shaders/lighting_shader.fs",
+                           ShaderVariants::defines(SHADER_DEPTH_ONLY) + "#define POINT_SHADOW_PASS\n", "shaders/point_shadow.gs");
+  shaderBatch.add(&upscaleShader);
+  shaderBatch.add(&overdrawHeatShader);
+  shaderBatch.add(&pointShadowShader);
+
   /* texture loading */
   std::vector<std::string> vfaces = {
     "images/skybox/tutorial/right.jpg",
@@ -756,35 +2273,72 @@ int main(int argc, char** argv)
 
   // flip the rest of the images around vertically
   stbi_set_flip_vertically_on_load(true);
-  unsigned int container = loadTexture(1, "images/container.jpg");
-  unsigned int container2 = loadTexture(2, "images/container2.png");
-  unsigned int container2_specular = loadTexture(3, "images/container2_specular.png");
-  unsigned int container2_emission_map = loadTexture(4, "images/container2_emission_map.png");
-  unsigned int generic01 = loadTexture(5, "images/altdev/generic-07.png");
-  unsigned int generic02 = loadTexture(6, "images/altdev/generic-12.png");
-  unsigned int awesomeface = loadTexture(7, "images/awesomeface.png");
-  unsigned int matrixTexture = loadTexture(8, "images/matrix.jpg");
-  unsigned int blankTexture = loadTexture(9, "images/1x1.png");
+  unsigned int container = loadTexture(1, "images/container.jpg", softRaster);
+  unsigned int container2 = loadTexture(2, "images/container2.png", softRaster);
+  unsigned int container2_specular = loadTexture(3, "images/container2_specular.png", softRaster);
+  unsigned int container2_emission_map = loadTexture(4, "images/container2_emission_map.png", softRaster);
+  unsigned int generic01 = loadTexture(5, "images/altdev/generic-07.png", softRaster);
+  unsigned int generic02 = loadTexture(6, "images/altdev/generic-12.png", softRaster);
+  unsigned int awesomeface = loadTexture(7, "images/awesomeface.png", softRaster);
+  unsigned int matrixTexture = loadTexture(8, "images/matrix.jpg", softRaster);
+  unsigned int blankTexture = loadTexture(9, "images/1x1.png", softRaster);
 
   // for some reason the skybox is flipped differently
   stbi_set_flip_vertically_on_load(false);
-  unsigned int skyboxTexture = loadCubemap(10, vfaces);
+  unsigned int skyboxTexture = loadCubemap(10, vfaces, softRaster);
+
+  // voxel tiles, in VOXEL_LAYER_* order
+  const char *voxelTiles[] = { "images/grasstop.png", "images/grass.png" };
+  stbi_set_flip_vertically_on_load(true);
+  unsigned int voxelTextures = loadTextureArray(11, voxelTiles, 2);
 
   /* end texture loading */
-  Shader lightingShader("shaders/lighting_shader.vs", "shaders/lighting_shader.fs");
-  Shader lightCubeShader("shaders/light_cube_shader.vs", "shaders/light_cube_shader.fs");
-  Shader skyboxShader("shaders/skybox_shader.vs", "shaders/skybox_shader.fs");
-  Shader debugDepthShader("shaders/lighting_shader.vs", "shaders/debug_quad.fs");
 
   glm::vec3 defaultAmbientColor = glm::vec3(0.2f);
   //                                            (shader,           specular,            shininess,  diffuse,       ambient,             emissionVals,  emissionMap);
-  Material *containerMaterial   = createMaterial(&lightingShader,  blankTexture,        16.0f,      container,     defaultAmbientColor, blankTexture,  blankTexture);
-  Material *container2Material  = createMaterial(&lightingShader,  container2_specular, 16.0f,      container2,    defaultAmbientColor, matrixTexture, container2_emission_map);
-  Material *awesomefaceMaterial = createMaterial(&lightingShader,  blankTexture,        64.0f,      awesomeface,   defaultAmbientColor, awesomeface,   awesomeface);
-  Material *generic01Material   = createMaterial(&lightingShader,  blankTexture,        16.0f,      generic01,     defaultAmbientColor, blankTexture,  blankTexture);
-  Material *generic02Material   = createMaterial(&lightingShader,  blankTexture,        16.0f,      generic02,     defaultAmbientColor, blankTexture,  blankTexture);
+  Material *containerMaterial   = createMaterial(NULL,             blankTexture,        16.0f,      container,     defaultAmbientColor, blankTexture,  blankTexture);
+  Material *container2Material  = createMaterial(NULL,             container2_specular, 16.0f,      container2,    defaultAmbientColor, matrixTexture, container2_emission_map);
+  Material *awesomefaceMaterial = createMaterial(NULL,             blankTexture,        64.0f,      awesomeface,   defaultAmbientColor, awesomeface,   awesomeface);
+  Material *generic01Material   = createMaterial(NULL,             blankTexture,        16.0f,      generic01,     defaultAmbientColor, blankTexture,  blankTexture);
+  Material *generic02Material   = createMaterial(NULL,             blankTexture,        16.0f,      generic02,     defaultAmbientColor, blankTexture,  blankTexture);
   Material *skyboxMaterial      = createMaterial(&skyboxShader,    blankTexture,        16.0f,      skyboxTexture, defaultAmbientColor, blankTexture,  blankTexture);
   Material *depthMaterial       = createMaterial(&debugDepthShader, blankTexture,       16.0f,      generic01,  defaultAmbientColor, blankTexture,  blankTexture);
+  Material *voxelMaterial       = createMaterial(NULL,             blankTexture,        16.0f,      blankTexture,  defaultAmbientColor, blankTexture,  blankTexture);
+  voxelMaterial->features = SHADER_VOXEL; // diffuse comes from the voxel texture array
+  Material *litMaterials[] = { containerMaterial, container2Material, awesomefaceMaterial, generic01Material, generic02Material, voxelMaterial };
+  unsigned int numLitMaterials = sizeof(litMaterials) / sizeof(litMaterials[0]);
+  UniformBuffer materialBuffer(sizeof(MaterialConstants), MAX_NUM_OF_MATERIALS);
+  UniformBuffer passConstants(sizeof(FrameConstants), 2); // FOR_REAL and FOR_DEPTH
+
+  for (unsigned int i = 0; i < numLitMaterials; i++) {
+    attachMaterialBuffer(litMaterials[i], &materialBuffer);
+  }
+
+  attachMaterialBuffer(skyboxMaterial, &materialBuffer);
+  attachMaterialBuffer(depthMaterial, &materialBuffer);
+
+  // submit every permutation the scene can ask for now, so they compile in parallel
+  // rather than one at a time as the light count crosses a bucket
+  lightingVariants.get(SHADER_DEPTH_ONLY);
+  lightingVariants.get(SHADER_OVERDRAW);
+
+  for (unsigned int i = 0; i < numLitMaterials; i++) {
+    useShaderVariants(litMaterials[i], &lightingVariants, blankTexture);
+
+    if (pointShadows) {
+      litMaterials[i]->features |= SHADER_POINT_SHADOWS;
+    }
+
+    if (gpuAnimation) {
+      litMaterials[i]->features |= SHADER_GPU_LIGHTS;
+    }
+
+    lightingVariants.get(litMaterials[i]->features | lightBucket(0));
+    lightingVariants.get(litMaterials[i]->features | lightBucket(16));
+    lightingVariants.get(litMaterials[i]->features | lightBucket(MAX_NUM_OF_LIGHTS));
+  }
+
+  shaderBatch.report();
 
   /* declare vertices */
   float vertices_cube[] = {
@@ -901,7 +2455,6 @@ int main(int argc, char** argv)
   unsigned int depthMapFBO;
   glGenFramebuffers(1, &depthMapFBO);
 
-  const unsigned int SHADOW_WIDTH = 8192, SHADOW_HEIGHT = 8192;
   unsigned int depthMap;
   glGenTextures(1, &depthMap);
   glBindTexture(GL_TEXTURE_2D, depthMap);
@@ -920,17 +2473,32 @@ int main(int argc, char** argv)
   glReadBuffer(GL_NONE);
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+  // every point light's shadows share one atlas; created after the fixed texture ids above
+  PointShadowAtlas *pointShadowAtlas = pointShadows ? new PointShadowAtlas(MAX_NUM_OF_LIGHTS) : NULL;
+
   Mesh *cubeMesh = createMesh(vertices_cube, 36, sizeof(vertices_cube), WITH_ATTRIBUTES);
   Mesh *planeMesh = createMesh(vertices_plane, 6, sizeof(vertices_plane), WITH_ATTRIBUTES);
   Mesh *quadMesh = createMesh(vertices_quad, 6, sizeof(vertices_quad), WITH_ATTRIBUTES);
   Mesh *skyboxMesh = createMesh(vertices_skybox, 36, sizeof(vertices_skybox), WITHOUT_ATTRIBUTES);
 
+  unsigned int cubeMeshId = addMesh(&scene, cubeMesh);
+  unsigned int quadMeshId = addMesh(&scene, quadMesh);
+  InstanceBuffer instanceBuffer;
+  scene.instances = &instanceBuffer;
+
+  // point light material is all blanks; every light cube shares it and gets its color per draw
+  Material *pointLightMaterial  = createMaterial(&lightCubeShader, blankTexture,        16.0f,      blankTexture,  defaultAmbientColor, blankTexture,  blankTexture);
+  attachMaterialBuffer(pointLightMaterial, &materialBuffer);
+
+  for (unsigned int i = 0; i < numLitMaterials; i++) {
+    addMaterial(&scene, litMaterials[i]);
+  }
+
+  addMaterial(&scene, pointLightMaterial);
+  addMaterial(&scene, depthMaterial);
+
   for (int i = 0; i < MAX_NUM_OF_LIGHTS; i++) {
     glm::vec3 pos;
-    // point light material is all blanks -- materials will need to be refactored later
-    // also though: we need 1 material / light, because they are all unique colors, changing at their own rates!
-    // corresponding frees in destroyPointLight
-    Material *pointLightMaterial  = createMaterial(&lightCubeShader, blankTexture,        16.0f,      blankTexture,  defaultAmbientColor, blankTexture,  blankTexture);
 
     if (i < 10) {
       pos = pointLightPositions[i];
@@ -938,26 +2506,76 @@ int main(int argc, char** argv)
       pos = glm::vec3((i % 11) * 0.3f, (i % 13) * 0.3f, (i % 17) * 0.6f);
     }
 
-    pointLights[i] = createPointLight(cubeMesh, pointLightMaterial, pos);
+    addPointLight(&pointLights, &scene.entities, cubeMeshId, pointLightMaterial->id, pos);
+  }
+
+  // the walls and the ground never move, so they're merged into a few static draws
+  InstanceBuffer identityInstance;
+  InstanceTransform identity = identityTransform();
+  identityInstance.upload(&identity, 1);
+
+  StaticBatchBuilder staticBatches(STATIC_CHUNK_SIZE);
+  createWalls(&staticBatches, cubeMesh, generic01Material->id);
+  addStaticObject(&staticBatches, planeMesh, generic02Material->id, glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(100.0f, 0.0f, 100.0f));
+  scene.staticChunks = staticBatches.build(&identityInstance);
+
+  // the terrain is meshed in the background; chunks show up as their workers finish
+  // (not at all when the software rasterizer is drawing; it would only compete for the cores)
+  VoxelWorld *voxelWorld = NULL;
+
+  if (!software) {
+    unsigned int meshThreads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1;
+    voxelWorld = new VoxelWorld(glm::ivec3(VOXEL_CHUNKS_X, VOXEL_CHUNKS_Y, VOXEL_CHUNKS_Z), glm::vec3(-128.5f, -64.5f, -128.5f), meshThreads);
+    fillTerrain(voxelWorld);
   }
 
+  scene.voxels = voxelWorld;
+  scene.voxelMaterialId = voxelMaterial->id;
+  scene.cullEntities = !gpuAnimation;
+
+  // the flying cubes' spin is a pure function of time, so it's set up once and animate() does the rest
   for (int i = 0; i < numFlyingCubes; i++) {
+    Material *mat = i == awesomeface_index ? awesomefaceMaterial : container2Material;
+    EntityHandle cube = scene.entities.create(cubeMeshId, mat->id, cubePositions[i], ALL_PASSES);
+    unsigned int index = scene.entities.indexOf(cube);
+    float angle = 20.0f * i;
+
     if (i == awesomeface_index) {
-      flyingCubes[i] = createGameObject(cubeMesh, awesomefaceMaterial, cubePositions[i]);
+      scene.entities.rotationAxes[index] = glm::vec3(1.0f, 1.0f, 0.5f);
+      scene.entities.spinRates[index] = glm::radians(angle);
+    } else if (i % 3 == 0) {
+      scene.entities.rotationAxes[index] = glm::vec3(1.0f, 0.3f, 0.5f);
+      scene.entities.spinRates[index] = glm::radians(angle);
+    } else if (i % 2 == 0) {
+      scene.entities.rotationAxes[index] = glm::vec3(0.3f, 0.1f, 0.5f);
+      scene.entities.spinRates[index] = glm::radians(angle);
     } else {
-      flyingCubes[i] = createGameObject(cubeMesh, container2Material, cubePositions[i]);
+      scene.entities.rotationAxes[index] = glm::vec3(1.0f, 0.3f, 0.5f);
+      scene.entities.baseAngles[index] = angle; // no change to angle
     }
   }
 
-  GameObject *plane = createGameObject(planeMesh, generic02Material, glm::vec3(0.0f, -0.5f, 0.0f));
-  GameObject *debugQuad = createGameObject(quadMesh, depthMaterial, glm::vec3(1.0f, 0.5f, 0.0f));
-  GameObject *wall = createGameObject(cubeMesh, generic01Material, glm::vec3(0.0f));
+  // a spinning cluster: only the centre cube is animated, the satellites just follow it
+  EntityHandle cluster = scene.entities.create(cubeMeshId, containerMaterial->id, glm::vec3(6.0f, 2.5f, -8.0f), ALL_PASSES);
+  scene.entities.rotationAxes[scene.entities.indexOf(cluster)] = glm::vec3(0.0f, 1.0f, 0.2f);
+  scene.entities.spinRates[scene.entities.indexOf(cluster)] = glm::radians(45.0f);
+
+  for (int i = 0; i < 6; i++) {
+    glm::vec3 offset(0.0f);
+    offset[i % 3] = i < 3 ? 1.5f : -1.5f;
+    EntityHandle satellite = scene.entities.create(cubeMeshId, containerMaterial->id, offset, ALL_PASSES);
+    scene.entities.scales[scene.entities.indexOf(satellite)] = glm::vec3(0.4f);
+    scene.entities.setParent(satellite, cluster);
+  }
+
+  // in no pass; it's drawn by hand with the depth map on it
+  EntityHandle debugQuad = scene.entities.create(quadMeshId, depthMaterial->id, glm::vec3(1.0f, 0.5f, 0.0f), 0);
+  scene.entities.rotationAxes[scene.entities.indexOf(debugQuad)] = glm::vec3(1.0f, 0.0f, 0.0f);
+  scene.entities.baseAngles[scene.entities.indexOf(debugQuad)] = glm::radians(90.0f);
+  depthMaterial->diffuseTexture = depthMap;
+  depthMaterial->specularTexture = depthMap;
+
   GameObject *skybox = createGameObject(skyboxMesh, skyboxMaterial, glm::vec3(0.0f));
-  plane->scale = glm::vec3(100.0f, 0.0f, 100.0f);
-  debugQuad->rot = glm::vec3(1.0f, 0.0f, 0.0f);
-  debugQuad->angle = glm::radians(90.0f);
-  debugQuad->mat->diffuseTexture = depthMap;
-  debugQuad->mat->specularTexture = depthMap;
 
   // un-comment to use wireframe mode:
   // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -967,120 +2585,292 @@ int main(int argc, char** argv)
   skyboxShader.setInt("skybox", skyboxTexture);
   debugDepthShader.use();
   debugDepthShader.setInt("depthMap", depthMap);
-  lightingShader.use(); // don't forget to activate the shader before setting uniforms!
-  lightingShader.setInt("skybox", skyboxTexture);
-  lightingShader.setInt("shadowMap", depthMap);
 
-  // set up lighting -- actually, these seem unused!
-  sendPointLightAttenuations(&lightingShader, pointLights, MAX_NUM_OF_LIGHTS);
+  FrameHandoff<FramePacket, PACKETS_IN_FLIGHT> packets;
+  Renderer renderer;
+  renderer.window = window;
+  renderer.scene = &scene;
+  renderer.skybox = skybox;
+  renderer.pointLights = &pointLights;
+  renderer.dirLight = &dirLight;
+  renderer.lightingVariants = &lightingVariants;
+  renderer.debugDepthShader = &debugDepthShader;
+  renderer.depthMaterial = depthMaterial;
+  renderer.debugQuad = debugQuad;
+  renderer.passConstants = &passConstants;
+  renderer.identityInstance = &identityInstance;
+  renderer.depthMapFBO = depthMapFBO;
+  renderer.depthMap = depthMap;
+  renderer.skyboxTexture = skyboxTexture;
+  renderer.voxelTextures = voxelTextures;
+  renderer.packets = &packets;
+  FramePacer pacer(targetFps, maxQueuedFrames > 0 ? maxQueuedFrames : 0);
+  renderer.pacer = &pacer;
+  DynamicResolution resolution(gpuBudgetMs, 0.5f);
+  renderer.resolution = &resolution;
+  renderer.upscaleShader = &upscaleShader;
+  renderer.pointShadows = pointShadowAtlas;
+  renderer.pointShadowShader = &pointShadowShader;
+  renderer.soft = softRaster;
+  renderer.softTexture = 0;
+  renderer.softFBO = 0;
+  renderer.softWidth = 0;
+  renderer.softHeight = 0;
+  renderer.recorder = NULL;
+  renderer.animator = NULL;
+  renderer.indirect = new IndirectDraws((GLADloadproc)glfwGetProcAddress);
+  renderer.prepass = new DepthPrepass(depthPrepass);
+  renderer.stats = new PipelineStats();
+  renderer.heatMap = new OverdrawHeatMap(&overdrawHeatShader);
+
+  // both programs link with their outputs named, in InstanceTransform / animatedLights order
+  static const char *const lightOutputs[] = { "lightPos", "lightColor", "lightAttenuation" };
+  static const char *const entityOutputs[] = { "model", "normalMatrix" };
+  Shader *animateLightsShader = NULL;
+  Shader *animateEntitiesShader = NULL;
+
+  if (gpuAnimation) {
+    animateLightsShader = new Shader("shaders/animate.vs", "shaders/animate.fs", "#define ANIMATE_LIGHTS\n", NULL, lightOutputs, 3);
+    animateEntitiesShader = new Shader("shaders/animate.vs", "shaders/animate.fs", "", NULL, entityOutputs, 2);
+    renderer.animator = new GpuAnimator(animateLightsShader, animateEntitiesShader);
+    setupGpuAnimation(renderer.animator, &scene, &pointLights);
+    printf("gpu animation: %u lights, %u entities\n", renderer.animator->numLights, renderer.animator->numEntities);
+  }
+
+  // the first lights get an emitter each, alternating between sparks and drifting dust,
+  // and each only runs while its light is on; the spinning cluster always throws sparks
+  static const char *const particleOutputs[] = { "posAge", "velLife" };
+  Shader *particleSimShader = NULL;
+  Shader *particleShader = NULL;
+  renderer.particles = NULL;
+
+  if (numParticles > 0) {
+    particleSimShader = new Shader("shaders/particle_sim.vs", "shaders/animate.fs", "", NULL, particleOutputs, 2);
+    particleShader = new Shader("shaders/particle.vs", "shaders/particle.fs");
+    renderer.particles = new ParticleSystem(numParticles, particleSimShader, particleShader);
+
+    for (int i = 0; i < MAX_NUM_OF_LIGHTS && i < MAX_PARTICLE_EMITTERS - 1; i++) {
+      ParticleEmitter emitter;
+      emitter.entity = scene.entities.indexOf(pointLights.cubes[i]);
+      emitter.light = i;
+
+      if (i % 2 == 0) {
+        emitter.speed = 2.5f;
+        emitter.gravity = 6.0f;
+        emitter.lifetime = 1.2f;
+        emitter.spread = 0.1f;
+        emitter.color = glm::vec3(0.6f, 0.33f, 0.12f);
+        emitter.size = 0.03f;
+      } else {
+        emitter.speed = 0.15f;
+        emitter.gravity = -0.05f;
+        emitter.lifetime = 6.0f;
+        emitter.spread = 1.2f;
+        emitter.color = glm::vec3(0.09f, 0.09f, 0.08f);
+        emitter.size = 0.02f;
+      }
+
+      renderer.particles->addEmitter(emitter);
+    }
 
-  lightingShader.setVec3f("dirLight.dir", dirLight.dir.x, dirLight.dir.y, dirLight.dir.z);
-  lightingShader.setVec3f("dirLight.diffuse", dirLight.diffuse.r, dirLight.diffuse.g, dirLight.diffuse.b);
-  lightingShader.setVec3f("dirLight.ambient", dirLight.ambient.r, dirLight.ambient.g, dirLight.ambient.b);
+    ParticleEmitter clusterSparks;
+    clusterSparks.entity = scene.entities.indexOf(cluster);
+    clusterSparks.light = -1;
+    clusterSparks.speed = 4.0f;
+    clusterSparks.gravity = 9.8f;
+    clusterSparks.lifetime = 0.8f;
+    clusterSparks.spread = 0.6f;
+    clusterSparks.color = glm::vec3(0.4f, 0.5f, 0.7f);
+    clusterSparks.size = 0.025f;
+    renderer.particles->addEmitter(clusterSparks);
+    renderer.particles->start();
+  }
+
+  if (recordDest) {
+    unsigned int cores = std::thread::hardware_concurrency();
+    renderer.recorder = new FrameRecorder(recordFormat, recordDest, recordWidth, recordHeight, recordFps, cores > 2 ? cores - 2 : 1);
+  }
+
+  if (softRaster) {
+    renderer.softMaterials.resize(scene.materials.size());
+
+    for (unsigned int i = 0; i < scene.materials.size(); i++) {
+      if (scene.materials[i]) {
+        renderer.softMaterials[i] = softMaterialFor(scene.materials[i]);
+      }
+    }
+
+    renderer.softLightCubes.assign(MAX_NUM_OF_LIGHTS, softMaterialFor(pointLightMaterial));
+    glGenTextures(1, &renderer.softTexture);
+    glGenFramebuffers(1, &renderer.softFBO);
+  }
+
+  printf("frame pacing: swap interval %d, %d fps limit, %d queued frames at most\n", swapInterval, targetFps, maxQueuedFrames);
+
+  for (unsigned int i = 0; i < PACKETS_IN_FLIGHT; i++) {
+    initFramePacket(packets.slot(i));
+  }
+
+  // from here on the render thread owns the context; the main thread only simulates
+  std::thread renderWorker;
+
+  if (renderThread) {
+    glfwMakeContextCurrent(NULL);
+    renderWorker = std::thread(renderThreadMain, &renderer);
+  }
+
+  unsigned int frameNumber = 0;
+  // process-wide counts: the render thread and the mesh workers allocate into them too,
+  // so they only say how the whole program does once warmed up, not which frame or thread
+  unsigned long long startupAllocations = allocationCount();
+  unsigned long long warmAllocations = startupAllocations;
 
   /* Loop until the user closes the window */
   while (!glfwWindowShouldClose(window)) {
-    float currentFrame = glfwGetTime();
+    // input is read as late as possible: after the limiter, right before it's simulated
+    pacer.waitForNextFrame();
+    glfwPollEvents();
+
+    double inputTime = FramePacer::now();
+    float currentFrame = renderer.recorder ? (float)frameNumber / recordFps : glfwGetTime();
     deltaTime = currentFrame - lastFrame;
     lastFrame = currentFrame;
 
-    processInput(window, &cam);
-    processCamera(&cam, deltaTime, currentFrame);
+    if (renderer.recorder) {
+      followCameraPath(&cam, &cameraPath, currentFrame);
+    } else {
+      processInput(window, &cam);
+      processCamera(&cam, deltaTime, currentFrame);
+    }
 
     int lightsUsed = (int)floor(cam.lightsUsedControl);
-    // updating pointLight pos+color in the lightingShader on the GPU:
-    updatePointLights(pointLights, lightsUsed);
-
-    // updating positions of each flyingCube in cpu
-    for (unsigned int i = 0; i < 10; i++) {
-      float angle = 20.0f * i;
-
-      if (i == awesomeface_index) {
-        flyingCubes[i]->rot = glm::vec3(1.0f, 1.0f, 0.5f);
-        flyingCubes[i]->angle = (float)glfwGetTime() * glm::radians(angle);
-      } else if (i % 3 == 0) {
-        flyingCubes[i]->rot = glm::vec3(1.0f, 0.3f, 0.5f);
-        flyingCubes[i]->angle = (float)glfwGetTime() * glm::radians(angle);
-      } else if (i % 2 == 0) {
-        flyingCubes[i]->rot = glm::vec3(0.3f, 0.1f, 0.5f);
-        flyingCubes[i]->angle = (float)glfwGetTime() * glm::radians(angle);
-      } else if (i <= 10) {
-        flyingCubes[i]->rot = glm::vec3(1.0f, 0.3f, 0.5f);
-        flyingCubes[i]->angle = angle; // no change to angle
+
+    // with --gpu-animation the render thread does both of these on the gpu, from the
+    // frame's time alone
+    if (!renderer.animator) {
+      // moving the lights and their cubes around on the CPU; the packet carries them to the GPU
+      updatePointLights(&pointLights, &scene.entities, lightsUsed, currentFrame);
+
+      // spinning the flying cubes; the model+normal matrices are rebuilt just below
+      scene.entities.animate(currentFrame);
+    }
+
+    // rebuilding the model+normal matrices of whatever moved (and everything hanging off
+    // it); the packet takes just that range to the gpu
+    scene.entities.updateTransforms();
+
+    // the real framebuffer size; it's twice the window size on retina displays
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+    if (renderer.recorder) {
+      framebufferWidth = recordWidth; // the offscreen target is what gets recorded, not the window
+      framebufferHeight = recordHeight;
+    }
+
+    // waits only if the render thread is still on the frame before last
+    FramePacket *packet = packets.beginWrite();
+    buildFramePacket(packet, &scene, &pointLights, lightsUsed, lightBudget, &cam, currentFrame,
+                     framebufferWidth > 0 ? framebufferWidth : 1, framebufferHeight > 0 ? framebufferHeight : 1);
+    packet->inputTime = inputTime;
+    packets.endWrite();
+
+    if (!renderThread) {
+      if (renderer.soft) {
+        softRenderFrame(&renderer, packets.beginRead());
+      } else {
+        renderFrame(&renderer, packets.beginRead());
       }
+
+      packets.endRead();
     }
 
-    // proj and view set up for depth buffer
-    float near_plane = 10.0f, far_plane = 64.0f;
-    glm::mat4 projection = glm::ortho(-32.0f, 32.0f, -32.0f, 32.0f, near_plane, far_plane);
-    glm::mat4 view = glm::lookAt(glm::vec3(-15.0f, 19.0f, -30.0f),
-                                 glm::vec3(0.0f, 0.0f,  0.0f),
-                                 glm::vec3(0.0f, 1.0f,  0.0f));
-    glm::mat4 lightSpaceMatrix = projection * view;
-    unsigned int lightSpaceLoc = glGetUniformLocation(lightingShader.ID, "lightSpaceMatrix");
-    glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-    // lights begin
-    lightingShader.use(); // used for everything kinda
-    lightingShader.setInt("lightsUsed", lightsUsed);
-    lightingShader.setVec3f("viewPos", cam.pos.x, cam.pos.y, cam.pos.z);  // this is the "player cam pos" :/
-
-    sendPointLightColors(&lightingShader, pointLights, lightsUsed);
-    sendPointLightPositions(&lightingShader, pointLights, lightsUsed);
-
-    // for shadow mapping:
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    glCullFace(GL_FRONT);
-    // render to depth buffer
-    renderScene(skybox, wall, plane, flyingCubes, numFlyingCubes, &lightCubeShader, pointLights, lightsUsed, view, projection, FOR_DEPTH);
-
-    // put framebuffer back to normal
-    glCullFace(GL_BACK);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, WINDOW_WIDTH * 2, WINDOW_HEIGHT * 2);
-    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear the buffers
-
-    projection = glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
-    view = glm::lookAt(cam.pos, cam.pos + cam.front, cam.up);
-
-    debugDepthShader.use();
-    debugDepthShader.setFloat("near_plane", near_plane);
-    debugDepthShader.setFloat("far_plane", far_plane);
-    glActiveTexture(GL_TEXTURE0 + depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    renderGameObject(debugQuad, view, projection);
-    renderScene(skybox, wall, plane, flyingCubes, numFlyingCubes, &lightCubeShader, pointLights, lightsUsed, view, projection, FOR_REAL);
-
-    /* Swap front and back buffers */
-    glfwSwapBuffers(window);
-
-    /* Poll for and process events */
-    glfwPollEvents();
+    // once warmed up, nothing should touch the heap at all
+    if (++frameNumber == WARMUP_FRAMES) {
+      warmAllocations = allocationCount();
+    }
+
+    if (renderer.recorder && frameNumber >= (unsigned int)recordFrames) {
+      glfwSetWindowShouldClose(window, GLFW_TRUE);
+    }
   }
 
-  for (int i = 0; i < MAX_NUM_OF_LIGHTS; i++) {
-    // these materials are created one-per-light so the lights can be unique colors
-    destroyMaterial(pointLights[i]->gameObject->mat);
-    destroyPointLight(pointLights[i]);
+  // taken before shutdown, which allocates a little of its own
+  unsigned long long steadyAllocations = frameNumber > WARMUP_FRAMES ? allocationCount() - warmAllocations : 0;
+
+  if (renderThread) {
+    packets.beginWrite()->quit = true;
+    packets.endWrite();
+    renderWorker.join();
+    glfwMakeContextCurrent(window);
   }
 
-  for (int i = 0; i < numFlyingCubes; i++) {
-    destroyGameObject(flyingCubes[i]);
+  // the last few frames are still on their way out
+  if (renderer.recorder) {
+    renderer.recorder->finish();
+    renderer.recorder->release();
+    delete renderer.recorder;
+  }
+
+  pacer.release();
+  resolution.release();
+  delete pointShadowAtlas;
+
+  renderer.indirect->release();
+  delete renderer.indirect;
+  renderer.prepass->release();
+  delete renderer.prepass;
+  renderer.stats->release();
+  delete renderer.stats;
+  renderer.heatMap->release();
+  delete renderer.heatMap;
+
+  if (renderer.particles) {
+    renderer.particles->release();
+    delete renderer.particles;
+    delete particleSimShader;
+    delete particleShader;
+  }
+
+  if (renderer.animator) {
+    renderer.animator->release();
+    delete renderer.animator;
+    delete animateLightsShader;
+    delete animateEntitiesShader;
+  }
+
+  if (softRaster) {
+    glDeleteTextures(1, &renderer.softTexture);
+    glDeleteFramebuffers(1, &renderer.softFBO);
+    delete softRaster;
   }
 
-  free(flyingCubes);
-  free(pointLights);
+  unsigned int arenaPeak = 0;
+
+  for (unsigned int i = 0; i < PACKETS_IN_FLIGHT; i++) {
+    packets.slot(i)->arena->reset();
+    arenaPeak = packets.slot(i)->arena->highWater > arenaPeak ? packets.slot(i)->arena->highWater : arenaPeak;
+    destroyFramePacket(packets.slot(i));
+  }
+
+  printf("heap allocations (whole process): %llu during startup, %llu over %u steady-state frames (frame packet arena peak %u bytes)\n",
+         startupAllocations, steadyAllocations, frameNumber > WARMUP_FRAMES ? frameNumber - WARMUP_FRAMES : 0, arenaPeak);
+
+  destroyGameObject(skybox);
+  destroyMaterial(pointLightMaterial);
+  destroyMaterial(depthMaterial);
   destroyMaterial(containerMaterial);
   destroyMaterial(container2Material);
   destroyMaterial(awesomefaceMaterial);
   destroyMaterial(generic01Material);
   destroyMaterial(generic02Material);
   destroyMaterial(skyboxMaterial);
+  destroyMaterial(voxelMaterial);
   destroyMesh(cubeMesh);
   destroyMesh(planeMesh);
+  destroyMesh(quadMesh);
   destroyMesh(skyboxMesh);
+  delete voxelWorld;
 
   glfwTerminate();
   return 0;